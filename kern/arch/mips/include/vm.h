@@ -127,13 +127,16 @@ paddr_t ram_getfirstfree(void);
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
+ *
+ * A shootdown names pages rather than an address space: the TLB is
+ * flushed whenever a cpu switches to another address space, so any
+ * entry it has for these pages is either the stale one or harmless
+ * to drop.
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;	/* first page */
+	unsigned ts_npages;	/* number of pages, or 0 for the whole TLB */
 };
 
 #define TLBSHOOTDOWN_MAX 16
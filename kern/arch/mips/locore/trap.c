@@ -203,6 +203,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If another thread has made the process exit, don't
+		 * go back to user mode (see below). Turn interrupts
+		 * back on first, the same way as for other traps.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			proc_exit(0);
+		}
 		goto done2;
 	}
 
@@ -323,6 +334,15 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/*
+	 * Threads of a process that is exiting leave here rather than
+	 * going back to user mode. The status was set by whichever
+	 * thread called _exit, so the one passed here is ignored.
+	 */
+	if (!iskern && curproc->p_exiting) {
+		proc_exit(0);
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
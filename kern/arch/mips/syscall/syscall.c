@@ -37,6 +37,7 @@
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -113,6 +114,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 
 	    /* process calls */
 
@@ -142,6 +148,97 @@ syscall(struct trapframe *tf)
 		err = sys_getpid(&retval);
 		break;
 
+	    case SYS_getrlimit:
+		err = sys_getrlimit(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_setrlimit:
+		err = sys_setrlimit(tf->tf_a0, (const_userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_getpriority:
+		err = sys_getpriority(tf->tf_a0, tf->tf_a1, &retval);
+		break;
+
+	    case SYS_setpriority:
+		err = sys_setpriority(tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+
+
+	    /* virtual memory calls */
+
+#if !OPT_DUMBVM
+	    case SYS_madvise:
+		err = sys_madvise(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			tf->tf_a2);
+		break;
+
+	    case SYS_shmmap:
+		err = sys_shmmap(
+			(const_userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
+	    case SYS_shmunmap:
+		err = sys_shmunmap((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_shmunlink:
+		err = sys_shmunlink((const_userptr_t)tf->tf_a0);
+		break;
+#endif
+
+
+	    /* user-level synchronization */
+
+	    case SYS_futex:
+		err = sys_futex(
+			(userptr_t)tf->tf_a0,
+			tf->tf_a1,
+			tf->tf_a2,
+			&retval);
+		break;
+
+
+	    /* user threads */
+
+#if !OPT_DUMBVM
+	    case SYS___thread_create:
+		err = sys___thread_create(
+			(userptr_t)tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			(userptr_t)tf->tf_a2,
+			&retval);
+		break;
+
+	    case SYS_thread_join:
+		err = sys_thread_join(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_thread_exit:
+		sys_thread_exit(tf->tf_a0);
+		panic("Returning from thread_exit\n");
+#endif
+
+
+	    /* cpu affinity */
+
+	    case SYS_setaffinity:
+		err = sys_setaffinity(tf->tf_a0);
+		break;
+
+	    case SYS_getaffinity:
+		err = sys_getaffinity((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_pset_bind:
+		err = sys_pset_bind(tf->tf_a0, &retval);
+		break;
+
 
 	    /* file calls */
 
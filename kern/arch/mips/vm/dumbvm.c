@@ -38,6 +38,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <vmalloc.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -149,6 +150,21 @@ free_kpages(vaddr_t addr)
 
 #endif
 
+/*
+ * dumbvm has no kernel pagetable, so vmalloc is just kmalloc.
+ */
+void *
+vmalloc(size_t size)
+{
+	return kmalloc(size);
+}
+
+void
+vfree(void *ptr)
+{
+	kfree(ptr);
+}
+
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
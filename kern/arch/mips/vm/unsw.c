@@ -28,10 +28,14 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <compact.h>
+#include <shrinker.h>
+#include "opt-dumbvm.h"
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -40,19 +44,41 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 
 
 
-typedef struct ft_entry {
-        unsigned allocated:1; /* the corresponding frame is allocated */
-        unsigned not_last:1; /* the frame is part of a multiframe allocation */
-} ft_entry_t;
-
-
-static ft_entry_t * frame_table = NULL; /* base of frame table */
+/*
+ * The frame table. Each frame has a bit in frame_freemap, set if the
+ * frame is free, so that a scan can look at 32 frames per compare; a
+ * second-level summary bitmap has a bit per freemap word, set if that
+ * word has any free frame in it, so that a single free frame is found
+ * in two word scans. frame_notlast marks every frame of a multiframe
+ * allocation but the last, and frame_refcnt counts the mappings of a
+ * single frame shared by KSM.
+ *
+ * Frames below first_frame (the kernel and these tables) are never
+ * free, and neither are the bits past last_frame, so the scans need
+ * no bounds checks of their own.
+ */
+static uint32_t * frame_freemap = NULL;    /* 1 = frame free */
+static uint32_t * frame_summary = NULL;    /* 1 = freemap word not all used */
+static uint32_t * frame_notlast = NULL;    /* 1 = run continues past frame */
+static uint16_t * frame_refcnt = NULL;     /* references to a single frame */
+static uint32_t frame_nwords;              /* words in freemap and notlast */
+static uint32_t frame_nsummary;            /* words in the summary */
+
+static void ** frame_owner = NULL; /* per-frame descriptor (kmalloc pageref) */
+
+/* reverse map: the user mapping of a private frame, if it has one */
+struct frame_rmap {
+        struct addrspace *fr_as;
+        vaddr_t fr_vaddr;
+};
+static struct frame_rmap * frame_rmap = NULL;
 static uint32_t first_frame;
 static uint32_t last_frame;
 
 #define PAGE_BITS 12
-#define TRUE 1
-#define FALSE 0
+
+#define BIT(i)      ((uint32_t)1 << ((i) % 32))
+#define WORD(i)     ((i) / 32)
 
 
 /* frame_table protected by spinlock (interrupt disabling on
@@ -61,6 +87,90 @@ static uint32_t last_frame;
 
 static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * Index of the lowest set bit of a nonzero word. There is no ctz
+ * instruction on MIPS-I and no libgcc in the kernel, so binary search.
+ */
+static
+unsigned
+frame_lowbit(uint32_t w)
+{
+        unsigned n;
+
+        KASSERT(w != 0);
+        n = 0;
+        if ((w & 0xffff) == 0) {
+                n += 16;
+                w >>= 16;
+        }
+        if ((w & 0xff) == 0) {
+                n += 8;
+                w >>= 8;
+        }
+        if ((w & 0xf) == 0) {
+                n += 4;
+                w >>= 4;
+        }
+        if ((w & 0x3) == 0) {
+                n += 2;
+                w >>= 2;
+        }
+        if ((w & 0x1) == 0) {
+                n += 1;
+        }
+        return n;
+}
+
+static
+bool
+frame_isfree(uint32_t i)
+{
+        return (frame_freemap[WORD(i)] & BIT(i)) != 0;
+}
+
+static
+void
+frame_markused(uint32_t i)
+{
+        uint32_t w = WORD(i);
+
+        KASSERT(frame_freemap[w] & BIT(i));
+        frame_freemap[w] &= ~BIT(i);
+        if (frame_freemap[w] == 0) {
+                frame_summary[WORD(w)] &= ~BIT(w);
+        }
+}
+
+static
+void
+frame_markfree(uint32_t i)
+{
+        uint32_t w = WORD(i);
+
+        KASSERT((frame_freemap[w] & BIT(i)) == 0);
+        frame_freemap[w] |= BIT(i);
+        frame_summary[WORD(w)] |= BIT(w);
+}
+
+static
+bool
+frame_isnotlast(uint32_t i)
+{
+        return (frame_notlast[WORD(i)] & BIT(i)) != 0;
+}
+
+static
+void
+frame_setnotlast(uint32_t i, bool notlast)
+{
+        if (notlast) {
+                frame_notlast[WORD(i)] |= BIT(i);
+        }
+        else {
+                frame_notlast[WORD(i)] &= ~BIT(i);
+        }
+}
+
 /*
  * Called very early in system boot to figure out how much physical
  * RAM is available.
@@ -68,8 +178,8 @@ static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
 void
 ram_bootstrap(void)
 {
-	size_t ramsize, frametable_size;
-        uint32_t npages, i;
+	size_t ramsize, frameowner_size, framermap_size;
+        uint32_t npages, w;
 
 	/* Get size of RAM. */
 	ramsize = mainbus_ramsize();
@@ -107,12 +217,33 @@ ram_bootstrap(void)
         npages = lastpaddr / PAGE_SIZE; /* number of pages in ram */
         last_frame = npages;
 
-        frametable_size = npages * sizeof(ft_entry_t);
-        frametable_size = ROUNDUP(frametable_size,PAGE_SIZE);
-
         /* grab pages for the frame table and bump the first free address */
-        frame_table = (ft_entry_t *) PADDR_TO_KVADDR(firstpaddr);
-        firstpaddr += frametable_size;
+        frame_nwords = DIVROUNDUP(npages, 32);
+        frame_nsummary = DIVROUNDUP(frame_nwords, 32);
+
+        frame_freemap = (uint32_t *) PADDR_TO_KVADDR(firstpaddr);
+        firstpaddr += frame_nwords * sizeof(uint32_t);
+        frame_notlast = (uint32_t *) PADDR_TO_KVADDR(firstpaddr);
+        firstpaddr += frame_nwords * sizeof(uint32_t);
+        frame_summary = (uint32_t *) PADDR_TO_KVADDR(firstpaddr);
+        firstpaddr += frame_nsummary * sizeof(uint32_t);
+        frame_refcnt = (uint16_t *) PADDR_TO_KVADDR(firstpaddr);
+        firstpaddr += npages * sizeof(uint16_t);
+        firstpaddr = ROUNDUP(firstpaddr, PAGE_SIZE);
+
+        /* and the same again for the per-frame descriptors */
+        frameowner_size = npages * sizeof(void *);
+        frameowner_size = ROUNDUP(frameowner_size,PAGE_SIZE);
+
+        frame_owner = (void **) PADDR_TO_KVADDR(firstpaddr);
+        firstpaddr += frameowner_size;
+
+        /* and the reverse map */
+        framermap_size = npages * sizeof(struct frame_rmap);
+        framermap_size = ROUNDUP(framermap_size,PAGE_SIZE);
+
+        frame_rmap = (struct frame_rmap *) PADDR_TO_KVADDR(firstpaddr);
+        firstpaddr += framermap_size;
 
         if (firstpaddr >= lastpaddr) {
                 /* This should never happen */
@@ -120,29 +251,39 @@ ram_bootstrap(void)
                 
         }
 
-        /* Now initialise the frame table in two ranges. */
-
-        /* The first range of frames are used by the kernel already
-         * and frametable itself, so mark as used.
+        /*
+         * Everything starts out allocated, as single frames with no
+         * owner; this covers the frames used by the kernel already
+         * and by the frame table itself.
          */
+        bzero(frame_freemap, frame_nwords * sizeof(uint32_t));
+        bzero(frame_notlast, frame_nwords * sizeof(uint32_t));
+        bzero(frame_summary, frame_nsummary * sizeof(uint32_t));
+        bzero(frame_refcnt, npages * sizeof(uint16_t));
+        bzero(frame_owner, npages * sizeof(void *));
+        bzero(frame_rmap, npages * sizeof(struct frame_rmap));
 
-        for (i = 0; i < (firstpaddr >> PAGE_BITS); i++) {
-                /* Mark as allocated as individual pages */
-                frame_table[i].allocated = TRUE;
-                frame_table[i].not_last = FALSE;
-        }                                            
-        
         /* 
-         * The second range of frames are free
+         * The frames from first_frame on are free. Set their bits a
+         * word at a time.
          */
         
         first_frame = firstpaddr >> PAGE_BITS;
-        
-        for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
-                frame_table[i].allocated = FALSE;
-        }
 
-        
+        for (w = WORD(first_frame); w < frame_nwords; w++) {
+                frame_freemap[w] = 0xffffffff;
+                if (w == WORD(first_frame)) {
+                        /* not the frames below first_frame */
+                        frame_freemap[w] &= ~(BIT(first_frame) - 1);
+                }
+                if (w == WORD(last_frame) && BIT(last_frame) != 1) {
+                        /* nor those at or past last_frame */
+                        frame_freemap[w] &= BIT(last_frame) - 1;
+                }
+                if (frame_freemap[w] != 0) {
+                        frame_summary[WORD(w)] |= BIT(w);
+                }
+        }
 }
 
 /*
@@ -189,29 +330,28 @@ ram_getfirstfree(void)
 }
 
 /*
- * This is a relatively inefficient first-fit allocator. Single pages
- * always fit. Multiframe allocations can suffer from external
- * fragmentation. It is intended to be easy to understand and robust,
- * not efficient.
+ * This is a first-fit allocator. Single pages always fit, and are
+ * found through the summary bitmap in two word scans. Multiframe
+ * allocations can suffer from external fragmentation.
  */
 
 
 static paddr_t alloc_one_frame(unsigned int npages)
 {
-        unsigned int i;
+        uint32_t sw, w, i;
 
-        /* 
-         * Just scan from the start of the frame_table array for an
-         * unallocated block
-         */
-        
         KASSERT(npages == 1);
 
         spinlock_acquire(&frame_table_spinlock);
-        for (i =  first_frame; i < last_frame; i++) {
-                if (frame_table[i].allocated == FALSE) {
-                        frame_table[i].allocated = TRUE;
-                        frame_table[i].not_last = FALSE;
+        for (sw = 0; sw < frame_nsummary; sw++) {
+                if (frame_summary[sw] != 0) {
+                        w = sw * 32 + frame_lowbit(frame_summary[sw]);
+                        i = w * 32 + frame_lowbit(frame_freemap[w]);
+                        KASSERT(i >= first_frame && i < last_frame);
+
+                        frame_markused(i);
+                        frame_setnotlast(i, false);
+                        frame_refcnt[i] = 1;
 
                         spinlock_release(&frame_table_spinlock);
 
@@ -227,40 +367,53 @@ static paddr_t alloc_one_frame(unsigned int npages)
 
 static paddr_t alloc_multiple_frames(unsigned int npages)
 {
-        unsigned int i,j;
+        uint32_t i, j, start;
 
 
         /* scan from 'i' for the number of needed free frames. If an
          * allocated frame is encountered, restart the scan from after
-         * that point.
+         * that point. Whole words that are all used or all free are
+         * taken 32 frames at a time.
          */
         
 
         spinlock_acquire(&frame_table_spinlock);
 
-        i = first_frame; j = 0;
+        i = first_frame; start = i; j = 0;
 
-        while (i < (last_frame - npages) && j < npages) {
-                if (frame_table[i+j].allocated == TRUE) {
-                        i = i + j + 1; /* continue scan after allocated frame */
-                        j = 0;         /* restart the count */
+        while (i < last_frame && j < npages) {
+                if (i % 32 == 0 && frame_freemap[WORD(i)] == 0) {
+                        i += 32;           /* nothing free in this word */
+                        start = i;
+                        j = 0;
+                }
+                else if (i % 32 == 0 && frame_freemap[WORD(i)] == 0xffffffff) {
+                        i += 32;           /* all free */
+                        j += 32;
+                }
+                else if (!frame_isfree(i)) {
+                        i++;               /* continue scan after allocated frame */
+                        start = i;
+                        j = 0;             /* restart the count */
                 }
                 else {
-                        j = j + 1; /* increment count of free frames */
+                        i++;
+                        j++;               /* increment count of free frames */
                 }
         }
 
-        if  (j == npages) { /* we exited as we found the number of frames required. */
-                for (j = i; j < i + npages - 1; j++) {
-                        frame_table[j].allocated = TRUE; /* mark frame allocated */
-                        frame_table[j].not_last = TRUE;  /* as a contiguous block */
+        if (j >= npages && start + npages <= last_frame) {
+                /* we exited as we found the number of frames required. */
+                for (i = start; i < start + npages; i++) {
+                        frame_markused(i);
+                        frame_setnotlast(i, i < start + npages - 1);
+                        frame_refcnt[i] = 0;
                 }
-                frame_table[j].allocated = TRUE;
-                frame_table[j].not_last = FALSE;
+                frame_refcnt[start] = 1;
 
                 spinlock_release(&frame_table_spinlock);
                 
-                return (paddr_t) (i << PAGE_BITS);
+                return (paddr_t) (start << PAGE_BITS);
         }
         
         /* Did not find an unallocated contiguous range of frames :-( */
@@ -279,18 +432,31 @@ static void free_frames(vaddr_t vaddr)
         paddr = KVADDR_TO_PADDR(vaddr);
 
         i = paddr >> PAGE_BITS;
+        KASSERT(i >= first_frame && i < last_frame);
 
         spinlock_acquire(&frame_table_spinlock);
 
-        if (frame_table[i].allocated == FALSE) { /* check for double free error */
+        if (frame_isfree(i)) { /* check for double free error */
                 panic("Double free error!!");
         }
+
+        if (frame_refcnt[i] > 1) { /* still mapped elsewhere */
+                frame_refcnt[i]--;
+                spinlock_release(&frame_table_spinlock);
+                return;
+        }
+        frame_refcnt[i] = 0;
+        frame_owner[i] = NULL;
+        frame_rmap[i].fr_as = NULL;
         
-        while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
-                frame_table[i].allocated = FALSE;
-                if (frame_table[i].not_last == TRUE) {
-                        i++;
+        while (1) { /* otherwise mark block free */
+                KASSERT(!frame_isfree(i));
+                frame_markfree(i);
+                if (!frame_isnotlast(i)) {
+                        break;
                 }
+                frame_setnotlast(i, false);
+                i++;
         }
         spinlock_release(&frame_table_spinlock);
 }
@@ -300,13 +466,29 @@ vaddr_t
 alloc_kpages(unsigned npages)
 {
         paddr_t paddr;
-        if (npages > 1 ) {
-                paddr = alloc_multiple_frames(npages);
-        }
-        else {
-                paddr = alloc_one_frame(npages);
+        unsigned tries;
+
+        for (tries = 0; ; tries++) {
+                if (npages > 1 ) {
+                        paddr = alloc_multiple_frames(npages);
+#if !OPT_DUMBVM
+                        if (paddr == 0) {
+                                /* free frames may just be scattered: compact */
+                                paddr = compact_alloc(npages);
+                        }
+#endif
+                }
+                else {
+                        paddr = alloc_one_frame(npages);
+                }
+
+                /* out of frames: ask the caches to give some back, once. */
+                if (paddr != 0 || tries > 0 ||
+                    shrinker_run(npages, false) == 0) {
+                        break;
+                }
         }
-        
+
 	if (paddr == 0) {
 		return 0;
 	}
@@ -318,3 +500,187 @@ free_kpages(vaddr_t addr)
 {
         free_frames(addr);
 }
+
+/*
+ * Reference counts on single frames, so that a frame can be mapped by
+ * several address spaces at once (KSM merged pages). alloc_kpages
+ * hands out frames with one reference; free_kpages drops one and only
+ * frees the frame when the last goes.
+ */
+void
+frame_incref(vaddr_t addr)
+{
+        uint32_t i;
+
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(!frame_isfree(i));
+        KASSERT(!frame_isnotlast(i));
+        KASSERT(frame_refcnt[i] < 0xffff);
+        frame_refcnt[i]++;
+        spinlock_release(&frame_table_spinlock);
+}
+
+unsigned
+frame_refcount(vaddr_t addr)
+{
+        uint32_t i;
+        unsigned refcount;
+
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        refcount = frame_refcnt[i];
+        spinlock_release(&frame_table_spinlock);
+
+        return refcount;
+}
+
+/*
+ * Per-frame descriptors. The kernel heap records which of its pagerefs
+ * manages each subpage page here so kfree can find the owner of a
+ * block without searching. Frames with no owner (multi-page kmalloc
+ * allocations, user pages, anything outside RAM) read back as NULL.
+ *
+ * The descriptor belongs to whoever owns the frame and is synchronized
+ * by that owner's lock, so these do not take frame_table_spinlock.
+ */
+void
+frame_setowner(vaddr_t addr, void *owner)
+{
+        uint32_t i;
+
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        KASSERT(i >= first_frame && i < last_frame);
+        KASSERT(!frame_isfree(i));
+        KASSERT(owner == NULL || frame_owner[i] == NULL);
+        frame_owner[i] = owner;
+}
+
+void *
+frame_getowner(vaddr_t addr)
+{
+        uint32_t i;
+
+        if (addr < MIPS_KSEG0 || addr >= MIPS_KSEG1) {
+                return NULL;
+        }
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+        if (i < first_frame || i >= last_frame) {
+                return NULL;
+        }
+        return frame_owner[i];
+}
+
+/*
+ * Reverse map. The VM system records the address space and virtual
+ * address that map each private user frame, so that compaction can
+ * find the page table entry to update when it moves the frame. The
+ * entry is only a hint: it is not cleared when a page is merged or
+ * split by KSM, so whoever uses it must check the page table entry
+ * under the address space's lock. Freeing the frame clears it.
+ */
+void
+frame_setrmap(vaddr_t addr, struct addrspace *as, vaddr_t vaddr)
+{
+        uint32_t i;
+
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(&frame_table_spinlock);
+        KASSERT(i >= first_frame && i < last_frame);
+        KASSERT(!frame_isfree(i));
+        frame_rmap[i].fr_as = as;
+        frame_rmap[i].fr_vaddr = vaddr;
+        spinlock_release(&frame_table_spinlock);
+}
+
+/*
+ * Classify the frame at PADDR for compaction. A movable frame is a
+ * single allocated frame with one reference and a reverse map entry,
+ * which is handed back in *AS and *VADDR.
+ */
+int
+frame_info(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+        uint32_t i;
+        int state;
+
+        i = paddr >> PAGE_BITS;
+        if (i < first_frame || i >= last_frame) {
+                return FRAME_PINNED;
+        }
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (frame_isfree(i)) {
+                state = FRAME_FREE;
+        }
+        else if (!frame_isnotlast(i) &&
+                 frame_refcnt[i] == 1 &&
+                 frame_rmap[i].fr_as != NULL) {
+                *as = frame_rmap[i].fr_as;
+                *vaddr = frame_rmap[i].fr_vaddr;
+                state = FRAME_MOVABLE;
+        }
+        else {
+                state = FRAME_PINNED;
+        }
+        spinlock_release(&frame_table_spinlock);
+
+        return state;
+}
+
+/*
+ * Allocate the frame at PADDR if it is free. Returns EBUSY if it is
+ * not.
+ */
+int
+frame_claim(paddr_t paddr)
+{
+        uint32_t i;
+
+        i = paddr >> PAGE_BITS;
+        KASSERT(i >= first_frame && i < last_frame);
+
+        spinlock_acquire(&frame_table_spinlock);
+        if (!frame_isfree(i)) {
+                spinlock_release(&frame_table_spinlock);
+                return EBUSY;
+        }
+        frame_markused(i);
+        frame_setnotlast(i, false);
+        frame_refcnt[i] = 1;
+        spinlock_release(&frame_table_spinlock);
+
+        return 0;
+}
+
+/*
+ * Turn NPAGES single frames starting at PADDR, all allocated by the
+ * caller, into one multiframe allocation, as alloc_multiple_frames
+ * would have returned it.
+ */
+void
+frame_joinrun(paddr_t paddr, unsigned npages)
+{
+        uint32_t i, first;
+
+        first = paddr >> PAGE_BITS;
+        KASSERT(first >= first_frame && first + npages <= last_frame);
+
+        spinlock_acquire(&frame_table_spinlock);
+        for (i = first; i < first + npages; i++) {
+                KASSERT(!frame_isfree(i));
+                KASSERT(!frame_isnotlast(i));
+                KASSERT(frame_refcnt[i] == 1);
+                KASSERT(frame_owner[i] == NULL);
+                KASSERT(frame_rmap[i].fr_as == NULL);
+                frame_setnotlast(i, i < first + npages - 1);
+                if (i != first) {
+                        frame_refcnt[i] = 0;
+                }
+        }
+        spinlock_release(&frame_table_spinlock);
+}
@@ -119,6 +119,24 @@ mainbus_bootstrap(void)
 	mips_timer_set(CPU_FREQUENCY / HZ);
 }
 
+/*
+ * Stop and restart the on-chip timer, for an idle cpu that does not
+ * need hardclock. There is no way to turn it off as such; set it as
+ * far ahead as it goes (about three minutes at 25 MHz), after which
+ * one stray hardclock is harmless.
+ */
+void
+mainbus_hardclock_stop(void)
+{
+	mips_timer_set(0xffffffff);
+}
+
+void
+mainbus_hardclock_start(void)
+{
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * Start all secondary CPUs.
  */
@@ -54,6 +54,7 @@
 #include <cpu.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <synch.h>
 #include <generic/console.h>
 #include <vfs.h>
@@ -149,6 +150,27 @@ getch_intr(struct con_softc *cs)
 	return ret;
 }
 
+/*
+ * Read a character for a user read, as getch_intr, but fail with
+ * EINTR if the current process is exiting; getch_interrupt wakes
+ * the reader so that it checks.
+ */
+static
+int
+getch_user(struct con_softc *cs, char *ch)
+{
+	int result;
+
+	result = P_intr(cs->cs_rsem, &curproc->p_exiting);
+	if (result) {
+		return result;
+	}
+	*ch = cs->cs_gotchars[cs->cs_gotchars_tail];
+	cs->cs_gotchars_tail =
+		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	return 0;
+}
+
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
@@ -225,6 +247,20 @@ getch(void)
 	return getch_intr(cs);
 }
 
+/*
+ * Wake any user read waiting for input, so that one belonging to an
+ * exiting process gives up.
+ */
+void
+getch_interrupt(void)
+{
+	struct con_softc *cs = the_console;
+
+	if (cs != NULL) {
+		sem_interrupt(cs->cs_rsem);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -262,7 +298,12 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			KASSERT(the_console != NULL);
+			result = getch_user(the_console, &ch);
+			if (result) {
+				lock_release(lk);
+				return result;
+			}
 			if (ch=='\r') {
 				ch = '\n';
 			}
@@ -34,6 +34,7 @@
 #include <lib.h>
 #include <spl.h>
 #include <clock.h>
+#include <timer.h>
 #include <platform/bus.h>
 #include <lamebus/ltimer.h>
 #include "autoconf.h"
@@ -46,11 +47,26 @@
 #define LT_REG_COUNT  16    /* Time for countdown timer (usec) */
 #define LT_REG_SPKR   20    /* Beep control */
 
-/* Granularity of countdown timer (usec) */
-#define LT_GRANULARITY   1000000
-
 static bool havetimerclock;
 
+/*
+ * Start the countdown timer to go off once, USECS microseconds from
+ * now. Writing the count register restarts it, so this also replaces
+ * any countdown already running.
+ */
+static
+void
+ltimer_oneshot(void *vlt, uint32_t usecs)
+{
+	struct ltimer_softc *lt = vlt;
+
+	if (usecs == 0) {
+		/* zero would stop it */
+		usecs = 1;
+	}
+	bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT, usecs);
+}
+
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -85,16 +101,18 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 
 	/*
 	 * We do, however, use ltimer for the timer clock, since the
-	 * on-chip timer can't do that.
+	 * on-chip timer can't do that. It runs in one-shot mode: the
+	 * timer wheel sets the countdown for whenever the next timer
+	 * is due, and nothing interrupts while no timers are pending.
+	 * The interrupt goes only to the boot cpu (see lamebus.c),
+	 * which is where the timer wheel runs.
 	 */
 	if (!havetimerclock) {
 		havetimerclock = true;
 		lt->lt_timerclock = 1;
 
-		/* Wire it to go off once every second. */
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
-				   LT_GRANULARITY);
+		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 0);
+		timer_setdevice(lt, ltimer_oneshot);
 	}
 
 	return 0;
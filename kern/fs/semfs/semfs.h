@@ -93,7 +93,7 @@ struct semfs {
 	struct vnodearray *semfs_vnodes;	/* Currently extant vnodes */
 	struct semfs_semarray *semfs_sems;	/* Semaphores */
 
-	struct lock *semfs_dirlock;		/* Lock for following */
+	struct rwlock *semfs_dirlock;		/* Lock for following */
 	struct semfs_direntryarray *semfs_dents; /* The root directory */
 };
 
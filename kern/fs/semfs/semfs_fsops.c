@@ -112,7 +112,7 @@ semfs_destroy(struct semfs *semfs)
 	semfs_direntryarray_setsize(semfs->semfs_dents, 0);
 
 	semfs_direntryarray_destroy(semfs->semfs_dents);
-	lock_destroy(semfs->semfs_dirlock);
+	rwlock_destroy(semfs->semfs_dirlock);
 	semfs_semarray_destroy(semfs->semfs_sems);
 	vnodearray_destroy(semfs->semfs_vnodes);
 	lock_destroy(semfs->semfs_tablelock);
@@ -178,7 +178,7 @@ semfs_create(void)
 		goto fail_vnodes;
 	}
 
-	semfs->semfs_dirlock = lock_create("semfs_dir");
+	semfs->semfs_dirlock = rwlock_create("semfs_dir");
 	if (semfs->semfs_dirlock == NULL) {
 		goto fail_sems;
 	}
@@ -192,7 +192,7 @@ semfs_create(void)
 	return semfs;
 
  fail_dirlock:
-	lock_destroy(semfs->semfs_dirlock);
+	rwlock_destroy(semfs->semfs_dirlock);
  fail_sems:
 	semfs_semarray_destroy(semfs->semfs_sems);
  fail_vnodes:
@@ -311,7 +311,7 @@ semfs_getdirentry(struct vnode *dirvn, struct uio *uio)
 	KASSERT(uio->uio_offset >= 0);
 	pos = uio->uio_offset;
 
-	lock_acquire(semfs->semfs_dirlock);
+	rwlock_acquire_read(semfs->semfs_dirlock);
 
 	num = semfs_direntryarray_num(semfs->semfs_dents);
 	if (pos >= num) {
@@ -324,7 +324,7 @@ semfs_getdirentry(struct vnode *dirvn, struct uio *uio)
 				 uio);
 	}
 
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_read(semfs->semfs_dirlock);
 	return result;
 }
 
@@ -340,9 +340,9 @@ semfs_dirstat(struct vnode *vn, struct stat *buf)
 
 	bzero(buf, sizeof(*buf));
 
-	lock_acquire(semfs->semfs_dirlock);
+	rwlock_acquire_read(semfs->semfs_dirlock);
 	buf->st_size = semfs_direntryarray_num(semfs->semfs_dents);
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_read(semfs->semfs_dirlock);
 
 	buf->st_mode = S_IFDIR | 1777;
 	buf->st_nlink = 2;
@@ -386,7 +386,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		return EEXIST;
 	}
 
-	lock_acquire(semfs->semfs_dirlock);
+	rwlock_acquire_write(semfs->semfs_dirlock);
 	num = semfs_direntryarray_num(semfs->semfs_dents);
 	empty = num;
 	for (i=0; i<num; i++) {
@@ -400,12 +400,12 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		if (!strcmp(dent->semd_name, name)) {
 			/* found */
 			if (excl) {
-				lock_release(semfs->semfs_dirlock);
+				rwlock_release_write(semfs->semfs_dirlock);
 				return EEXIST;
 			}
 			result = semfs_getvnode(semfs, dent->semd_semnum,
 						resultvn);
-			lock_release(semfs->semfs_dirlock);
+			rwlock_release_write(semfs->semfs_dirlock);
 			return result;
 		}
 	}
@@ -445,7 +445,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	}
 
 	sem->sems_linked = true;
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_write(semfs->semfs_dirlock);
 	return 0;
 
  fail_undir:
@@ -459,7 +459,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
  fail_uncreate:
 	semfs_sem_destroy(sem);
  fail_unlock:
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_write(semfs->semfs_dirlock);
 	return result;
 }
 
@@ -482,7 +482,7 @@ semfs_remove(struct vnode *dirvn, const char *name)
 		return EINVAL;
 	}
 
-	lock_acquire(semfs->semfs_dirlock);
+	rwlock_acquire_write(semfs->semfs_dirlock);
 	num = semfs_direntryarray_num(semfs->semfs_dents);
 	for (i=0; i<num; i++) {
 		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
@@ -514,7 +514,7 @@ semfs_remove(struct vnode *dirvn, const char *name)
 	}
 	result = ENOENT;
  out:
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_write(semfs->semfs_dirlock);
 	return result;
 }
 
@@ -537,7 +537,7 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 		return 0;
 	}
 
-	lock_acquire(semfs->semfs_dirlock);
+	rwlock_acquire_read(semfs->semfs_dirlock);
 	num = semfs_direntryarray_num(semfs->semfs_dents);
 	for (i=0; i<num; i++) {
 		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
@@ -547,11 +547,11 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 		if (!strcmp(path, dent->semd_name)) {
 			result = semfs_getvnode(semfs, dent->semd_semnum,
 						resultvn);
-			lock_release(semfs->semfs_dirlock);
+			rwlock_release_read(semfs->semfs_dirlock);
 			return result;
 		}
 	}
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_read(semfs->semfs_dirlock);
 	return ENOENT;
 }
 
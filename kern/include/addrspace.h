@@ -46,6 +46,8 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct shm_object;
 
 
 /*
@@ -60,6 +62,8 @@ struct region {
         vaddr_t reg_vbase;       // virtual memory base location of region.
         size_t reg_npages;       // size of region in number of pages.
         int permissions;         // region permissions (read/write/exec).
+        int reg_advice;          // access pattern hint from madvise (MADV_*).
+        struct shm_object *reg_shm; // shared segment mapped here, or NULL.
 };
 
 struct addrspace {
@@ -74,6 +78,12 @@ struct addrspace {
 #else
         struct region *regions; // linked list of regions
         paddr_t **pagetable;    // 2-level pagetable structure
+        struct rwlock *as_lock; // protects regions and pagetable; read
+                                // held only for plain TLB refills
+        struct addrspace *as_next; // next on the list of all address spaces
+        vaddr_t as_evict_hand;  // where vm_evict resumes its sweep
+        unsigned as_rss;        // resident private pages
+        unsigned as_wss;        // estimated working set, in pages
 #endif
 };
 
@@ -91,7 +101,7 @@ struct addrspace {
  *                you.
  *
  *    as_activate - make curproc's address space the one currently
- *                "seen" by the processor.
+ *                "seen" by the processor, and note it in c_tlbas.
  *
  *    as_deactivate - unload curproc's address space so it isn't
  *                currently "seen" by the processor. This is used to
@@ -114,6 +124,36 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_advise - apply an madvise() hint (MADV_* from <kern/mman.h>)
+ *                to a page-aligned range of the address space.
+ *
+ *    as_region_lookup - return the region containing VADDR, or NULL.
+ *                The caller should hold as_lock.
+ *
+ *    as_define_shared - map a shared memory segment into the address
+ *                space at a free address chosen below the stack, and
+ *                hand back that address. Takes over the caller's
+ *                reference to the segment on success.
+ *
+ *    as_remove_shared - unmap the shared region that begins at VADDR.
+ *
+ *    as_define_threadstack - make a stack region for a new user thread
+ *                below the main stack, and hand back its base and the
+ *                initial stack pointer.
+ *
+ *    as_remove_threadstack - remove the thread stack at BASE, freeing
+ *                its pages.
+ *
+ *    as_bootstrap - set up the list of all address spaces. Called
+ *                from vm_bootstrap.
+ *
+ *    as_lock_nth - return the Nth address space on that list with its
+ *                as_lock held, or NULL. For background scanners.
+ *
+ *    as_lock_live - acquire the as_lock of AS if it is still on that
+ *                list and the caller does not already hold it. For
+ *                callers with possibly stale pointers (compaction).
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -132,6 +172,20 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_advise(struct addrspace *as, vaddr_t vaddr, size_t len,
+                            int advice);
+struct region    *as_region_lookup(struct addrspace *as, vaddr_t vaddr);
+int               as_define_shared(struct addrspace *as,
+                                   struct shm_object *so, size_t npages,
+                                   int readable, int writeable,
+                                   vaddr_t *ret);
+int               as_remove_shared(struct addrspace *as, vaddr_t vaddr);
+int               as_define_threadstack(struct addrspace *as, vaddr_t *base,
+                                        vaddr_t *stackptr);
+int               as_remove_threadstack(struct addrspace *as, vaddr_t base);
+void              as_bootstrap(void);
+struct addrspace *as_lock_nth(unsigned n);
+bool              as_lock_live(struct addrspace *as);
 
 
 /*
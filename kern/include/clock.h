@@ -49,8 +49,11 @@ void hardclock_bootstrap(void);
 void hardclock(void);
 
 /*
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on CPU 0 by the one-shot timer device, if
+ * there is one, when its countdown runs out. It runs the timer wheel;
+ * see timer.h.
+ *
+ * An idle CPU may have its hardclock turned off; see thread_switch.
  */
 void timerclock(void);
 
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COMPACT_H_
+#define _COMPACT_H_
+
+/*
+ * Physical memory compaction.
+ *
+ * A multiframe alloc_kpages fails when there is no run of contiguous
+ * free frames, however many free frames there are in total. Compaction
+ * picks the window of frames that holds no pinned frames and the
+ * fewest in-use ones, and moves the private user pages in it elsewhere,
+ * using the frame table's reverse map to find and update the page
+ * table entry of each. Everything else (kernel memory, shared memory
+ * segments, KSM merged frames, zswap's pool) stays where it is.
+ *
+ * Moving a page takes as_list_lock and its address space's as_lock,
+ * so compaction only runs synchronously when the allocating thread can
+ * sleep and holds no sleep locks (t_nlocks is 0). Otherwise
+ * the allocation fails as before, and a background thread is woken to
+ * free a run of that size for next time.
+ *
+ * Functions:
+ *     compact_bootstrap  - start the background thread. Called from
+ *                          vm_bootstrap.
+ *     compact_alloc      - called by alloc_kpages when it cannot find
+ *                          NPAGES contiguous free frames. Returns the
+ *                          physical address of the run, allocated, or
+ *                          0.
+ *     compact_printstats - print statistics (menu command "cs").
+ */
+
+void compact_bootstrap(void);
+paddr_t compact_alloc(unsigned npages);
+void compact_printstats(void);
+
+
+#endif /* _COMPACT_H_ */
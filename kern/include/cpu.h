@@ -35,6 +35,8 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct addrspace;
+
 
 /*
  * Per-cpu structure
@@ -46,6 +48,9 @@
  * a pointer with a fixed address and a per-cpu mapping in the MMU.
  */
 
+/* Most exited threads (with their stacks) each cpu keeps for reuse. */
+#define CPU_THREADPOOL_MAX 8
+
 struct cpu {
 	/*
 	 * Fixed after allocation.
@@ -61,15 +66,30 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct thread *c_threadpool[CPU_THREADPOOL_MAX]; /* Recycled threads */
+	unsigned c_nthreadpool;		/* Number in c_threadpool[] */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * c_strays is set when the run queue may hold threads that
+	 * are not allowed on this cpu; c_migrator is the thread that
+	 * moves them off (see thread_migrator).
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_strays;			/* Run queue may need sorting out */
+	struct thread *c_migrator;	/* Moves strays to other cpus */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus without locking; see thread_idle,
+	 * and as_activate and vm_tlbinvalidate.
+	 */
+	volatile bool c_tickless;	/* Idle with hardclock off */
+	struct addrspace *volatile c_tlbas; /* Address space of curthread */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -82,10 +102,14 @@ struct cpu {
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
+	 *
+	 * c_shootdown_seq counts the times the queue has been run, so
+	 * that a sender can wait for its requests to be done.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	volatile unsigned c_shootdown_seq;
 	struct spinlock c_ipi_lock;
 
 	/*
@@ -155,6 +179,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_as sends TLB shootdown data to every other CPU
+ * running a thread in address space AS (every other CPU if AS is
+ * NULL), and waits until they have all done it. It must be called
+ * without spinlocks held.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +197,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_as(struct addrspace *as,
+			 const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -59,7 +59,7 @@
 #define SYS_mmap         8
 #define SYS_munmap       9
 #define SYS_mprotect     10
-//#define SYS_madvise    11
+#define SYS_madvise      11
 //#define SYS_mincore    12
 //#define SYS_mlock      13
 //#define SYS_munlock    14
@@ -88,11 +88,11 @@
 //#define SYS_wait4      34
 //#define SYS_getrusage  35
 //                              (resource limits)
-//#define SYS_getrlimit  36
-//#define SYS_setrlimit  37
+#define SYS_getrlimit    36
+#define SYS_setrlimit    37
 //                              (process priority control)
-//#define SYS_getpriority 38
-//#define SYS_setpriority 39
+#define SYS_getpriority  38
+#define SYS_setpriority  39
 //                              (process groups, sessions, and job control)
 //#define SYS_getpgid    40
 //#define SYS_setpgid    41
@@ -197,6 +197,22 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- OS/161 extensions --
+//                              (shared memory)
+#define SYS_shmmap       121
+#define SYS_shmunmap     122
+#define SYS_shmunlink    123
+//                              (user-level synchronization)
+#define SYS_futex        124
+//                              (user threads)
+#define SYS___thread_create 125
+#define SYS_thread_join  126
+#define SYS_thread_exit  127
+//                              (cpu affinity)
+#define SYS_setaffinity  128
+#define SYS_getaffinity  129
+#define SYS_pset_bind    130
+
 /*CALLEND*/
 
 
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches, for kernel structures that are allocated and freed
+ * often.
+ *
+ * A cache hands out objects of one type, carved from single pages
+ * ("slabs") so that there is no rounding up to a kmalloc size class.
+ * If the cache has a constructor, it is run on each object once, when
+ * its slab is set up, and the destructor only when the slab is given
+ * back; in between, a freed object keeps its constructed state (for
+ * example an embedded spinlock or a lock that has already been
+ * created) and must be handed back to kmem_cache_free in that state.
+ * The constructor may fail with an error code, in which case the
+ * allocation that needed the new slab returns NULL.
+ *
+ * Caches are usually static and declared with KMEM_CACHE_INITIALIZER,
+ * which lets them be used before anything else is set up; they can
+ * also be made with kmem_cache_create. Objects must fit in a page
+ * with room to spare.
+ *
+ * Functions:
+ *     kmem_cache_bootstrap - register the shrinker that reaps empty
+ *                           slabs when memory runs out.
+ *     kmem_cache_create   - make a cache of SIZE-byte objects.
+ *     kmem_cache_destroy  - destroy a cache. All objects must be free.
+ *     kmem_cache_alloc    - get an object, or NULL if out of memory.
+ *     kmem_cache_free     - give back an object.
+ *     kmem_cache_reap     - give back to the page allocator every slab
+ *                           with no objects in use, in every cache.
+ *                           Returns the number of pages freed.
+ *     kmem_cache_printstats - print per-cache statistics (menu command
+ *                           "kc").
+ */
+
+#include <spinlock.h>
+
+struct kc_slab;
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;                 /* object size */
+	int (*kc_ctor)(void *obj);      /* constructor, or NULL */
+	void (*kc_dtor)(void *obj);     /* destructor, or NULL */
+	struct spinlock kc_lock;        /* protects the rest */
+	struct kc_slab *kc_partial;     /* slabs with free objects */
+	struct kc_slab *kc_empty;       /* slabs with nothing in use */
+	unsigned kc_nempty;             /* length of kc_empty */
+	unsigned kc_nslabs;             /* slabs held */
+	unsigned kc_inuse;              /* objects allocated */
+	unsigned kc_allocs;             /* kmem_cache_alloc calls */
+	unsigned kc_frees;              /* kmem_cache_free calls */
+	unsigned kc_grows;              /* slabs set up */
+	unsigned kc_shrinks;            /* slabs given back */
+	bool kc_listed;                 /* on the list of all caches */
+	struct kmem_cache *kc_next;     /* next on that list */
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) {	\
+	.kc_name = (name),					\
+	.kc_size = (size),					\
+	.kc_ctor = (ctor),					\
+	.kc_dtor = (dtor),					\
+	.kc_lock = SPINLOCK_INITIALIZER,			\
+}
+
+void kmem_cache_bootstrap(void);
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+unsigned kmem_cache_reap(void);
+void kmem_cache_printstats(void);
+
+
+#endif /* _KMEM_CACHE_H_ */
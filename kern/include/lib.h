@@ -123,8 +123,11 @@ uint32_t random(void);
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
  *
- * kheap_nextgeneration, dump, and dumpall do nothing unless heap
- * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * kheap_dump and dumpall do nothing unless heap labeling (for leak
+ * detection) in kmalloc.c (q.v.) is enabled. kheap_track turns
+ * call-site tracking on and off at runtime; kheap_printtop reports the
+ * N sites holding the most memory and their growth since the last
+ * kheap_nextgeneration.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +135,8 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+int kheap_track(bool on);
+void kheap_printtop(unsigned n);
 
 /*
  * C string functions.
@@ -159,10 +164,12 @@ int snprintf(char *buf, size_t maxlen, const char *fmt, ...) __PF(3,4);
 const char *strerror(int errcode);
 
 /*
- * Low-level console access.
+ * Low-level console access. getch_interrupt wakes user reads waiting
+ * for input so that those of an exiting process give up.
  */
 void putch(int ch);
 int getch(void);
+void getch_interrupt(void);
 void beep(void);
 
 /*
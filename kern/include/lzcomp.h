@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LZCOMP_H_
+#define _LZCOMP_H_
+
+/*
+ * Small LZ77-style compressor, for squeezing pages in memory. The
+ * format is a sequence of (literal run, back-reference) pairs in the
+ * style of LZ4; zero-filled and repetitive data shrink a great deal.
+ *
+ * Functions:
+ *     lz_compress   - compress SRCLEN bytes at SRC into at most DSTMAX
+ *                     bytes at DST, using WORK (LZ_WORKSIZE bytes,
+ *                     aligned) as scratch space. Returns the compressed
+ *                     length, or 0 if the result would not fit.
+ *     lz_decompress - expand SRCLEN bytes of compressed data at SRC
+ *                     into exactly DSTLEN bytes at DST. Returns 0, or
+ *                     EINVAL if the data is corrupt.
+ *
+ * Inputs may be at most 65535 bytes long.
+ */
+
+#define LZ_HASHBITS   10
+#define LZ_WORKSIZE   ((1 << LZ_HASHBITS) * sizeof(uint16_t))
+
+size_t lz_compress(const void *src, size_t srclen, void *dst, size_t dstmax,
+                   void *work);
+int    lz_decompress(const void *src, size_t srclen, void *dst, size_t dstlen);
+
+
+#endif /* _LZCOMP_H_ */
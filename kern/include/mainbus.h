@@ -55,6 +55,10 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/* Turn the current cpu's hardclock interrupt off and on again. */
+void mainbus_hardclock_stop(void);
+void mainbus_hardclock_start(void);
+
 /* Request breaking into the debugger, where available. */
 void mainbus_debugger(void);
 
@@ -70,5 +70,11 @@ void pid_setexitstatus(int status);
  */
 int pid_wait(pid_t targetpid, int *status, int flags, pid_t *retpid);
 
+/*
+ * Wake the current process's threads waiting in pid_wait, which then
+ * fail with EINTR, because the process is exiting.
+ */
+void pid_interrupt(void);
+
 
 #endif /* _PID_H_ */
@@ -36,30 +36,53 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <kern/time.h> /* required for struct rlimit */
+#include <kern/resource.h>
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 
 struct addrspace;
 struct vnode;
 
+/*
+ * A user thread made by thread_create. It stays on its process's
+ * p_uthreads list after it exits, holding its exit status, until
+ * thread_join collects it. The initial thread of a process has none.
+ */
+struct uthread {
+	struct uthread *ut_next;	/* Next on p_uthreads */
+	int ut_tid;			/* Thread ID, unique in the process */
+	vaddr_t ut_stack;		/* Base of its user stack region */
+	bool ut_exited;			/* Has called thread_exit */
+	int ut_status;			/* Status passed to thread_exit */
+};
+
 /*
  * Process structure.
  *
- * Note that unless you implement multithreaded processes, p_threads
- * will only contain one thread for all processes other than kproc.
+ * A process may have several threads sharing its address space and
+ * file table. When one of them calls _exit, p_exiting is set and the
+ * others leave as soon as they next come back from the kernel or wake
+ * up in it; the last one out tears the process down.
  *
  * Note: you can't protect p_threads with a spinlock because it needs
  * to be able to call kmalloc.
  */
 struct proc {
 	char *p_name;			/* Name of this process */
-	struct lock *p_threadslock;	/* Lock for p_threads */
+	struct lock *p_threadslock;	/* Lock for p_threads to p_exitstatus */
 	struct threadarray p_threads;	/* Threads in this process */
+	struct cv *p_threadcv;		/* Signalled when a thread exits */
+	struct uthread *p_uthreads;	/* Threads made by thread_create */
+	int p_nexttid;			/* Next thread ID to hand out */
+	volatile bool p_exiting;	/* Some thread has called _exit */
+	int p_exitstatus;		/* Its status, for the last one out */
 	struct spinlock p_lock;		/* Lock for rest of this structure */
 	pid_t p_pid;			/* Process ID */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct rlimit p_rsslimit;	/* resident set size limit (bytes) */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -88,13 +111,21 @@ void proc_destroy(struct proc *proc);
 
 /*
  * Cause the current process to exit. The current thread switches
- * itself into the kernel process.
+ * itself into the kernel process. Any other threads are told to exit
+ * too, and the last of them to leave destroys the process.
  *
  * The status code should be prepared with one of the _MKWAIT macros
  * defined in <kern/wait.h>.
  */
 void proc_exit(int status);
 
+/*
+ * Make the current thread leave its process, which exits with STATUS
+ * if no other threads are left. Marks its uthread (if any) exited with
+ * STATUS for thread_join. Does not return.
+ */
+__DEAD void proc_thread_exit(int status);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
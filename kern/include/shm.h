@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Shared memory segments.
+ *
+ * A segment is a set of frames that may be mapped into several
+ * address spaces at once. Anonymous segments come from shmmap() with
+ * no name and are passed on to children by fork; named segments are
+ * kept in a flat namespace, like semfs semaphores, so that unrelated
+ * processes can attach to them by name.
+ *
+ * The segment owns its frames. Regions that map a segment point at it
+ * through reg_shm and hold a reference; a named segment also holds a
+ * reference for its name until shmunlink() removes it. Frames are
+ * allocated on first touch and freed when the last reference goes.
+ */
+
+struct lock;
+
+struct shm_object {
+	char *so_name;                  /* name, or NULL if anonymous */
+	unsigned so_npages;             /* size of segment in pages */
+	vaddr_t *so_pages;              /* kvaddr of each frame, 0 if untouched */
+	unsigned so_refcount;           /* mapping regions + name; shm_lock */
+	struct lock *so_lock;           /* protects so_pages */
+	struct shm_object *so_next;     /* next named segment */
+};
+
+/* Set up the shared memory system. Called from vm_bootstrap. */
+void shm_bootstrap(void);
+
+/* Create a new anonymous segment of NPAGES pages, with one reference. */
+int shm_create(unsigned npages, struct shm_object **ret);
+
+/*
+ * Look up the named segment NAME and take a reference to it, creating
+ * it with NPAGES pages if it does not exist. Fails with EINVAL if an
+ * existing segment is smaller than NPAGES.
+ */
+int shm_open(const char *name, unsigned npages, struct shm_object **ret);
+
+/* Remove NAME from the namespace; the segment lives on while mapped. */
+int shm_unlink(const char *name);
+
+/* Reference counting. Dropping the last reference frees the segment. */
+void shm_incref(struct shm_object *so);
+void shm_decref(struct shm_object *so);
+
+/* Get the frame for page INDEX of the segment, allocating it if needed. */
+int shm_getpage(struct shm_object *so, unsigned index, vaddr_t *ret);
+
+
+#endif /* _SHM_H_ */
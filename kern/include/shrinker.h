@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SHRINKER_H_
+#define _SHRINKER_H_
+
+/*
+ * Memory pressure callbacks ("shrinkers").
+ *
+ * A subsystem that keeps memory it could do without (free slabs,
+ * parked thread stacks, resident user pages) registers a shrinker.
+ * When alloc_kpages finds no free frames it runs the shrinkers, in
+ * the order they were registered, until enough pages have come back,
+ * and then tries once more before failing.
+ *
+ * sh_count says roughly how many pages the subsystem could give back
+ * right now; it should be cheap, and a shrinker reporting 0 is
+ * skipped. sh_scan tries to free up to NPAGES pages and returns how
+ * many it freed.
+ *
+ * alloc_kpages can be called holding spinlocks and sleep locks, so a
+ * shrinker that might sleep or take a sleep lock (such as the VM's,
+ * which needs each address space's as_lock) must be flagged
+ * SHRINKER_SLEEPS. Those are skipped from alloc_kpages and only run
+ * by callers that know they hold no locks and pass MAYSLEEP as true,
+ * such as vm_fault when the faulting thread's t_nlocks is 0. Other shrinkers may only take spinlocks that nobody
+ * holds while calling alloc_kpages.
+ *
+ * Shrinkers are usually static structures, declared with
+ * SHRINKER_INITIALIZER, and are never unregistered.
+ *
+ * Functions:
+ *     shrinker_register   - add SH to the list.
+ *     shrinker_run        - try to free NPAGES pages. Returns the
+ *                           number freed.
+ *     shrinker_printstats - print statistics (menu command "sk").
+ */
+
+#define SHRINKER_SLEEPS  0x1            /* sh_scan may sleep */
+
+struct shrinker {
+	const char *sh_name;
+	unsigned (*sh_count)(void);     /* pages that could be freed */
+	unsigned (*sh_scan)(unsigned npages); /* free some; return count */
+	unsigned sh_flags;              /* SHRINKER_* */
+	unsigned sh_calls;              /* times sh_scan was called */
+	unsigned sh_freed;              /* pages it returned in total */
+	struct shrinker *sh_next;       /* next on the list */
+};
+
+#define SHRINKER_INITIALIZER(name, count, scan, flags) {	\
+	.sh_name = (name),					\
+	.sh_count = (count),					\
+	.sh_scan = (scan),					\
+	.sh_flags = (flags),					\
+}
+
+void shrinker_register(struct shrinker *sh);
+unsigned shrinker_run(unsigned npages, bool maysleep);
+void shrinker_printstats(void);
+
+
+#endif /* _SHRINKER_H_ */
@@ -58,9 +58,15 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * P_intr is P for waits that can be interrupted: it fails with EINTR
+ * rather than block (again) once *FLAG is set. sem_interrupt wakes
+ * every waiter, without changing the count, so that they check.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int P_intr(struct semaphore *, volatile bool *flag);
+void sem_interrupt(struct semaphore *);
 
 
 /*
@@ -69,15 +75,40 @@ void V(struct semaphore *);
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
+ * The lock is adaptive: a thread that finds it held spins, as long
+ * as the holder is running on another cpu, for up to LOCK_SPINMAX
+ * checks, and only sleeps if the holder is not running or the budget
+ * runs out. Most critical sections under a lock are short, and
+ * spinning through them is much cheaper than two context switches.
+ *
+ * The lk_contended, lk_spun and lk_slept counters count acquires
+ * that found the lock held, those that got it by spinning, and those
+ * that had to sleep at least once. They are protected by lk_lock.
+ *
+ * Locks do priority inheritance: while threads are asleep waiting for
+ * the lock, its holder runs at the best of their priorities, and so
+ * on along the chain if the holder is itself waiting for a lock (see
+ * synch.c). lk_waiters, lk_pri and lk_nextheld are for this. They are
+ * protected by synch.c's pri_lock, and only changed with lk_lock
+ * held as well.
+ *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
  */
+#define LOCK_SPINMAX 1000
+
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         struct thread *volatile lk_holder;
+        unsigned lk_contended;          /* Acquires that had to wait. */
+        unsigned lk_spun;               /* ...and got it by spinning. */
+        unsigned lk_slept;              /* ...and slept. */
+        unsigned lk_waiters;            /* Threads asleep waiting. */
+        int lk_pri;                     /* Best t_pri among them. */
+        struct lock *lk_nextheld;       /* On lk_holder's t_heldlocks. */
 };
 
 struct lock *lock_create(const char *name);
@@ -128,8 +159,10 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_wait_timeout - As cv_wait, but give up after TICKS timer ticks.
+ *                   Returns ETIMEDOUT if it did, otherwise 0.
  *
- * For all three operations, the current thread must hold the lock passed
+ * For all of these operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
@@ -138,6 +171,54 @@ void cv_destroy(struct cv *);
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
+int cv_wait_timeout(struct cv *cv, struct lock *lock, unsigned ticks);
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers cannot starve writers. A
+ * thread that already holds the lock for reading must therefore not
+ * acquire it for reading again.
+ *
+ * An uncontended acquire or release only takes rwlock_lock; the wait
+ * channels are only touched when someone has to wait.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+        struct wchan *rwlock_rwchan;    /* readers wait here */
+        struct wchan *rwlock_wwchan;    /* writers wait here */
+        struct spinlock rwlock_lock;    /* protects the rest */
+        unsigned rwlock_readers;        /* readers holding the lock */
+        unsigned rwlock_rwaiting;       /* readers waiting */
+        unsigned rwlock_wwaiting;       /* writers waiting */
+        struct thread *rwlock_writer;   /* writer holding it, or NULL */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give back a read hold.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Give back the write hold. Only the thread
+ *                           holding the lock for writing may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing. (Readers are not
+ *                           tracked individually.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
 
 
 #endif /* _SYNCH_H_ */
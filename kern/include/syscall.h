@@ -54,6 +54,12 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 /* Setup function for exec. */
 void exec_bootstrap(void);
 
+/* Setup function for futex. */
+void futex_bootstrap(void);
+
+/* Wake all futex waiters, so they see their process is exiting. */
+void futex_interrupt(void);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -64,12 +70,32 @@ void exec_bootstrap(void);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
+int sys_getrlimit(int resource, userptr_t rlp);
+int sys_setrlimit(int resource, const_userptr_t rlp);
+int sys_getpriority(int which, pid_t who, int32_t *retval);
+int sys_setpriority(int which, pid_t who, int prio);
+int sys_setaffinity(unsigned mask);
+int sys_getaffinity(userptr_t mask);
+int sys_pset_bind(int pset, int32_t *retval);
+
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_shmmap(const_userptr_t name, size_t len, int prot, int32_t *retval);
+int sys_shmunmap(userptr_t addr);
+int sys_shmunlink(const_userptr_t name);
+
+int sys_futex(userptr_t uaddr, int op, int val, int32_t *retval);
+
+int sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+			int32_t *retval);
+int sys_thread_join(int tid, userptr_t status);
+__DEAD void sys_thread_exit(int status);
 
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
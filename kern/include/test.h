@@ -57,6 +57,10 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwtest(int, char **);
+int rwtest2(int, char **);
+int timertest(int, char **);
+int pritest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -96,6 +100,9 @@ int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int kmalloctest5(int, char **);
+int kmalloctest6(int, char **);
+int kmalloctest7(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
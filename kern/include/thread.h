@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -56,6 +57,19 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * A set of cpus, by cpu number: bit N is cpu N. Used for affinity
+ * masks and processor sets.
+ */
+typedef uint32_t cpumask_t;
+#define CPUMASK_BITS	32
+#define CPUMASK(n)	((cpumask_t)1 << (n))
+#define CPUMASK_ALL	((cpumask_t)-1)
+
+/* Number of processor sets. Every cpu starts out in set 0. */
+#define PSET_MAX	4
+
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -85,6 +99,45 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields. t_level is the thread's run queue level,
+	 * 0 being the highest priority; t_ticks counts the hardclocks
+	 * it has used of its quantum at that level. t_readyclock is
+	 * for work stealing, which leaves threads that have only just
+	 * been queued to their own cpu. Only
+	 * touched by the thread's own cpu, or by whoever holds the
+	 * thread while it is on no run queue.
+	 *
+	 * t_affinity and t_pset say which cpus the thread may run on
+	 * (see thread_cpumask). They are set with thread_setcpus and
+	 * read without locks.
+	 *
+	 * t_basepri is the thread's own priority, a nice value, so
+	 * lower is more important; t_pri is the one the scheduler
+	 * goes by, which is better while a more important thread is
+	 * waiting for a lock this one holds (see synch.c). They, and
+	 * t_waitlock and t_heldlocks for working t_pri out, are
+	 * protected by synch.c's pri_lock, though the scheduler reads
+	 * t_pri without it.
+	 */
+	unsigned t_level;		/* Scheduling level */
+	unsigned t_ticks;		/* Hardclocks used at t_level */
+	unsigned t_readyclock;		/* t_cpu's c_hardclocks when queued */
+	volatile cpumask_t t_affinity;	/* Cpus it may run on */
+	volatile unsigned t_pset;	/* Processor set it is bound to */
+	int t_basepri;			/* Priority set by setpriority */
+	volatile int t_pri;		/* Priority including donations */
+	struct lock *t_waitlock;	/* Lock it is asleep waiting for */
+	struct lock *t_heldlocks;	/* Held locks with waiters */
+
+	/*
+	 * Number of sleep locks (locks and rwlocks) the thread holds.
+	 * Code that would take locks out of order, such as compaction
+	 * taking an as_lock from inside an allocation, only does so
+	 * when this is 0. Only touched by the thread itself.
+	 */
+	unsigned t_nlocks;
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -106,6 +159,8 @@ struct thread {
 	 * Public fields
 	 */
 
+	struct uthread *t_uthread;	/* User thread record, if any */
+
 	/* add more here as needed */
 };
 
@@ -158,16 +213,45 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for a hardclock, and yield if it has used
+ * up its quantum or a higher-priority thread is waiting. Called from
+ * the timer interrupt.
+ */
+void thread_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Affinity and processor sets.
+ *
+ * thread_allcpus returns the mask of all cpus in the system, and
+ * pset_getcpus the cpus in processor set PSET. pset_assign moves cpu
+ * CPUNUM to set PSET; it fails with EINVAL if either is out of range.
+ *
+ * thread_setcpus sets T's affinity mask and processor set. T can be
+ * running, or on a run queue; it moves once thread_checkcpus has
+ * been called, which should be done after a batch of thread_setcpus
+ * calls. The new values are not checked; callers should make sure
+ * the mask and the set have a cpu in common.
+ */
+cpumask_t thread_allcpus(void);
+cpumask_t pset_getcpus(unsigned pset);
+int pset_assign(unsigned cpunum, unsigned pset);
+void thread_setcpus(struct thread *t, cpumask_t affinity, unsigned pset);
+void thread_checkcpus(void);
+
+/*
+ * Priorities. thread_setbasepri sets T's own priority; it lives in
+ * synch.c, which works out what T runs at given the locks it holds.
+ * thread_setpri sets the priority T runs at, keeping T's run queue
+ * in order, and is only for synch.c.
  */
-void thread_consider_migration(void);
+void thread_setbasepri(struct thread *t, int pri);
+void thread_setpri(struct thread *t, int pri);
 
 
 #endif /* _THREAD_H_ */
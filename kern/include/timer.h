@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Kernel timers.
+ *
+ * A timer calls tm_func(tm_data) once, on CPU 0, a given number of
+ * timer ticks (1/TIMER_HZ of a second each) after it is armed.
+ * Pending timers live in a hierarchical timer wheel: the first level
+ * has one slot per tick for the next TIMER_L0SLOTS ticks, and each
+ * further level has TIMER_LNSLOTS slots each covering a whole turn of
+ * the level below. When a lower level wraps around, the next slot of
+ * the level above is emptied and its timers are redistributed
+ * ("cascaded") downward. Arming and cancelling are O(1).
+ *
+ * Time is taken from the real-time clock, not by counting hardclocks.
+ * If a one-shot timer device has been registered with
+ * timer_setdevice, it is programmed to interrupt (and call
+ * timer_run, via timerclock) when the earliest pending timer is due,
+ * and not at all while nothing is pending; this lets CPU 0 go
+ * without a hardclock when idle, and gives timers a resolution finer
+ * than a hardclock. Without such a device, CPU 0's hardclock calls
+ * timer_run instead.
+ *
+ * The callback runs in interrupt context with no locks held; it may
+ * take spinlocks and wake threads but must not sleep. A timer can be
+ * re-armed from its own callback.
+ *
+ * struct timer is usually embedded in something else, often on the
+ * stack of a thread that is about to sleep; timer_cancel waits for a
+ * running callback to finish, so after it returns the structure can
+ * go away.
+ *
+ * Functions:
+ *     timer_bootstrap - initialize the wheel.
+ *     timer_start     - start the clock, once gettime() works.
+ *     timer_setdevice - register a one-shot device: ONESHOT(DEVDATA,
+ *                       USECS) should interrupt once, USECS
+ *                       microseconds from now, replacing any earlier
+ *                       request, and call timerclock() when it does.
+ *     timer_hasdevice - true if there is a one-shot device.
+ *     timer_init      - set up T to call FUNC(DATA).
+ *     timer_add       - arm T to fire TICKS ticks from now (at least
+ *                       1). T must not already be pending.
+ *     timer_cancel    - disarm T. Returns true if it was still
+ *                       pending, false if it already fired or was
+ *                       never armed.
+ *     timer_run       - bring the wheel up to the current time and
+ *                       run whatever is due. Called on CPU 0 only.
+ *     timer_now       - ticks since timer_start.
+ *     timer_sleep     - suspend the current thread for TICKS ticks.
+ */
+
+struct timer {
+	struct timer *tm_next;		/* Next timer in the slot */
+	struct timer **tm_prevp;	/* Pointer to us, or NULL if idle */
+	uint64_t tm_expires;		/* timer_now() value to fire at */
+	void (*tm_func)(void *);	/* Callback */
+	void *tm_data;			/* Argument to callback */
+};
+
+/* Timer ticks per second. Should be a multiple of HZ. */
+#define TIMER_HZ	1000
+
+/* Wheel geometry: 8 bits of ticks, then 3 levels of 6 bits. */
+#define TIMER_L0BITS	8
+#define TIMER_LNBITS	6
+#define TIMER_LEVELS	4
+#define TIMER_L0SLOTS	(1 << TIMER_L0BITS)
+#define TIMER_LNSLOTS	(1 << TIMER_LNBITS)
+
+/* Longest delay that can be armed (about 18 hours). */
+#define TIMER_MAXTICKS \
+	((1U << (TIMER_L0BITS + (TIMER_LEVELS - 1) * TIMER_LNBITS)) - 1)
+
+void timer_bootstrap(void);
+void timer_start(void);
+void timer_setdevice(void *devdata,
+		     void (*oneshot)(void *devdata, uint32_t usecs));
+bool timer_hasdevice(void);
+void timer_init(struct timer *t, void (*func)(void *), void *data);
+void timer_add(struct timer *t, unsigned ticks);
+bool timer_cancel(struct timer *t);
+void timer_run(void);
+uint64_t timer_now(void);
+void timer_sleep(unsigned ticks);
+
+
+#endif /* _TIMER_H_ */
@@ -39,11 +39,27 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+struct region;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
+/*
+ * Software bits in a pagetable entry. These sit below TLBLO_GLOBAL and
+ * are never loaded into the TLB. An entry with PTE_ZSWAP set is not
+ * valid and holds a zswap handle in place of the frame number. PTE_REF
+ * is set when a page is loaded into the TLB and cleared by the
+ * working-set sampler and by vm_evict's clock hand.
+ */
+#define PTE_ZSWAP            0x00000001
+#define PTE_REF              0x00000002
+#define PTE_SWBITS           0x000000ff
+#define PTE_TO_ZSWAP(pte)    ((pte) >> 12)
+#define ZSWAP_TO_PTE(handle) (((paddr_t)(handle) << 12) | PTE_ZSWAP)
+
 /* insert a page table entry that maps to the provided frame number. */
 int pagetable_insert(paddr_t **pagetable, vaddr_t vaddr, paddr_t frame_no);
 
@@ -53,6 +69,17 @@ int pagetable_lookup(paddr_t **pagetable, vaddr_t vaddr, paddr_t *frame_no);
 /* flips the dirty bit off in order to change read/write entries to readonly. */
 int pagetable_update(paddr_t **pagetable, vaddr_t reg_vbase, size_t reg_npages);
 
+/* map a frame (zero-filled or shared) for vaddr within region reg. */
+int vm_map_page(struct addrspace *as, struct region *reg, vaddr_t vaddr,
+                paddr_t *entryLo);
+
+/* drop TLB entries for npages pages at vaddr (0: all of as) wherever as runs. */
+void vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr, unsigned npages);
+
+/* evict up to npages private pages of as (as_lock held) or of anyone. */
+unsigned vm_evict(struct addrspace *as, unsigned npages);
+unsigned vm_reclaim(unsigned npages);
+
 /* Initialization function */
 void vm_bootstrap(void);
 
@@ -63,6 +90,23 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/* Reference counts on single kernel pages mapped by several users */
+void frame_incref(vaddr_t addr);
+unsigned frame_refcount(vaddr_t addr);
+
+/* Per-frame descriptor used by kmalloc to find a page's pageref */
+void frame_setowner(vaddr_t addr, void *owner);
+void *frame_getowner(vaddr_t addr);
+
+/* Reverse map of private user frames, and frame table access for compaction */
+#define FRAME_FREE           0    /* not allocated */
+#define FRAME_MOVABLE        1    /* private user page that can be moved */
+#define FRAME_PINNED         2    /* anything else */
+void frame_setrmap(vaddr_t addr, struct addrspace *as, vaddr_t vaddr);
+int frame_info(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr);
+int frame_claim(paddr_t paddr);
+void frame_joinrun(paddr_t paddr, unsigned npages);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
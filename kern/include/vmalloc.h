@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _VMALLOC_H_
+#define _VMALLOC_H_
+
+/*
+ * Virtually contiguous kernel memory ("vmalloc").
+ *
+ * kmalloc hands out large blocks as runs of physically contiguous
+ * frames in kseg0, and once memory is fragmented those runs become
+ * hard to find even with plenty of frames free. vmalloc instead takes
+ * single frames from wherever they are and maps them at consecutive
+ * addresses in the TLB-mapped kseg2 segment, through a kernel pagetable
+ * that vm_fault consults on a kseg2 TLB miss. Each allocation is
+ * followed by an unmapped guard page.
+ *
+ * vmalloc memory must not be used for thread stacks (a TLB miss on the
+ * stack cannot be taken), nor for anything that needs a physical
+ * address. It may be touched with spinlocks held, except the vmalloc
+ * lock itself.
+ *
+ * Functions:
+ *     vmalloc_bootstrap  - set up the kernel pagetable. Called from
+ *                          vm_bootstrap.
+ *     vmalloc            - allocate SIZE bytes, rounded up to whole
+ *                          pages. Returns NULL if out of memory.
+ *     vfree              - free a block returned by vmalloc.
+ *     vmalloc_fault      - load the TLB for a fault at a kseg2 address.
+ *                          Returns EFAULT if it is not mapped.
+ *     vmalloc_printstats - print usage statistics (menu command "vs").
+ *
+ * With dumbvm there is no kernel pagetable; vmalloc and vfree are
+ * plain kmalloc and kfree, found in dumbvm.c.
+ */
+
+void vmalloc_bootstrap(void);
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+int vmalloc_fault(int faulttype, vaddr_t faultaddress);
+void vmalloc_printstats(void);
+
+
+#endif /* _VMALLOC_H_ */
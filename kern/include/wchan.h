@@ -66,15 +66,29 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but wake up by ourselves after TICKS timer ticks
+ * (see timer.h) if nobody else has. Returns 0 if woken, or ETIMEDOUT.
+ */
+int wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+			unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
  *
- * The current implementation is FIFO but this is not promised by the
+ * wchan_wakeone wakes the most important thread (see t_pri), and of
+ * those the one that has waited longest; this is not promised by the
  * interface.
  */
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Return the best (lowest) t_pri among PRI and the threads sleeping on
+ * the channel. The associated spinlock should be locked.
+ */
+int wchan_toppri(struct wchan *wc, struct spinlock *lk, int pri);
+
 
 #endif /* _WCHAN_H_ */
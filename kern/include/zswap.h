@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+/*
+ * Compressed page store ("zswap").
+ *
+ * When frames run out, vm_fault evicts private user pages by
+ * compressing them into a pool of frames carved up into size classes,
+ * in the manner of zsmalloc's zspages. An evicted page's pagetable
+ * entry holds PTE_ZSWAP and the handle of its compressed copy, and is
+ * brought back by decompressing it into a new frame on the next fault.
+ * There is no swap disk, so pages that do not compress well enough to
+ * be worth storing simply stay resident.
+ *
+ * Functions:
+ *     zswap_bootstrap  - set up the pool. Called from vm_bootstrap.
+ *     zswap_store      - compress the frame at KVADDR into the pool
+ *                        and hand back a handle for it. On success the
+ *                        frame belongs to zswap and the caller must not
+ *                        touch or free it. Fails with ENOSPC if the
+ *                        page does not compress or the pool is full.
+ *     zswap_load       - decompress the page HANDLE into the frame at
+ *                        KVADDR. The copy in the pool is kept.
+ *     zswap_free       - discard the compressed page HANDLE.
+ *     zswap_printstats - print pool statistics (menu command "zs").
+ */
+
+void zswap_bootstrap(void);
+int  zswap_store(vaddr_t kvaddr, unsigned *handle);
+int  zswap_load(unsigned handle, vaddr_t kvaddr);
+void zswap_free(unsigned handle);
+void zswap_printstats(void);
+
+
+#endif /* _ZSWAP_H_ */
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Small LZ77-style compressor. See lzcomp.h.
+ *
+ * Each sequence is a token byte, an optional literal length
+ * extension, the literals, and then (except in the last sequence) a
+ * two-byte little-endian offset and an optional match length
+ * extension. The high nibble of the token is the literal count and
+ * the low nibble is the match length minus MINMATCH; a nibble of 15
+ * means more length follows, as bytes added on until one is not 255.
+ *
+ * Matches are found through a hash table of recent positions for
+ * each four-byte sequence. The last LASTLITERALS bytes of the input
+ * are always sent as literals, so the last sequence is the only one
+ * without a match.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <lzcomp.h>
+
+#define MINMATCH      4
+#define LASTLITERALS  5
+#define RUNMASK       15
+
+static
+uint32_t
+lz_read32(const unsigned char *p)
+{
+	/* bytewise, as the input need not be aligned. */
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static
+unsigned
+lz_hash(uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ_HASHBITS);
+}
+
+/*
+ * Write the part of a length beyond RUNMASK.
+ */
+static
+bool
+lz_putlength(unsigned char **opp, unsigned char *oend, size_t len)
+{
+	unsigned char *op = *opp;
+
+	while (len >= 255) {
+		if (op >= oend) {
+			return false;
+		}
+		*op++ = 255;
+		len -= 255;
+	}
+	if (op >= oend) {
+		return false;
+	}
+	*op++ = len;
+
+	*opp = op;
+	return true;
+}
+
+/*
+ * Write one sequence: LITLEN literals from LIT and then, if MLEN is
+ * not 0, a match of MLEN bytes at distance OFFSET.
+ */
+static
+bool
+lz_putsequence(unsigned char **opp, unsigned char *oend,
+	       const unsigned char *lit, size_t litlen,
+	       size_t offset, size_t mlen)
+{
+	unsigned char *op = *opp;
+	unsigned char *token;
+
+	if (op >= oend) {
+		return false;
+	}
+	token = op++;
+
+	*token = (litlen >= RUNMASK ? RUNMASK : litlen) << 4;
+	if (litlen >= RUNMASK && !lz_putlength(&op, oend, litlen - RUNMASK)) {
+		return false;
+	}
+	if ((size_t)(oend - op) < litlen) {
+		return false;
+	}
+	memcpy(op, lit, litlen);
+	op += litlen;
+
+	if (mlen > 0) {
+		if (oend - op < 2) {
+			return false;
+		}
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+
+		mlen -= MINMATCH;
+		*token |= mlen >= RUNMASK ? RUNMASK : mlen;
+		if (mlen >= RUNMASK &&
+		    !lz_putlength(&op, oend, mlen - RUNMASK)) {
+			return false;
+		}
+	}
+
+	*opp = op;
+	return true;
+}
+
+size_t
+lz_compress(const void *src, size_t srclen, void *dst, size_t dstmax,
+	    void *work)
+{
+	const unsigned char *in = src;
+	unsigned char *op = dst;
+	unsigned char *oend = op + dstmax;
+	uint16_t *table = work;
+	size_t ip, anchor, ref, mlen;
+	uint32_t seq;
+	unsigned h;
+
+	KASSERT(srclen <= 0xffff);
+
+	/* table entries are a position plus one; 0 means empty. */
+	for (h = 0; h < (1 << LZ_HASHBITS); h++) {
+		table[h] = 0;
+	}
+
+	ip = anchor = 0;
+	while (ip + MINMATCH + LASTLITERALS <= srclen) {
+		seq = lz_read32(in + ip);
+		h = lz_hash(seq);
+		ref = table[h];
+		table[h] = ip + 1;
+
+		if (ref == 0 || lz_read32(in + ref - 1) != seq) {
+			ip++;
+			continue;
+		}
+		ref--;
+
+		/* extend the match as far as the trailing literals. */
+		mlen = MINMATCH;
+		while (ip + mlen < srclen - LASTLITERALS &&
+		       in[ref + mlen] == in[ip + mlen]) {
+			mlen++;
+		}
+
+		if (!lz_putsequence(&op, oend, in + anchor, ip - anchor,
+				    ip - ref, mlen)) {
+			return 0;
+		}
+		ip += mlen;
+		anchor = ip;
+	}
+
+	/* whatever is left goes out as literals. */
+	if (!lz_putsequence(&op, oend, in + anchor, srclen - anchor, 0, 0)) {
+		return 0;
+	}
+
+	return op - (unsigned char *)dst;
+}
+
+/*
+ * Read the part of a length beyond RUNMASK and add it to *LENP.
+ */
+static
+int
+lz_getlength(const unsigned char *in, size_t srclen, size_t *ipp,
+	     size_t *lenp)
+{
+	unsigned char b;
+
+	do {
+		if (*ipp >= srclen) {
+			return EINVAL;
+		}
+		b = in[(*ipp)++];
+		*lenp += b;
+	} while (b == 255);
+
+	return 0;
+}
+
+int
+lz_decompress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+	const unsigned char *in = src;
+	unsigned char *out = dst;
+	size_t ip, op, len, offset;
+	unsigned token;
+
+	ip = op = 0;
+	while (ip < srclen) {
+		token = in[ip++];
+
+		len = token >> 4;
+		if (len == RUNMASK && lz_getlength(in, srclen, &ip, &len)) {
+			return EINVAL;
+		}
+		if (len > srclen - ip || len > dstlen - op) {
+			return EINVAL;
+		}
+		memcpy(out + op, in + ip, len);
+		ip += len;
+		op += len;
+
+		/* the last sequence has no match. */
+		if (ip == srclen) {
+			break;
+		}
+
+		if (srclen - ip < 2) {
+			return EINVAL;
+		}
+		offset = in[ip] | in[ip + 1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > op) {
+			return EINVAL;
+		}
+
+		len = (token & RUNMASK) + MINMATCH;
+		if ((token & RUNMASK) == RUNMASK &&
+		    lz_getlength(in, srclen, &ip, &len)) {
+			return EINVAL;
+		}
+		if (len > dstlen - op) {
+			return EINVAL;
+		}
+
+		/* bytewise, since the source may overlap the output. */
+		for (; len > 0; len--, op++) {
+			out[op] = out[op - offset];
+		}
+	}
+
+	return op == dstlen ? 0 : EINVAL;
+}
@@ -38,11 +38,13 @@
 #include <lib.h>
 #include <spl.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <kmem_cache.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
@@ -111,6 +113,7 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
+	kmem_cache_bootstrap();
 	pid_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
@@ -121,6 +124,8 @@ boot(void)
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+	/* The timer wheel needs the real-time clock, found just now. */
+	timer_start();
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
@@ -130,6 +135,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	exec_bootstrap();
+	futex_bootstrap();
 	thread_start_cpus();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
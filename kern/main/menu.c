@@ -45,8 +45,22 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <kmem_cache.h>
+#include <shrinker.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-ksm.h"
+#include "opt-dumbvm.h"
+
+#if OPT_KSM
+#include <ksm.h>
+#endif
+#if !OPT_DUMBVM
+#include <zswap.h>
+#include <wset.h>
+#include <vmalloc.h>
+#include <compact.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -245,6 +259,38 @@ cmd_sync(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for processor sets: with no arguments, list them; otherwise
+ * move a cpu to a set.
+ */
+static
+int
+cmd_pset(int nargs, char **args)
+{
+	cpumask_t cpus;
+	unsigned i, j;
+
+	if (nargs == 1) {
+		for (i=0; i<PSET_MAX; i++) {
+			cpus = pset_getcpus(i);
+			kprintf("pset %u:", i);
+			for (j=0; j<CPUMASK_BITS; j++) {
+				if (cpus & CPUMASK(j)) {
+					kprintf(" cpu%u", j);
+				}
+			}
+			kprintf("\n");
+		}
+		return 0;
+	}
+	if (nargs != 3) {
+		kprintf("Usage: pset [cpu set]\n");
+		return EINVAL;
+	}
+
+	return pset_assign(atoi(args[1]), atoi(args[2]));
+}
+
 /*
  * Command for dropping to the debugger.
  */
@@ -471,6 +517,94 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_KSM
+static
+int
+cmd_ksmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	ksm_printstats();
+
+	return 0;
+}
+#endif
+
+#if !OPT_DUMBVM
+static
+int
+cmd_zswapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	zswap_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_wsetstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	wset_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_vmallocstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vmalloc_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_compactstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	compact_printstats();
+
+	return 0;
+}
+#endif
+
+static
+int
+cmd_kcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_shrinkerstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	shrinker_printstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -500,6 +634,50 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheaptrack(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		result = kheap_track(true);
+		if (result) {
+			kprintf("khtrack: %s\n", strerror(result));
+		}
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		kheap_track(false);
+	}
+	else {
+		kprintf("Usage: khtrack on|off\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_kheaptop(int nargs, char **args)
+{
+	unsigned n;
+
+	if (nargs == 1) {
+		n = 10;
+	}
+	else if (nargs == 2 && atoi(args[1]) > 0) {
+		n = atoi(args[1]);
+	}
+	else {
+		kprintf("Usage: khtop [count]\n");
+		return 0;
+	}
+
+	kheap_printtop(n);
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -539,6 +717,7 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[pset]    Processor sets            ",
 	"[debug]   Drop to debugger          ",
 	"[panic]   Intentional panic         ",
 	"[deadlock] Intentional deadlock     ",
@@ -566,6 +745,9 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] Object cache test             ",
+	"[km6] vmalloc test                  ",
+	"[km7] kmalloc size class test       ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -576,6 +758,10 @@ static const char *testmenu[] = {
 	"[sy2] Lock test                     ",
 	"[sy3] CV test                       ",
 	"[sy4] CV test #2                    ",
+	"[rw1] Rwlock test                   ",
+	"[rw2] Rwlock writer preference test ",
+	"[tm1] Timer test                    ",
+	"[pi1] Priority inheritance test     ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[wt]  waitpid test                  ",
 	"[fs1] Filesystem test               ",
@@ -606,6 +792,19 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khtrack] Track heap call sites     ",
+	"[khtop] Top heap call sites         ",
+	"[kc] Object cache stats             ",
+	"[sk] Shrinker stats                 ",
+#if OPT_KSM
+	"[ksm] Page merging stats            ",
+#endif
+#if !OPT_DUMBVM
+	"[zs] Compressed page store stats    ",
+	"[ws] Working set stats              ",
+	"[vs] vmalloc stats                  ",
+	"[cs] Compaction stats               ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -646,6 +845,7 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "pset",	cmd_pset },
 	{ "debug",	cmd_debug },
 	{ "panic",	cmd_panic },
 	{ "deadlock",	cmd_deadlock },
@@ -657,6 +857,19 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khtrack",    cmd_kheaptrack },
+	{ "khtop",      cmd_kheaptop },
+	{ "kc",         cmd_kcachestats },
+	{ "sk",         cmd_shrinkerstats },
+#if OPT_KSM
+	{ "ksm",        cmd_ksmstats },
+#endif
+#if !OPT_DUMBVM
+	{ "zs",         cmd_zswapstats },
+	{ "ws",         cmd_wsetstats },
+	{ "vs",         cmd_vmallocstats },
+	{ "cs",         cmd_compactstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -667,6 +880,9 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
+	{ "km6",	kmalloctest6 },
+	{ "km7",	kmalloctest7 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -679,6 +895,10 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "rw1",	rwtest },
+	{ "rw2",	rwtest2 },
+	{ "tm1",	timertest },
+	{ "pi1",	pritest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
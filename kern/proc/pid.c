@@ -43,6 +43,7 @@
 #include <current.h>
 #include <synch.h>
 #include <pid.h>
+#include <kmem_cache.h>
 
 /*
  * Structure for holding exit data of a thread.
@@ -75,6 +76,36 @@ static int nprocs;			// number of allocated pids
 
 
 
+/*
+ * pidinfo structures come from an object cache; a free one keeps its
+ * condition variable.
+ */
+static
+int
+pidinfo_ctor(void *obj)
+{
+	struct pidinfo *pi = obj;
+
+	pi->pi_cv = cv_create("pidinfo cv");
+	if (pi->pi_cv == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+pidinfo_dtor(void *obj)
+{
+	struct pidinfo *pi = obj;
+
+	cv_destroy(pi->pi_cv);
+}
+
+static struct kmem_cache pidinfo_cache =
+	KMEM_CACHE_INITIALIZER("pidinfo", sizeof(struct pidinfo),
+			       pidinfo_ctor, pidinfo_dtor);
+
 /*
  * Create a pidinfo structure for the specified pid.
  */
@@ -86,17 +117,11 @@ pidinfo_create(pid_t pid, pid_t ppid)
 
 	KASSERT(pid != INVALID_PID);
 
-	pi = kmalloc(sizeof(struct pidinfo));
+	pi = kmem_cache_alloc(&pidinfo_cache);
 	if (pi==NULL) {
 		return NULL;
 	}
 
-	pi->pi_cv = cv_create("pidinfo cv");
-	if (pi->pi_cv == NULL) {
-		kfree(pi);
-		return NULL;
-	}
-
 	pi->pi_pid = pid;
 	pi->pi_ppid = ppid;
 	pi->pi_exited = false;
@@ -114,8 +139,7 @@ pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
-	cv_destroy(pi->pi_cv);
-	kfree(pi);
+	kmem_cache_free(&pidinfo_cache, pi);
 }
 
 ////////////////////////////////////////////////////////////
@@ -381,6 +405,26 @@ pid_setexitstatus(int status)
 	lock_release(pidlock);
 }
 
+/*
+ * pid_interrupt: wake any thread of the current process that is
+ * waiting for one of its children, so that it sees the process is
+ * exiting and gives up.
+ */
+void
+pid_interrupt(void)
+{
+	int i;
+
+	lock_acquire(pidlock);
+	for (i=0; i<PROCS_MAX; i++) {
+		if (pidinfo[i] != NULL &&
+		    pidinfo[i]->pi_ppid == curproc->p_pid) {
+			cv_broadcast(pidinfo[i]->pi_cv, pidlock);
+		}
+	}
+	lock_release(pidlock);
+}
+
 /*
  * Waits on a pid, returning the exit status when it's available.
  * status and ret are a kernel pointers, but pid/flags may come from
@@ -417,30 +461,41 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 
 	lock_acquire(pidlock);
 
-	them = pi_get(theirpid);
-	if (them==NULL) {
-		lock_release(pidlock);
-		return ESRCH;
-	}
+	/*
+	 * Look the pid up again after sleeping: another thread of
+	 * this process may have been waiting for the same child, and
+	 * collected it first.
+	 */
+	while (1) {
+		them = pi_get(theirpid);
+		if (them==NULL) {
+			lock_release(pidlock);
+			return ESRCH;
+		}
 
-	KASSERT(them->pi_pid==theirpid);
+		KASSERT(them->pi_pid==theirpid);
 
-	/* Only allow waiting for own children. */
-	if (them->pi_ppid != curproc->p_pid) {
-		lock_release(pidlock);
-		return EPERM;
-	}
+		/* Only allow waiting for own children. */
+		if (them->pi_ppid != curproc->p_pid) {
+			lock_release(pidlock);
+			return EPERM;
+		}
 
-	if (them->pi_exited == false) {
+		if (them->pi_exited) {
+			break;
+		}
 		if (flags == WNOHANG) {
 			lock_release(pidlock);
 			KASSERT(ret != NULL);
 			*ret = 0;
 			return 0;
 		}
-		/* don't need to loop on this */
+		if (curproc->p_exiting) {
+			/* another thread called _exit; see pid_interrupt. */
+			lock_release(pidlock);
+			return EINTR;
+		}
 		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited == true);
 	}
 
 	if (status != NULL) {
@@ -38,12 +38,13 @@
  * things they point to. Rearrange this (and/or change it to be a
  * regular lock) as needed.
  *
- * Unless you're implementing multithreaded user processes, the only
- * process that will have more than one thread is the kernel process.
+ * User processes get more than one thread through thread_create; see
+ * kern/syscall/thread_syscalls.c.
  */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/wait.h>
 #include <spl.h>
 #include <synch.h>
 #include <proc.h>
@@ -52,12 +53,55 @@
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <kmem_cache.h>
+#include <syscall.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Proc structures come from an object cache. A free one keeps its
+ * locks and its (empty) thread array.
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->p_threadslock = lock_create("p_threads");
+	if (proc->p_threadslock == NULL) {
+		return ENOMEM;
+	}
+	proc->p_threadcv = cv_create("p_threads");
+	if (proc->p_threadcv == NULL) {
+		lock_destroy(proc->p_threadslock);
+		return ENOMEM;
+	}
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_cleanup(&proc->p_lock);
+	threadarray_cleanup(&proc->p_threads);
+	cv_destroy(proc->p_threadcv);
+	lock_destroy(proc->p_threadslock);
+}
+
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc),
+			       proc_ctor, proc_dtor);
+
 /*
  * Create a proc structure.
  */
@@ -67,29 +111,28 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
-		return NULL;
-	}
-
-	proc->p_threadslock = lock_create("p_threads");
-	if (proc->p_threadslock == NULL) {
-		kfree(proc->p_name);
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
-	threadarray_init(&proc->p_threads);
 
-	spinlock_init(&proc->p_lock);
 	proc->p_pid = INVALID_PID;
 
+	/* threads */
+	proc->p_uthreads = NULL;
+	proc->p_nexttid = 1;
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
+
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_rsslimit.rlim_cur = RLIM_INFINITY;
+	proc->p_rsslimit.rlim_max = RLIM_INFINITY;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -107,6 +150,8 @@ proc_create(const char *name)
 void
 proc_destroy(struct proc *proc)
 {
+	struct uthread *ut;
+
 	/*
 	 * You probably want to destroy and null out much of the
 	 * process (particularly the address space) at exit time if
@@ -183,12 +228,17 @@ proc_destroy(struct proc *proc)
 	}
 
 	KASSERT(proc->p_pid == INVALID_PID);
-	spinlock_cleanup(&proc->p_lock);
-	threadarray_cleanup(&proc->p_threads);
-	lock_destroy(proc->p_threadslock);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+
+	/* Threads nobody joined. */
+	while (proc->p_uthreads != NULL) {
+		ut = proc->p_uthreads;
+		proc->p_uthreads = ut->ut_next;
+		kfree(ut);
+	}
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 }
 
 /*
@@ -292,6 +342,10 @@ proc_fork(struct proc **ret)
 #endif
 
 	/* VM fields */
+	spinlock_acquire(&curproc->p_lock);
+	newproc->p_rsslimit = curproc->p_rsslimit;
+	spinlock_release(&curproc->p_lock);
+
 	as = proc_getas();
 	if (as != NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
@@ -344,19 +398,86 @@ proc_unfork(struct proc *newproc)
 	proc_destroy(newproc);
 }
 
+/*
+ * Take the current thread out of PROC, which must have other threads
+ * left, and make it go away. The caller holds p_threadslock.
+ */
+static
+__DEAD
+void
+proc_leave(struct proc *proc)
+{
+	unsigned num, i;
+	int spl;
+
+	KASSERT(lock_do_i_hold(proc->p_threadslock));
+	KASSERT(curthread->t_proc == proc);
+
+	num = threadarray_num(&proc->p_threads);
+	KASSERT(num > 1);
+	for (i=0; i<num; i++) {
+		if (threadarray_get(&proc->p_threads, i) == curthread) {
+			break;
+		}
+	}
+	KASSERT(i < num);
+	threadarray_remove(&proc->p_threads, i);
+	lock_release(proc->p_threadslock);
+
+	spl = splhigh();
+	curthread->t_proc = NULL;
+	splx(spl);
+
+	proc_addthread(kproc, curthread);
+	thread_exit();
+}
+
 /*
  * Make the current process exit.
+ *
+ * The first thread to get here sets the exit status and wakes up any
+ * others that are asleep in thread_join, nanosleep (both on
+ * p_threadcv), futex, waitpid or a console read, so they notice
+ * p_exiting and fail with EINTR; the rest notice on their way back to
+ * user mode (see mips_trap). Other waits, such as for a lock or for
+ * disk I/O, are short and run their course. Each thread leaves in
+ * turn, and the last one out sets the exit status and destroys the
+ * process.
  */
 void
 proc_exit(int status)
 {
 	struct proc *proc = curproc;
+	bool first, alone;
 
 	/* The kernel isn't supposed to exit. */
 	KASSERT(proc != kproc);
 
+	lock_acquire(proc->p_threadslock);
+	first = !proc->p_exiting;
+	if (first) {
+		proc->p_exiting = true;
+		proc->p_exitstatus = status;
+		cv_broadcast(proc->p_threadcv, proc->p_threadslock);
+	}
+	alone = threadarray_num(&proc->p_threads) == 1;
+	lock_release(proc->p_threadslock);
+
+	if (first && !alone) {
+		futex_interrupt();
+		pid_interrupt();
+		getch_interrupt();
+	}
+
+	/* Leave if anyone else is still here. */
+	lock_acquire(proc->p_threadslock);
+	if (threadarray_num(&proc->p_threads) > 1) {
+		proc_leave(proc);
+	}
+	lock_release(proc->p_threadslock);
+
 	/* Set exit status and wake up anyone waiting for us. */
-	pid_setexitstatus(status);
+	pid_setexitstatus(proc->p_exitstatus);
 
 	/* Detach from the process and attach to the kernel process. */
 	KASSERT(curthread->t_proc == proc);
@@ -372,6 +493,33 @@ proc_exit(int status)
 	thread_exit();
 }
 
+/*
+ * Make the current thread exit, for thread_exit().
+ */
+void
+proc_thread_exit(int status)
+{
+	struct proc *proc = curproc;
+	struct uthread *ut = curthread->t_uthread;
+
+	KASSERT(proc != kproc);
+
+	lock_acquire(proc->p_threadslock);
+	if (threadarray_num(&proc->p_threads) > 1) {
+		if (ut != NULL) {
+			ut->ut_exited = true;
+			ut->ut_status = status;
+			cv_broadcast(proc->p_threadcv, proc->p_threadslock);
+		}
+		curthread->t_uthread = NULL;
+		proc_leave(proc);
+	}
+	lock_release(proc->p_threadslock);
+
+	/* The last thread out takes the process with it. */
+	proc_exit(_MKWAIT_EXIT(status));
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -445,10 +593,9 @@ finish:
 /*
  * Fetch the address space of (the current) process.
  *
- * Caution: address spaces aren't refcounted. If you implement
- * multithreaded processes, make sure to set up a refcount scheme or
- * some other method to make this safe. Otherwise the returned address
- * space might disappear under you.
+ * Address spaces aren't refcounted. This is still safe with several
+ * threads: the address space only goes away when the last thread
+ * leaves (proc_destroy) or on exec, which needs a lone thread.
  */
 struct addrspace *
 proc_getas(void)
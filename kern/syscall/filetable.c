@@ -34,6 +34,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <openfile.h>
 #include <filetable.h>
 
@@ -52,6 +53,8 @@ filetable_create(void)
 		return NULL;
 	}
 
+	spinlock_init(&ft->ft_lock);
+
 	/* the table starts empty */
 	for (fd = 0; fd < OPEN_MAX; fd++) {
 		ft->ft_openfiles[fd] = NULL;
@@ -61,7 +64,7 @@ filetable_create(void)
 }
 
 /*
- * Destroy a filetable.
+ * Destroy a filetable. Nothing else may be using it, so no locking.
  */
 void
 filetable_destroy(struct filetable *ft)
@@ -77,6 +80,7 @@ filetable_destroy(struct filetable *ft)
 			ft->ft_openfiles[fd] = NULL;
 		}
 	}
+	spinlock_cleanup(&ft->ft_lock);
 	kfree(ft);
 }
 
@@ -114,6 +118,7 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 	}
 
 	/* share the entries */
+	spinlock_acquire(&src->ft_lock);
 	for (fd = 0; fd < OPEN_MAX; fd++) {
 		file = src->ft_openfiles[fd];
 		if (file != NULL) {
@@ -121,6 +126,7 @@ filetable_copy(struct filetable *src, struct filetable **dest_ret)
 		}
 		dest->ft_openfiles[fd] = file;
 	}
+	spinlock_release(&src->ft_lock);
 
 	*dest_ret = dest;
 	return 0;
@@ -144,7 +150,8 @@ filetable_okfd(struct filetable *ft, int fd)
  *
  * This checks that the file handle is in range and fails rather than
  * returning a null openfile; it only yields files that are actually
- * open.
+ * open. The file comes with a reference of its own, so it stays open
+ * even if another thread closes the handle before filetable_put.
  */
 int
 filetable_get(struct filetable *ft, int fd, struct openfile **ret)
@@ -155,36 +162,33 @@ filetable_get(struct filetable *ft, int fd, struct openfile **ret)
 		return EBADF;
 	}
 
+	spinlock_acquire(&ft->ft_lock);
 	file = ft->ft_openfiles[fd];
 	if (file == NULL) {
+		spinlock_release(&ft->ft_lock);
 		return EBADF;
 	}
+	openfile_incref(file);
+	spinlock_release(&ft->ft_lock);
 
 	*ret = file;
 	return 0;
 }
 
 /*
- * Put a file handle back when done with it. This does not actually do
- * anything (other than crosscheck) but it's always good practice to
- * build things so when you take them out you put them back again
- * rather than dropping them on the floor. Then if you need to do
- * something at cleanup time you can put it in this function instead
- * of having to hunt for all the places to insert the new logic.
- *
- * (For example, if you have multithreaded processes you will need to
- * insert additional lock and/or refcount manipulations here and in
- * filetable_get.)
+ * Put a file handle back when done with it, dropping the reference
+ * filetable_get took. If another thread closed the handle meanwhile,
+ * this is where the file actually gets closed.
  *
  * The openfile should be the one returned from filetable_get. If you
- * want to manipulate the table so the assertion's no longer true, get
- * your own reference to the openfile (with openfile_incref) and call
- * filetable_put before mucking about.
+ * want to keep using it, get your own reference to the openfile (with
+ * openfile_incref) before calling filetable_put.
  */
 void
 filetable_put(struct filetable *ft, int fd, struct openfile *file)
 {
-	KASSERT(ft->ft_openfiles[fd] == file);
+	KASSERT(filetable_okfd(ft, fd));
+	openfile_decref(file);
 }
 
 /*
@@ -202,13 +206,16 @@ filetable_place(struct filetable *ft, struct openfile *file, int *fd_ret)
 {
 	int fd;
 
+	spinlock_acquire(&ft->ft_lock);
 	for (fd = 0; fd < OPEN_MAX; fd++) {
 		if (ft->ft_openfiles[fd] == NULL) {
 			ft->ft_openfiles[fd] = file;
+			spinlock_release(&ft->ft_lock);
 			*fd_ret = fd;
 			return 0;
 		}
 	}
+	spinlock_release(&ft->ft_lock);
 
 	return EMFILE;
 }
@@ -232,6 +239,8 @@ filetable_placeat(struct filetable *ft, struct openfile *newfile, int fd,
 {
 	KASSERT(filetable_okfd(ft, fd));
 
+	spinlock_acquire(&ft->ft_lock);
 	*oldfile_ret = ft->ft_openfiles[fd];
 	ft->ft_openfiles[fd] = newfile;
+	spinlock_release(&ft->ft_lock);
 }
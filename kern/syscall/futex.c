@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futex - wait and wake on a word of user memory.
+ *
+ * User-level locks keep their state in an ordinary int and only come
+ * here to sleep when the lock is taken, and to wake sleepers when it
+ * is given back; the uncontended cases never enter the kernel.
+ *
+ * A futex is named by its key: the address space and the user
+ * address, or, for a word in a shared memory segment, the segment and
+ * the offset in it, so that processes mapping the segment at
+ * different addresses still meet. Waiters are kept in a fixed hash
+ * table of buckets, each with its own lock and condition variable.
+ * FUTEX_WAKE marks the waiters it picks and broadcasts on the bucket,
+ * so a wakeup can also rouse waiters on other futexes that hash to
+ * the same bucket; they see they were not picked and sleep again.
+ *
+ * The bucket lock is a sleep lock because FUTEX_WAIT reads the user
+ * word while holding it, and the read may fault. Otherwise a FUTEX_WAKE
+ * could slip in between the read and the sleep, and be lost.
+ *
+ * A waiter also gives up with EINTR when another thread of its process
+ * calls _exit; futex_interrupt rouses every bucket so it can look.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <syscall.h>
+#include "opt-dumbvm.h"
+
+#define FUTEX_NBUCKETS 64
+
+struct futex_key {
+	const void *fk_obj;             /* address space or shm segment */
+	vaddr_t fk_off;                 /* address in it */
+};
+
+struct futex_waiter {
+	struct futex_key fw_key;
+	bool fw_woken;                  /* picked by FUTEX_WAKE */
+	struct futex_waiter *fw_next;
+};
+
+static struct futex_bucket {
+	struct lock *fb_lock;
+	struct cv *fb_cv;
+	struct futex_waiter *fb_waiters;
+} futex_buckets[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_buckets[i].fb_lock = lock_create("futex");
+		futex_buckets[i].fb_cv = cv_create("futex");
+		if (futex_buckets[i].fb_lock == NULL ||
+		    futex_buckets[i].fb_cv == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_buckets[i].fb_waiters = NULL;
+	}
+}
+
+/*
+ * Work out the key for UADDR in the current process.
+ */
+static
+void
+futex_getkey(vaddr_t uaddr, struct futex_key *key)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	key->fk_obj = as;
+	key->fk_off = uaddr;
+
+#if !OPT_DUMBVM
+	struct region *reg;
+
+	rwlock_acquire_read(as->as_lock);
+	reg = as_region_lookup(as, uaddr);
+	if (reg != NULL && reg->reg_shm != NULL) {
+		key->fk_obj = reg->reg_shm;
+		key->fk_off = uaddr - reg->reg_vbase;
+	}
+	rwlock_release_read(as->as_lock);
+#endif
+}
+
+static
+struct futex_bucket *
+futex_hash(const struct futex_key *key)
+{
+	uint32_t h;
+
+	h = (uint32_t)key->fk_obj ^ (uint32_t)key->fk_off;
+	h ^= h >> 12;
+	h ^= h >> 6;
+	return &futex_buckets[(h >> 2) % FUTEX_NBUCKETS];
+}
+
+static
+bool
+futex_samekey(const struct futex_key *a, const struct futex_key *b)
+{
+	return a->fk_obj == b->fk_obj && a->fk_off == b->fk_off;
+}
+
+static
+int
+futex_wait(const struct futex_key *key, userptr_t uaddr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter w, **wp;
+	int curval, result;
+
+	fb = futex_hash(key);
+	lock_acquire(fb->fb_lock);
+
+	result = copyin((const_userptr_t)uaddr, &curval, sizeof(curval));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (curval != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	/* Go on the end, so that waiters are woken in order. */
+	w.fw_key = *key;
+	w.fw_woken = false;
+	w.fw_next = NULL;
+	for (wp = &fb->fb_waiters; *wp != NULL; wp = &(*wp)->fw_next) {
+		/* nothing */
+	}
+	*wp = &w;
+
+	while (!w.fw_woken) {
+		if (curproc->p_exiting) {
+			/* take ourselves off the list and go. */
+			for (wp = &fb->fb_waiters; *wp != &w;
+			     wp = &(*wp)->fw_next) {
+				/* nothing */
+			}
+			*wp = w.fw_next;
+			lock_release(fb->fb_lock);
+			return EINTR;
+		}
+		cv_wait(fb->fb_cv, fb->fb_lock);
+	}
+
+	/* futex_wake took us off the list. */
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+static
+unsigned
+futex_wake(const struct futex_key *key, unsigned max)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **wp, *w;
+	unsigned n;
+
+	fb = futex_hash(key);
+	lock_acquire(fb->fb_lock);
+
+	n = 0;
+	wp = &fb->fb_waiters;
+	while (*wp != NULL && n < max) {
+		w = *wp;
+		if (!futex_samekey(&w->fw_key, key)) {
+			wp = &w->fw_next;
+			continue;
+		}
+		*wp = w->fw_next;
+		w->fw_woken = true;
+		n++;
+	}
+	if (n > 0) {
+		cv_broadcast(fb->fb_cv, fb->fb_lock);
+	}
+
+	lock_release(fb->fb_lock);
+	return n;
+}
+
+/*
+ * Wake every waiter, so that those whose process is exiting give up.
+ * The others see they were not picked and sleep again.
+ */
+void
+futex_interrupt(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		lock_acquire(futex_buckets[i].fb_lock);
+		if (futex_buckets[i].fb_waiters != NULL) {
+			cv_broadcast(futex_buckets[i].fb_cv,
+				     futex_buckets[i].fb_lock);
+		}
+		lock_release(futex_buckets[i].fb_lock);
+	}
+}
+
+int
+sys_futex(userptr_t uaddr, int op, int val, int32_t *retval)
+{
+	struct futex_key key;
+	int result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	futex_getkey((vaddr_t)uaddr, &key);
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		result = futex_wait(&key, uaddr, val);
+		*retval = 0;
+		return result;
+	    case FUTEX_WAKE:
+		if (val < 0) {
+			return EINVAL;
+		}
+		*retval = futex_wake(&key, val);
+		return 0;
+	}
+	return EINVAL;
+}
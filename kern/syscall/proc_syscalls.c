@@ -37,6 +37,7 @@
 #include <lib.h>
 #include <machine/trapframe.h>
 #include <clock.h>
+#include <synch.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
@@ -157,3 +158,199 @@ sys_waitpid(pid_t pid, userptr_t retstatus, int flags, pid_t *retval)
 	}
 	return result;
 }
+
+/*
+ * sys_getrlimit
+ * only RLIMIT_RSS is kept; it is enforced by vm_fault.
+ */
+int
+sys_getrlimit(int resource, userptr_t rlp)
+{
+	struct rlimit rl;
+
+	if (resource != RLIMIT_RSS) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&curproc->p_lock);
+	rl = curproc->p_rsslimit;
+	spinlock_release(&curproc->p_lock);
+
+	return copyout(&rl, rlp, sizeof(rl));
+}
+
+/*
+ * sys_setrlimit
+ * anyone may lower the hard limit, but nobody may raise it again.
+ */
+int
+sys_setrlimit(int resource, const_userptr_t rlp)
+{
+	struct rlimit rl;
+	int result;
+
+	if (resource != RLIMIT_RSS) {
+		return EINVAL;
+	}
+
+	result = copyin(rlp, &rl, sizeof(rl));
+	if (result) {
+		return result;
+	}
+	if (rl.rlim_cur > rl.rlim_max) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&curproc->p_lock);
+	if (rl.rlim_max > curproc->p_rsslimit.rlim_max) {
+		spinlock_release(&curproc->p_lock);
+		return EPERM;
+	}
+	curproc->p_rsslimit = rl;
+	spinlock_release(&curproc->p_lock);
+
+	return 0;
+}
+
+/*
+ * sys_getpriority
+ * only PRIO_PROCESS, and only for the calling process: there are no
+ * process groups or users, and a pid can't be looked up. The result
+ * can be -1, so callers have to check errno.
+ */
+int
+sys_getpriority(int which, pid_t who, int32_t *retval)
+{
+	if (which != PRIO_PROCESS) {
+		return EINVAL;
+	}
+	if (who != 0 && who != curproc->p_pid) {
+		return ESRCH;
+	}
+
+	*retval = curthread->t_basepri;
+	return 0;
+}
+
+/*
+ * sys_setpriority
+ * as getpriority. PRIO is clamped to PRIO_MIN..PRIO_MAX, and is set
+ * for every thread in the process; threads and children made later
+ * inherit it. As with nice(2), a process may lower its priority but
+ * not raise it: priorities are strict, so a process spinning at
+ * PRIO_MIN would starve the kernel's own threads on its CPU.
+ */
+int
+sys_setpriority(int which, pid_t who, int prio)
+{
+	struct proc *proc = curproc;
+	unsigned i, num;
+
+	if (which != PRIO_PROCESS) {
+		return EINVAL;
+	}
+	if (who != 0 && who != proc->p_pid) {
+		return ESRCH;
+	}
+
+	if (prio < PRIO_MIN) {
+		prio = PRIO_MIN;
+	}
+	if (prio > PRIO_MAX) {
+		prio = PRIO_MAX;
+	}
+	if (prio < curthread->t_basepri) {
+		return EPERM;
+	}
+
+	lock_acquire(proc->p_threadslock);
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		thread_setbasepri(threadarray_get(&proc->p_threads, i), prio);
+	}
+	lock_release(proc->p_threadslock);
+
+	return 0;
+}
+
+/*
+ * Set the affinity mask and processor set of every thread in the
+ * process. Threads and children made later inherit them from their
+ * creator (thread_fork).
+ */
+static
+void
+proc_setcpus(cpumask_t affinity, unsigned pset)
+{
+	struct proc *proc = curproc;
+	unsigned i, num;
+
+	lock_acquire(proc->p_threadslock);
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		thread_setcpus(threadarray_get(&proc->p_threads, i),
+			       affinity, pset);
+	}
+	lock_release(proc->p_threadslock);
+
+	thread_checkcpus();
+}
+
+/*
+ * sys_setaffinity
+ * cpus that don't exist are dropped from the mask; it must still
+ * share a cpu with the process's processor set.
+ */
+int
+sys_setaffinity(unsigned mask)
+{
+	unsigned pset;
+
+	mask &= thread_allcpus();
+	pset = curthread->t_pset;
+	if ((mask & pset_getcpus(pset)) == 0) {
+		return EINVAL;
+	}
+
+	proc_setcpus(mask, pset);
+	return 0;
+}
+
+int
+sys_getaffinity(userptr_t mask)
+{
+	unsigned cpus;
+
+	cpus = curthread->t_affinity & thread_allcpus();
+	return copyout(&cpus, mask, sizeof(cpus));
+}
+
+/*
+ * sys_pset_bind
+ * returns the set the process was in; a PSET of -1 only asks. The
+ * set must share a cpu with the affinity mask, so it can't be empty.
+ */
+int
+sys_pset_bind(int pset, int32_t *retval)
+{
+	unsigned oldpset;
+	cpumask_t affinity;
+
+	oldpset = curthread->t_pset;
+	if (pset == -1) {
+		*retval = oldpset;
+		return 0;
+	}
+	if (pset < 0 || pset >= PSET_MAX) {
+		return EINVAL;
+	}
+
+	affinity = curthread->t_affinity;
+	if ((affinity & pset_getcpus(pset)) == 0) {
+		return EINVAL;
+	}
+
+	proc_setcpus(affinity, pset);
+	*retval = oldpset;
+	return 0;
+}
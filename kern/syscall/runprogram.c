@@ -44,6 +44,7 @@
 #include <copyinout.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <vmalloc.h>
 #include <vfs.h>
 #include <openfile.h>
 #include <filetable.h>
@@ -106,7 +107,7 @@ void
 argbuf_cleanup(struct argbuf *buf)
 {
 	if (buf->data != NULL) {
-		kfree(buf->data);
+		vfree(buf->data);
 		buf->data = NULL;
 	}
 	buf->len = 0;
@@ -119,13 +120,15 @@ argbuf_cleanup(struct argbuf *buf)
 }
 
 /*
- * Allocate the memory for an argv buffer.
+ * Allocate the memory for an argv buffer. A full-size buffer is
+ * ARG_MAX bytes, too many contiguous frames to count on once memory
+ * is fragmented, so it comes from vmalloc.
  */
 static
 int
 argbuf_allocate(struct argbuf *buf, size_t size)
 {
-	buf->data = kmalloc(size);
+	buf->data = vmalloc(size);
 	if (buf->data == NULL) {
 		return ENOMEM;
 	}
@@ -557,9 +560,21 @@ sys_execv(userptr_t prog, userptr_t uargv)
 	char *path;
 	struct argbuf kargv;
 	vaddr_t entrypoint, stackptr;
+	unsigned nthreads;
 	int argc;
 	int result;
 
+	/*
+	 * The old address space goes away, so nobody else may be
+	 * running in it: only a process down to one thread may exec.
+	 */
+	lock_acquire(curproc->p_threadslock);
+	nthreads = threadarray_num(&curproc->p_threads);
+	lock_release(curproc->p_threadslock);
+	if (nthreads > 1) {
+		return EBUSY;
+	}
+
 	path = kmalloc(PATH_MAX);
 	if (!path) {
 		return ENOMEM;
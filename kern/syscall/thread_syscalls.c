@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * User thread syscalls.
+ *
+ * New threads run in the process's own address space and share its
+ * file table; each gets a stack region of its own from
+ * as_define_threadstack. The kernel starts a thread at a trampoline
+ * in libc, passing the function and argument the way main() gets
+ * argc and argv, and the trampoline calls thread_exit with whatever
+ * the function returns.
+ *
+ * Threads are named by small integer IDs, unique within the process.
+ * The uthread records on p_uthreads hold the ID, the stack and, once
+ * the thread has exited, its status until thread_join collects it;
+ * p_threadslock protects them.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/* What the new thread needs to get to user mode. */
+struct uthread_start {
+	struct uthread *us_uthread;
+	vaddr_t us_entry;
+	vaddr_t us_func;
+	vaddr_t us_arg;
+	vaddr_t us_stackptr;
+};
+
+/*
+ * The new thread starts here.
+ */
+static
+void
+uthread_newthread(void *vus, unsigned long junk)
+{
+	struct uthread_start us;
+
+	(void)junk;
+
+	us = *(struct uthread_start *)vus;
+	kfree(vus);
+
+	curthread->t_uthread = us.us_uthread;
+
+	/* Don't bother starting if the process has exited meanwhile. */
+	if (curproc->p_exiting) {
+		proc_exit(0);
+	}
+
+	/* The trampoline gets FUNC and ARG where main gets argc and argv. */
+	enter_new_process((int)us.us_func, (userptr_t)us.us_arg, NULL,
+			  us.us_stackptr, us.us_entry);
+}
+
+/*
+ * sys___thread_create
+ * start a thread at ENTRY, which is passed FUNC and ARG.
+ */
+int
+sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg,
+		    int32_t *retval)
+{
+	struct proc *proc = curproc;
+	struct addrspace *as;
+	struct uthread *ut, **utp;
+	struct uthread_start *us;
+	vaddr_t stackbase, stackptr;
+	int result;
+
+	as = proc_getas();
+
+	ut = kmalloc(sizeof(*ut));
+	if (ut == NULL) {
+		return ENOMEM;
+	}
+	us = kmalloc(sizeof(*us));
+	if (us == NULL) {
+		kfree(ut);
+		return ENOMEM;
+	}
+
+	result = as_define_threadstack(as, &stackbase, &stackptr);
+	if (result) {
+		kfree(us);
+		kfree(ut);
+		return result;
+	}
+
+	ut->ut_stack = stackbase;
+	ut->ut_exited = false;
+	ut->ut_status = 0;
+
+	us->us_uthread = ut;
+	us->us_entry = (vaddr_t)entry;
+	us->us_func = (vaddr_t)func;
+	us->us_arg = (vaddr_t)arg;
+	us->us_stackptr = stackptr;
+
+	lock_acquire(proc->p_threadslock);
+	ut->ut_tid = proc->p_nexttid++;
+	ut->ut_next = proc->p_uthreads;
+	proc->p_uthreads = ut;
+	lock_release(proc->p_threadslock);
+
+	result = thread_fork(curthread->t_name, proc,
+			     uthread_newthread, us, 0);
+	if (result) {
+		lock_acquire(proc->p_threadslock);
+		for (utp = &proc->p_uthreads; *utp != ut;
+		     utp = &(*utp)->ut_next) {
+			/* nothing */
+		}
+		*utp = ut->ut_next;
+		lock_release(proc->p_threadslock);
+		as_remove_threadstack(as, stackbase);
+		kfree(us);
+		kfree(ut);
+		return result;
+	}
+
+	*retval = ut->ut_tid;
+	return 0;
+}
+
+/*
+ * sys_thread_join
+ * wait for thread TID to exit and collect its status.
+ */
+int
+sys_thread_join(int tid, userptr_t status)
+{
+	struct proc *proc = curproc;
+	struct uthread *ut, **utp;
+	int exitstatus;
+
+	/* Don't let a thread wait for itself. */
+	ut = curthread->t_uthread;
+	if (ut != NULL && ut->ut_tid == tid) {
+		return EINVAL;
+	}
+
+	lock_acquire(proc->p_threadslock);
+	while (1) {
+		for (utp = &proc->p_uthreads; *utp != NULL;
+		     utp = &(*utp)->ut_next) {
+			if ((*utp)->ut_tid == tid) {
+				break;
+			}
+		}
+		ut = *utp;
+		if (ut == NULL) {
+			/* never existed, or somebody else joined it. */
+			lock_release(proc->p_threadslock);
+			return ESRCH;
+		}
+		if (ut->ut_exited) {
+			break;
+		}
+		if (proc->p_exiting) {
+			lock_release(proc->p_threadslock);
+			return EINTR;
+		}
+		cv_wait(proc->p_threadcv, proc->p_threadslock);
+	}
+	*utp = ut->ut_next;
+	lock_release(proc->p_threadslock);
+
+	exitstatus = ut->ut_status;
+	kfree(ut);
+
+	if (status != NULL) {
+		return copyout(&exitstatus, status, sizeof(int));
+	}
+	return 0;
+}
+
+/*
+ * sys_thread_exit
+ * give back our stack, then let proc_thread_exit do the rest.
+ */
+__DEAD
+void
+sys_thread_exit(int status)
+{
+	struct uthread *ut = curthread->t_uthread;
+
+	if (ut != NULL) {
+		as_remove_threadstack(proc_getas(), ut->ut_stack);
+	}
+	proc_thread_exit(status);
+}
@@ -28,8 +28,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
+#include <timer.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
 #include <syscall.h>
 
 /*
@@ -56,3 +61,58 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * nanosleep: sleep for at least the interval in *REQ. The wait is
+ * rounded up to whole timer ticks. It sleeps on p_threadcv, which
+ * proc_exit broadcasts, so that another thread's _exit cuts it short
+ * with EINTR; the thread then leaves on its way back to user mode.
+ * Nothing else interrupts a sleep in OS/161, so if REM is given the
+ * time remaining is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct proc *proc = curproc;
+	struct timespec req, rem;
+	uint64_t ticks, now, end;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ticks = (uint64_t)req.tv_sec * TIMER_HZ +
+		((uint64_t)req.tv_nsec * TIMER_HZ + 999999999) / 1000000000;
+	end = timer_now() + ticks;
+
+	/* p_threadcv is also broadcast when threads exit; check the time. */
+	lock_acquire(proc->p_threadslock);
+	while ((now = timer_now()) < end) {
+		if (proc->p_exiting) {
+			lock_release(proc->p_threadslock);
+			return EINTR;
+		}
+		ticks = end - now;
+		if (ticks > TIMER_MAXTICKS) {
+			ticks = TIMER_MAXTICKS;
+		}
+		cv_wait_timeout(proc->p_threadcv, proc->p_threadslock,
+				(unsigned)ticks);
+	}
+	lock_release(proc->p_threadslock);
+
+	if (user_rem != NULL) {
+		rem.tv_sec = 0;
+		rem.tv_nsec = 0;
+		result = copyout(&rem, user_rem, sizeof(rem));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Virtual memory system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <limits.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <shm.h>
+#include <syscall.h>
+
+/*
+ * madvise - hand the hint to the address space.
+ *
+ * The start address must be page-aligned; the length is rounded up
+ * to whole pages.
+ */
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+	vaddr_t vaddr = (vaddr_t)addr;
+
+	if ((vaddr & PAGE_FRAME) != vaddr) {
+		return EINVAL;
+	}
+
+	return as_advise(proc_getas(), vaddr, len, advice);
+}
+
+/*
+ * shmmap - map a shared memory segment.
+ *
+ * A NULL name makes a new anonymous segment, which fork shares with
+ * the child. Otherwise the named segment is looked up, and created if
+ * it does not exist yet. Either way the address space gets a new
+ * region mapping the first LEN bytes (rounded up to pages) of it.
+ */
+int
+sys_shmmap(const_userptr_t name, size_t len, int prot, int32_t *retval)
+{
+	char kname[NAME_MAX+1];
+	struct shm_object *so;
+	size_t npages;
+	vaddr_t vaddr;
+	int result;
+
+	if (len == 0 || len > USERSTACK) {
+		return EINVAL;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE)) != 0 || prot == 0) {
+		return EINVAL;
+	}
+	npages = ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE;
+
+	if (name == NULL) {
+		result = shm_create(npages, &so);
+	} else {
+		result = copyinstr(name, kname, sizeof(kname), NULL);
+		if (result) {
+			return result;
+		}
+		result = shm_open(kname, npages, &so);
+	}
+	if (result) {
+		return result;
+	}
+
+	result = as_define_shared(proc_getas(), so, npages,
+				  (prot & PROT_READ) ? RF_R : 0,
+				  (prot & PROT_WRITE) ? RF_W : 0,
+				  &vaddr);
+	if (result) {
+		shm_decref(so);
+		return result;
+	}
+
+	*retval = (int32_t)vaddr;
+	return 0;
+}
+
+/*
+ * shmunmap - unmap a region made by shmmap.
+ */
+int
+sys_shmunmap(userptr_t addr)
+{
+	return as_remove_shared(proc_getas(), (vaddr_t)addr);
+}
+
+/*
+ * shmunlink - remove the name of a shared memory segment.
+ */
+int
+sys_shmunlink(const_userptr_t name)
+{
+	char kname[NAME_MAX+1];
+	int result;
+
+	result = copyinstr(name, kname, sizeof(kname), NULL);
+	if (result) {
+		return result;
+	}
+
+	return shm_unlink(kname);
+}
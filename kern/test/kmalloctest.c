@@ -36,6 +36,8 @@
 #include <thread.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
+#include <kmem_cache.h>
+#include <vmalloc.h>
 #include <test.h>
 
 #include "opt-dumbvm.h"
@@ -379,3 +381,393 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5
+
+/*
+ * Test object caches: several threads allocate and free objects from
+ * one cache, checking that objects come back in their constructed
+ * state and are never handed out twice, and that every object
+ * constructed is destroyed once the cache goes away.
+ */
+
+#define KM5_OBJSIZE  200
+#define KM5_NOBJS    64
+#define KM5_ROUNDS   20
+#define KM5_MAGIC    0x0b1ec7ed
+#define KM5_NOOWNER  (~0UL)
+
+struct km5obj {
+	uint32_t magic;
+	unsigned long owner;
+	char pad[KM5_OBJSIZE - sizeof(uint32_t) - sizeof(unsigned long)];
+};
+
+static struct spinlock km5_lock = SPINLOCK_INITIALIZER;
+static unsigned km5_ctors, km5_dtors;
+
+static
+int
+km5_ctor(void *obj)
+{
+	struct km5obj *ko = obj;
+
+	ko->magic = KM5_MAGIC;
+	ko->owner = KM5_NOOWNER;
+	spinlock_acquire(&km5_lock);
+	km5_ctors++;
+	spinlock_release(&km5_lock);
+	return 0;
+}
+
+static
+void
+km5_dtor(void *obj)
+{
+	struct km5obj *ko = obj;
+
+	KASSERT(ko->magic == KM5_MAGIC);
+	KASSERT(ko->owner == KM5_NOOWNER);
+	spinlock_acquire(&km5_lock);
+	km5_dtors++;
+	spinlock_release(&km5_lock);
+}
+
+static struct kmem_cache *km5_cache;
+
+static
+void
+kmalloctest5thread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	struct km5obj *ptrs[KM5_NOBJS];
+	unsigned i, round;
+
+	for (round=0; round<KM5_ROUNDS; round++) {
+		for (i=0; i<KM5_NOBJS; i++) {
+			ptrs[i] = kmem_cache_alloc(km5_cache);
+			if (ptrs[i] == NULL) {
+				panic("kmalloctest5: thread %lu: "
+				      "kmem_cache_alloc failed\n", num);
+			}
+			if (ptrs[i]->magic != KM5_MAGIC) {
+				panic("kmalloctest5: thread %lu: "
+				      "object not constructed\n", num);
+			}
+			if (ptrs[i]->owner != KM5_NOOWNER) {
+				panic("kmalloctest5: thread %lu: "
+				      "object already owned by %lu\n",
+				      num, ptrs[i]->owner);
+			}
+			ptrs[i]->owner = num;
+		}
+		thread_yield();
+		for (i=0; i<KM5_NOBJS; i++) {
+			if (ptrs[i]->owner != num) {
+				panic("kmalloctest5: thread %lu: "
+				      "object taken by %lu\n",
+				      num, ptrs[i]->owner);
+			}
+			ptrs[i]->owner = KM5_NOOWNER;
+			kmem_cache_free(km5_cache, ptrs[i]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	struct semaphore *sem;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting object cache test...\n");
+
+	km5_ctors = km5_dtors = 0;
+	km5_cache = kmem_cache_create("km5", sizeof(struct km5obj),
+				      km5_ctor, km5_dtor);
+	if (km5_cache == NULL) {
+		panic("kmalloctest5: kmem_cache_create failed\n");
+	}
+
+	sem = sem_create("kmalloctest5", 0);
+	if (sem == NULL) {
+		panic("kmalloctest5: sem_create failed\n");
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("kmalloctest5", NULL,
+				     kmalloctest5thread, sem, i);
+		if (result) {
+			panic("kmalloctest5: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		P(sem);
+	}
+	sem_destroy(sem);
+
+	kmem_cache_destroy(km5_cache);
+	km5_cache = NULL;
+
+	if (km5_ctors == 0 || km5_ctors != km5_dtors) {
+		panic("kmalloctest5: %u objects constructed, %u destroyed\n",
+		      km5_ctors, km5_dtors);
+	}
+
+	kprintf("Object cache test done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// km6
+
+/*
+ * Test vmalloc: like km4, several threads allocate and free blocks of
+ * several pages, and each block is filled with a pattern that is
+ * checked before it is freed, so pages mapped twice or mapped to the
+ * wrong frame show up.
+ */
+
+#define NUM_KM6_SIZES 5
+#define KM6_TRIES     200
+
+static
+void
+km6_fill(uint32_t *block, unsigned npages, unsigned long num)
+{
+	unsigned i, n;
+
+	n = npages * PAGE_SIZE / sizeof(uint32_t);
+	for (i=0; i<n; i++) {
+		block[i] = i ^ (num << 24) ^ (vaddr_t)block;
+	}
+}
+
+static
+void
+km6_check(uint32_t *block, unsigned npages, unsigned long num)
+{
+	unsigned i, n;
+
+	n = npages * PAGE_SIZE / sizeof(uint32_t);
+	for (i=0; i<n; i++) {
+		if (block[i] != (i ^ (num << 24) ^ (vaddr_t)block)) {
+			panic("kmalloctest6: thread %lu: block %p word %u "
+			      "overwritten\n", num, block, i);
+		}
+	}
+}
+
+static
+void
+kmalloctest6thread(void *sm, unsigned long num)
+{
+	static const unsigned sizes[NUM_KM6_SIZES] = { 1, 7, 16, 3, 9 };
+
+	struct semaphore *sem = sm;
+	uint32_t *ptrs[NUM_KM6_SIZES];
+	unsigned p, q;
+	unsigned i;
+
+	for (i=0; i<NUM_KM6_SIZES; i++) {
+		ptrs[i] = NULL;
+	}
+	p = 0;
+	q = NUM_KM6_SIZES / 2;
+
+	for (i=0; i<KM6_TRIES; i++) {
+		if (ptrs[q] != NULL) {
+			km6_check(ptrs[q], sizes[q], num);
+			vfree(ptrs[q]);
+			ptrs[q] = NULL;
+		}
+		ptrs[p] = vmalloc(sizes[p] * PAGE_SIZE);
+		if (ptrs[p] == NULL) {
+			panic("kmalloctest6: thread %lu: "
+			      "allocating %u pages failed\n",
+			      num, sizes[p]);
+		}
+		km6_fill(ptrs[p], sizes[p], num);
+		p = (p + 1) % NUM_KM6_SIZES;
+		q = (q + 1) % NUM_KM6_SIZES;
+	}
+
+	for (i=0; i<NUM_KM6_SIZES; i++) {
+		if (ptrs[i] != NULL) {
+			km6_check(ptrs[i], sizes[i], num);
+			vfree(ptrs[i]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmalloctest6(int nargs, char **args)
+{
+	struct semaphore *sem;
+	unsigned nthreads;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting vmalloc test...\n");
+#if OPT_DUMBVM
+	kprintf("(dumbvm has no vmalloc; this tests kmalloc instead)\n");
+#endif
+
+	sem = sem_create("kmalloctest6", 0);
+	if (sem == NULL) {
+		panic("kmalloctest6: sem_create failed\n");
+	}
+
+	nthreads = (3*NTHREADS)/4;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("kmalloctest6", NULL,
+				     kmalloctest6thread, sem, i);
+		if (result) {
+			panic("kmalloctest6: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<nthreads; i++) {
+		P(sem);
+	}
+
+	sem_destroy(sem);
+	kprintf("vmalloc test done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// km7
+
+/*
+ * Test the odd size classes and the large-object allocator: several
+ * threads allocate and free blocks of sizes that fall between the
+ * power-of-two classes and between whole pages, and each block is
+ * filled with a pattern that is checked before it is freed. Afterwards
+ * "kh" shows how much of what was set aside went unused.
+ */
+
+#define NUM_KM7_SIZES 12
+#define KM7_TRIES     300
+
+static
+void
+km7_fill(uint8_t *block, size_t size, unsigned long num)
+{
+	size_t i;
+
+	for (i=0; i<size; i++) {
+		block[i] = (uint8_t)(i ^ num ^ size);
+	}
+}
+
+static
+void
+km7_check(uint8_t *block, size_t size, unsigned long num)
+{
+	size_t i;
+
+	for (i=0; i<size; i++) {
+		if (block[i] != (uint8_t)(i ^ num ^ size)) {
+			panic("kmalloctest7: thread %lu: block %p (size %zu) "
+			      "byte %zu overwritten\n", num, block, size, i);
+		}
+	}
+}
+
+static
+void
+kmalloctest7thread(void *sm, unsigned long num)
+{
+	static const size_t sizes[NUM_KM7_SIZES] = {
+		20, 2900, 40, 4100, 90, 1400, 180, 9000, 300, 6000, 700, 4096
+	};
+
+	struct semaphore *sem = sm;
+	uint8_t *ptrs[NUM_KM7_SIZES];
+	unsigned p, q;
+	unsigned i;
+
+	for (i=0; i<NUM_KM7_SIZES; i++) {
+		ptrs[i] = NULL;
+	}
+	p = 0;
+	q = NUM_KM7_SIZES / 2;
+
+	for (i=0; i<KM7_TRIES; i++) {
+		if (ptrs[q] != NULL) {
+			km7_check(ptrs[q], sizes[q], num);
+			kfree(ptrs[q]);
+			ptrs[q] = NULL;
+		}
+		ptrs[p] = kmalloc(sizes[p]);
+		if (ptrs[p] == NULL) {
+			panic("kmalloctest7: thread %lu: "
+			      "allocating %zu bytes failed\n",
+			      num, sizes[p]);
+		}
+		km7_fill(ptrs[p], sizes[p], num);
+		p = (p + 1) % NUM_KM7_SIZES;
+		q = (q + 1) % NUM_KM7_SIZES;
+	}
+
+	for (i=0; i<NUM_KM7_SIZES; i++) {
+		if (ptrs[i] != NULL) {
+			km7_check(ptrs[i], sizes[i], num);
+			kfree(ptrs[i]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmalloctest7(int nargs, char **args)
+{
+	struct semaphore *sem;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting kmalloc size class test...\n");
+
+	sem = sem_create("kmalloctest7", 0);
+	if (sem == NULL) {
+		panic("kmalloctest7: sem_create failed\n");
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("kmalloctest7", NULL,
+				     kmalloctest7thread, sem, i);
+		if (result) {
+			panic("kmalloctest7: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		P(sem);
+	}
+
+	sem_destroy(sem);
+	kprintf("kmalloc size class test done\n");
+	return 0;
+}
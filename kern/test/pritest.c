@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Priority inheritance test.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define LOWPRI		10
+#define MIDPRI		5
+#define HIGHPRI		(-10)
+
+static struct lock *lock1;
+static struct lock *lock2;
+static struct semaphore *donesem;
+static struct thread *volatile midthread;
+
+static
+void
+inititems(void)
+{
+	if (lock1 == NULL) {
+		lock1 = lock_create("pritest1");
+		if (lock1 == NULL) {
+			panic("pritest: lock_create failed\n");
+		}
+	}
+	if (lock2 == NULL) {
+		lock2 = lock_create("pritest2");
+		if (lock2 == NULL) {
+			panic("pritest: lock_create failed\n");
+		}
+	}
+	if (donesem == NULL) {
+		donesem = sem_create("donesem", 0);
+		if (donesem == NULL) {
+			panic("pritest: sem_create failed\n");
+		}
+	}
+}
+
+/*
+ * Wait (up to a few seconds) for a lock to have the given number of
+ * waiters. The peek at lk_waiters is unlocked; it's only a hint.
+ */
+static
+bool
+waitfor(struct lock *lk, unsigned nwaiters)
+{
+	int i;
+
+	for (i=0; i<5; i++) {
+		if (lk->lk_waiters >= nwaiters) {
+			return true;
+		}
+		clocksleep(1);
+	}
+	kprintf("pritest: timed out waiting on %s\n", lk->lk_name);
+	return false;
+}
+
+static
+void
+highthread(void *data1, unsigned long data2)
+{
+	struct lock *lk = data1;
+
+	(void)data2;
+
+	thread_setbasepri(curthread, HIGHPRI);
+	lock_acquire(lk);
+	lock_release(lk);
+	V(donesem);
+}
+
+static
+void
+middlethread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	thread_setbasepri(curthread, MIDPRI);
+	lock_acquire(lock2);
+	midthread = curthread;
+	lock_acquire(lock1);
+	lock_release(lock1);
+	lock_release(lock2);
+	V(donesem);
+}
+
+static
+bool
+checkpri(const char *what, struct thread *t, int want)
+{
+	if (t->t_pri != want) {
+		kprintf("%s: priority %d, expected %d\n", what, t->t_pri, want);
+		return false;
+	}
+	return true;
+}
+
+int
+pritest(int nargs, char **args)
+{
+	int result, oldpri;
+	unsigned nthreads;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting priority inheritance test...\n");
+
+	oldpri = curthread->t_basepri;
+	thread_setbasepri(curthread, LOWPRI);
+
+	/* One waiter lends its priority directly to the holder. */
+	lock_acquire(lock1);
+	result = thread_fork("pritest", NULL, highthread, lock1, 0);
+	if (result) {
+		panic("pritest: thread_fork failed: %s\n", strerror(result));
+	}
+	if (waitfor(lock1, 1)) {
+		ok &= checkpri("direct", curthread, HIGHPRI);
+	}
+	else {
+		ok = false;
+	}
+	lock_release(lock1);
+	ok &= checkpri("direct release", curthread, LOWPRI);
+	P(donesem);
+
+	/*
+	 * Transitive: high waits on lock2, held by middle, which waits
+	 * on lock1, held by us. Both holders should run at high's
+	 * priority.
+	 */
+	midthread = NULL;
+	lock_acquire(lock1);
+	result = thread_fork("pritest", NULL, middlethread, NULL, 0);
+	if (result) {
+		panic("pritest: thread_fork failed: %s\n", strerror(result));
+	}
+	nthreads = 1;
+	if (waitfor(lock1, 1)) {
+		result = thread_fork("pritest", NULL, highthread, lock2, 0);
+		if (result) {
+			panic("pritest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		nthreads++;
+		if (waitfor(lock2, 1)) {
+			ok &= checkpri("transitive", curthread, HIGHPRI);
+			ok &= checkpri("transitive middle", midthread,
+				       HIGHPRI);
+		}
+		else {
+			ok = false;
+		}
+	}
+	else {
+		ok = false;
+	}
+	lock_release(lock1);
+	ok &= checkpri("transitive release", curthread, LOWPRI);
+	while (nthreads-- > 0) {
+		P(donesem);
+	}
+
+	thread_setbasepri(curthread, oldpri);
+
+	kprintf("%s\n", ok ? "Test passed" : "Test failed");
+	return 0;
+}
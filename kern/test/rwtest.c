@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Reader-writer lock tests.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define NREADERS     24
+#define NWRITERS     8
+#define NRWLOOPS     40
+#define NDATA        16
+
+static struct rwlock *testrw;
+static struct semaphore *startsem;
+static struct semaphore *donesem;
+
+/* Who is inside the lock, kept under our own spinlock. */
+static struct spinlock insidelock = SPINLOCK_INITIALIZER;
+static unsigned inreaders, inwriters, maxreaders;
+static bool rwfailed;
+
+static volatile unsigned long testdata[NDATA];
+
+static
+void
+inititems(void)
+{
+	if (testrw == NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+	}
+	if (startsem == NULL) {
+		startsem = sem_create("startsem", 0);
+		if (startsem == NULL) {
+			panic("rwtest: sem_create failed\n");
+		}
+	}
+	if (donesem == NULL) {
+		donesem = sem_create("donesem", 0);
+		if (donesem == NULL) {
+			panic("rwtest: sem_create failed\n");
+		}
+	}
+}
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	spinlock_acquire(&insidelock);
+	rwfailed = true;
+	spinlock_release(&insidelock);
+}
+
+/*
+ * Enter or leave the lock's critical section, checking that nobody
+ * is in it who shouldn't be.
+ */
+static
+void
+enter(unsigned long num, bool writer)
+{
+	spinlock_acquire(&insidelock);
+	if (writer) {
+		if (inreaders > 0 || inwriters > 0) {
+			spinlock_release(&insidelock);
+			rwfail(num, "writer got in alongside someone");
+			spinlock_acquire(&insidelock);
+		}
+		inwriters++;
+	}
+	else {
+		if (inwriters > 0) {
+			spinlock_release(&insidelock);
+			rwfail(num, "reader got in alongside a writer");
+			spinlock_acquire(&insidelock);
+		}
+		inreaders++;
+		if (inreaders > maxreaders) {
+			maxreaders = inreaders;
+		}
+	}
+	spinlock_release(&insidelock);
+}
+
+static
+void
+leave(bool writer)
+{
+	spinlock_acquire(&insidelock);
+	if (writer) {
+		inwriters--;
+	}
+	else {
+		inreaders--;
+	}
+	spinlock_release(&insidelock);
+}
+
+static
+void
+readerthread(void *junk, unsigned long num)
+{
+	unsigned i, j;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_read(testrw);
+		enter(num, false);
+		for (j=1; j<NDATA; j++) {
+			if (testdata[j] != testdata[0]) {
+				rwfail(num, "reader saw a torn write");
+				break;
+			}
+		}
+		/* let the other readers in while we are here */
+		thread_yield();
+		leave(false);
+		rwlock_release_read(testrw);
+	}
+	V(donesem);
+}
+
+static
+void
+writerthread(void *junk, unsigned long num)
+{
+	unsigned i, j;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rwlock_acquire_write(testrw);
+		enter(num, true);
+		if (!rwlock_do_i_hold_write(testrw)) {
+			rwfail(num, "rwlock_do_i_hold_write is false");
+		}
+		for (j=0; j<NDATA; j++) {
+			testdata[j] = num * NRWLOOPS + i;
+			if (j == NDATA/2) {
+				/* give a reader the chance to see half */
+				thread_yield();
+			}
+		}
+		leave(true);
+		rwlock_release_write(testrw);
+	}
+	V(donesem);
+}
+
+/*
+ * Stress test: readers check that they never see a write half done,
+ * and everyone checks that writers are alone in the lock.
+ */
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	rwfailed = false;
+	maxreaders = 0;
+	for (i=0; i<NREADERS + NWRITERS; i++) {
+		if (i < NWRITERS) {
+			result = thread_fork("rwtest", NULL, writerthread,
+					     NULL, i);
+		}
+		else {
+			result = thread_fork("rwtest", NULL, readerthread,
+					     NULL, i);
+		}
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NREADERS + NWRITERS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Up to %u readers held the lock at once\n", maxreaders);
+	if (rwfailed) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+static char order[3];
+static unsigned norder;
+
+static
+void
+prefwriter(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(startsem);
+	rwlock_acquire_write(testrw);
+	order[norder++] = 'W';
+	rwlock_release_write(testrw);
+	V(donesem);
+}
+
+static
+void
+prefreader(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(startsem);
+	rwlock_acquire_read(testrw);
+	order[norder++] = 'R';
+	rwlock_release_read(testrw);
+	V(donesem);
+}
+
+/*
+ * Writer preference: with a reader holding the lock and a writer
+ * waiting for it, a second reader must wait too, and get in only
+ * after the writer.
+ */
+int
+rwtest2(int nargs, char **args)
+{
+	int result;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock writer preference test...\n");
+
+	norder = 0;
+	ok = true;
+	rwlock_acquire_read(testrw);
+
+	result = thread_fork("rwtest2", NULL, prefwriter, NULL, 0);
+	if (result) {
+		panic("rwtest2: thread_fork failed: %s\n", strerror(result));
+	}
+	P(startsem);
+	clocksleep(1);
+	if (testrw->rwlock_wwaiting != 1) {
+		kprintf("The writer is not waiting\n");
+		ok = false;
+	}
+
+	result = thread_fork("rwtest2", NULL, prefreader, NULL, 0);
+	if (result) {
+		panic("rwtest2: thread_fork failed: %s\n", strerror(result));
+	}
+	P(startsem);
+	clocksleep(1);
+	if (testrw->rwlock_rwaiting != 1 || testrw->rwlock_readers != 1) {
+		kprintf("The second reader got past a waiting writer\n");
+		ok = false;
+	}
+
+	rwlock_release_read(testrw);
+	P(donesem);
+	P(donesem);
+
+	order[norder] = '\0';
+	if (strcmp(order, "WR") != 0) {
+		kprintf("Got in in the order %s, not WR\n", order);
+		ok = false;
+	}
+	kprintf("%s\n", ok ? "Test passed" : "Test failed");
+
+	return 0;
+}
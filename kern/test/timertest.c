@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timer wheel and timed wait tests.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <timer.h>
+#include <test.h>
+
+#define NTIMERS		16
+
+static struct timer timers[NTIMERS];
+static unsigned delays[NTIMERS];
+static uint64_t armed[NTIMERS];
+static uint64_t fired[NTIMERS];
+static struct semaphore *firesem;
+
+static struct lock *testlock;
+static struct cv *testcv;
+
+static
+void
+inititems(void)
+{
+	if (firesem == NULL) {
+		firesem = sem_create("firesem", 0);
+		if (firesem == NULL) {
+			panic("timertest: sem_create failed\n");
+		}
+	}
+	if (testlock == NULL) {
+		testlock = lock_create("timertest");
+		if (testlock == NULL) {
+			panic("timertest: lock_create failed\n");
+		}
+	}
+	if (testcv == NULL) {
+		testcv = cv_create("timertest");
+		if (testcv == NULL) {
+			panic("timertest: cv_create failed\n");
+		}
+	}
+}
+
+static
+void
+firefunc(void *data)
+{
+	unsigned i = (unsigned)(uintptr_t)data;
+
+	fired[i] = timer_now();
+	V(firesem);
+}
+
+static
+void
+signalthread(void *junk, unsigned long ticks)
+{
+	(void)junk;
+
+	timer_sleep(ticks);
+	lock_acquire(testlock);
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+}
+
+/*
+ * Arm timers with delays from one tick to past the first level of the
+ * wheel, so some are cascaded, and check that each fires on time.
+ * Then check cancelling, and that cv_wait_timeout both times out and
+ * can be signalled.
+ */
+int
+timertest(int nargs, char **args)
+{
+	uint64_t start;
+	unsigned i, elapsed;
+	bool ok = true;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting timer test...\n");
+
+	for (i=0; i<NTIMERS; i++) {
+		/* 1, 5, 13, ... up to nearly two turns of level 0 */
+		delays[i] = 1 + i * (i + 1) * 2;
+		fired[i] = 0;
+		timer_init(&timers[i], firefunc, (void *)(uintptr_t)i);
+	}
+	for (i=0; i<NTIMERS; i++) {
+		armed[i] = timer_now();
+		timer_add(&timers[i], delays[i]);
+	}
+	for (i=0; i<NTIMERS; i++) {
+		P(firesem);
+	}
+	for (i=0; i<NTIMERS; i++) {
+		/*
+		 * timer_add rounds the current time up, and without a
+		 * one-shot device the wheel only moves every hardclock.
+		 */
+		if (fired[i] < armed[i] + delays[i] ||
+		    fired[i] > armed[i] + delays[i] + TIMER_HZ / HZ + 1) {
+			kprintf("Timer %u: armed at %llu for %u, fired at "
+				"%llu\n", i, armed[i], delays[i], fired[i]);
+			ok = false;
+		}
+	}
+
+	timer_add(&timers[0], TIMER_HZ);
+	if (!timer_cancel(&timers[0])) {
+		kprintf("timer_cancel: pending timer was not pending\n");
+		ok = false;
+	}
+	if (timer_cancel(&timers[0])) {
+		kprintf("timer_cancel: cancelled twice\n");
+		ok = false;
+	}
+	clocksleep(2);
+	if (firesem->sem_count != 0) {
+		kprintf("Cancelled timer fired\n");
+		ok = false;
+	}
+
+	lock_acquire(testlock);
+	start = timer_now();
+	result = cv_wait_timeout(testcv, testlock, TIMER_HZ / 2);
+	elapsed = timer_now() - start;
+	if (result != ETIMEDOUT || elapsed < TIMER_HZ / 2) {
+		kprintf("cv_wait_timeout: got %d after %u ticks\n",
+			result, elapsed);
+		ok = false;
+	}
+
+	result = thread_fork("timertest", NULL, signalthread, NULL,
+			     TIMER_HZ / 10);
+	if (result) {
+		panic("timertest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	result = cv_wait_timeout(testcv, testlock, 10 * TIMER_HZ);
+	if (result != 0) {
+		kprintf("cv_wait_timeout: timed out while signalled\n");
+		ok = false;
+	}
+	lock_release(testlock);
+
+	kprintf("%s\n", ok ? "Test passed" : "Test failed");
+
+	return 0;
+}
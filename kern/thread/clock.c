@@ -30,17 +30,18 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
-#include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <timer.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at points in the future, and timed sleeps, go through the
+ * timer wheel in timer.c. It is driven by a one-shot timer device
+ * through timerclock() when there is one, and otherwise by hardclock
+ * on CPU 0.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,14 +51,7 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
-
-/*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+#define SCHEDULE_HARDCLOCKS	100	/* Reset priorities every 100 hardclocks. */
 
 /*
  * Setup.
@@ -65,24 +59,17 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
+	timer_bootstrap();
 }
 
 /*
- * This is called once per second, on one processor, by the timer
- * code.
+ * This is called on CPU 0 by the one-shot timer device registered
+ * with timer_setdevice, when the time it was asked for comes.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+	timer_run();
 }
 
 /*
@@ -97,13 +84,13 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	if (curcpu->c_number == 0 && !timer_hasdevice()) {
+		timer_run();
 	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_tick();
 }
 
 /*
@@ -112,10 +99,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		timer_sleep((unsigned)num_secs * TIMER_HZ);
 	}
-	spinlock_release(&lbolt_lock);
 }
@@ -33,10 +33,14 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
 
@@ -120,6 +124,36 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+P_intr(struct semaphore *sem, volatile bool *flag)
+{
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0) {
+		/* with the count at 0, giving up can't lose a V. */
+		if (*flag) {
+			spinlock_release(&sem->sem_lock);
+			return EINTR;
+		}
+		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+	}
+	sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+	return 0;
+}
+
+void
+sem_interrupt(struct semaphore *sem)
+{
+	KASSERT(sem != NULL);
+
+	spinlock_acquire(&sem->sem_lock);
+	wchan_wakeall(sem->sem_wchan, &sem->sem_lock);
+	spinlock_release(&sem->sem_lock);
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -164,6 +198,12 @@ lock_create(const char *name)
 	}
 	spinlock_init(&lock->lk_lock);
 	lock->lk_holder = NULL;
+	lock->lk_contended = 0;
+	lock->lk_spun = 0;
+	lock->lk_slept = 0;
+	lock->lk_waiters = 0;
+	lock->lk_pri = PRIO_MAX;
+	lock->lk_nextheld = NULL;
 
 	return lock;
 }
@@ -174,6 +214,7 @@ lock_destroy(struct lock *lock)
 	KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock->lk_waiters == 0);
 	spinlock_cleanup(&lock->lk_lock);
 	wchan_destroy(lock->lk_wchan);
 
@@ -181,9 +222,222 @@ lock_destroy(struct lock *lock)
 	kfree(lock);
 }
 
+/*
+ * Whether a thread waiting for LOCK should spin rather than sleep:
+ * the holder must be running right now, on another cpu, so that it
+ * can get out of the critical section while we wait. Called with
+ * lk_lock held, so the holder cannot go away under us.
+ */
+static
+bool
+lock_spinnable(struct lock *lock)
+{
+	struct thread *holder;
+
+	holder = lock->lk_holder;
+	return holder->t_state == S_RUN && holder->t_cpu != curcpu->c_self;
+}
+
+/*
+ * Priority inheritance.
+ *
+ * A thread asleep waiting for a lock lends its priority to the
+ * holder, and if the holder is asleep waiting for another lock, on to
+ * that one's holder, and so on. This walks the same graph of threads
+ * waiting for locks held by threads as the hangman deadlock detector
+ * does, but hangman is only there with "options hangman", so the
+ * edges are kept here, in t_waitlock and lk_holder. As in hangman,
+ * they are all under one spinlock, pri_lock; it is taken only when a
+ * thread sleeps for a lock, and when a lock with sleepers changes
+ * hands.
+ *
+ * A lock is on its holder's t_heldlocks list while it has waiters,
+ * with the best of their priorities in lk_pri. A thread's t_pri is
+ * the best of its t_basepri and its held locks' lk_pri. The walk
+ * stops where passing the priority on gains nothing, so it ends even
+ * around a deadlock.
+ *
+ * lk_pri is only worked out again when a waiter leaves. If a waiter's
+ * own priority gets worse in the meantime, what it lent lingers until
+ * then: priority can be kept a little too long, but not too short.
+ *
+ * Lock ordering: lk_lock, then pri_lock, then run queue locks (in
+ * thread_setpri).
+ */
+static struct spinlock pri_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * T's priority has got better; pass it on along the chain of locks
+ * and holders T is waiting behind.
+ */
+static
+void
+pri_donate(struct thread *t)
+{
+	struct lock *lock;
+	int pri;
+
+	KASSERT(spinlock_do_i_hold(&pri_lock));
+
+	pri = t->t_pri;
+	while ((lock = t->t_waitlock) != NULL) {
+		if (pri >= lock->lk_pri) {
+			break;
+		}
+		lock->lk_pri = pri;
+		t = lock->lk_holder;
+		if (t == NULL || pri >= t->t_pri) {
+			break;
+		}
+		thread_setpri(t, pri);
+	}
+}
+
+/*
+ * Work out T's priority again, from its own and its held locks'.
+ */
+static
+void
+pri_update(struct thread *t)
+{
+	struct lock *lock;
+	int pri, oldpri;
+
+	KASSERT(spinlock_do_i_hold(&pri_lock));
+
+	pri = t->t_basepri;
+	for (lock = t->t_heldlocks; lock != NULL; lock = lock->lk_nextheld) {
+		if (lock->lk_pri < pri) {
+			pri = lock->lk_pri;
+		}
+	}
+
+	oldpri = t->t_pri;
+	if (pri != oldpri) {
+		thread_setpri(t, pri);
+		if (pri < oldpri) {
+			pri_donate(t);
+		}
+	}
+}
+
+static
+void
+pri_link(struct thread *t, struct lock *lock)
+{
+	lock->lk_nextheld = t->t_heldlocks;
+	t->t_heldlocks = lock;
+}
+
+static
+void
+pri_unlink(struct thread *t, struct lock *lock)
+{
+	struct lock **p;
+
+	p = &t->t_heldlocks;
+	while (*p != lock) {
+		KASSERT(*p != NULL);
+		p = &(*p)->lk_nextheld;
+	}
+	*p = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+}
+
+/*
+ * Before sleeping for LOCK: lend the holder our priority.
+ */
+static
+void
+pri_wait(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder != NULL);
+
+	spinlock_acquire(&pri_lock);
+	if (lock->lk_waiters++ == 0) {
+		lock->lk_pri = PRIO_MAX;
+		pri_link(lock->lk_holder, lock);
+	}
+	curthread->t_waitlock = lock;
+	pri_donate(curthread);
+	spinlock_release(&pri_lock);
+}
+
+/*
+ * After sleeping for LOCK: stop lending. We are off the wchan, so
+ * lk_pri can be worked out again from those still on it.
+ */
+static
+void
+pri_unwait(struct lock *lock)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&pri_lock);
+	curthread->t_waitlock = NULL;
+	lock->lk_waiters--;
+	lock->lk_pri = wchan_toppri(lock->lk_wchan, &lock->lk_lock, PRIO_MAX);
+	holder = lock->lk_holder;
+	if (holder != NULL) {
+		if (lock->lk_waiters == 0) {
+			pri_unlink(holder, lock);
+		}
+		pri_update(holder);
+	}
+	spinlock_release(&pri_lock);
+}
+
+/*
+ * Take LOCK, which has waiters, and with it their priority.
+ */
+static
+void
+pri_take(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&pri_lock);
+	lock->lk_holder = curthread;
+	pri_link(curthread, lock);
+	pri_update(curthread);
+	spinlock_release(&pri_lock);
+}
+
+/*
+ * Let go of LOCK, which has waiters, and of their priority.
+ */
+static
+void
+pri_give(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&pri_lock);
+	pri_unlink(curthread, lock);
+	lock->lk_holder = NULL;
+	pri_update(curthread);
+	spinlock_release(&pri_lock);
+}
+
+void
+thread_setbasepri(struct thread *t, int pri)
+{
+	spinlock_acquire(&pri_lock);
+	t->t_basepri = pri;
+	pri_update(t);
+	spinlock_release(&pri_lock);
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	volatile struct thread *holder;
+	unsigned spins;
+	bool slept;
+
 	DEBUGASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
@@ -193,16 +447,54 @@ lock_acquire(struct lock *lock)
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
 	KASSERT(lock->lk_holder != curthread);
+	if (lock->lk_holder != NULL) {
+		lock->lk_contended++;
+	}
+	spins = 0;
+	slept = false;
 	while (lock->lk_holder != NULL) {
-		/* As in the semaphore. */
+		if (spins < LOCK_SPINMAX && lock_spinnable(lock)) {
+			/*
+			 * Wait for the holder to let go, with lk_lock
+			 * (and so interrupts) released, but only while
+			 * it is still running: once it blocks or is
+			 * switched out, go to sleep instead. Reading
+			 * its t_state unlocked is racy, but only a hint.
+			 */
+			holder = lock->lk_holder;
+			spinlock_release(&lock->lk_lock);
+			while (lock->lk_holder == holder &&
+			       holder->t_state == S_RUN &&
+			       spins < LOCK_SPINMAX) {
+				spins++;
+			}
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+		/* As in the semaphore, lending the holder our priority. */
+		pri_wait(lock);
 		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+		pri_unwait(lock);
+		slept = true;
+	}
+	if (lock->lk_waiters > 0) {
+		pri_take(lock);
+	}
+	else {
+		lock->lk_holder = curthread;
+	}
+	if (slept) {
+		lock->lk_slept++;
+	}
+	else if (spins > 0) {
+		lock->lk_spun++;
 	}
-	lock->lk_holder = curthread;
 
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
 
 	spinlock_release(&lock->lk_lock);
+	curthread->t_nlocks++;
 }
 
 void
@@ -213,7 +505,14 @@ lock_release(struct lock *lock)
 	spinlock_acquire(&lock->lk_lock);
 
 	KASSERT(lock->lk_holder == curthread);
-	lock->lk_holder = NULL;
+	KASSERT(curthread->t_nlocks > 0);
+	curthread->t_nlocks--;
+	if (lock->lk_waiters > 0) {
+		pri_give(lock);
+	}
+	else {
+		lock->lk_holder = NULL;
+	}
 	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 
 	/* Call this (atomically) when the lock is released */
@@ -298,6 +597,25 @@ cv_wait(struct cv *cv, struct lock *lock)
 	lock_acquire(lock);
 }
 
+/*
+ * As cv_wait, but give up after TICKS timer ticks; returns ETIMEDOUT
+ * if that happened and 0 if signalled. The lock is held again on
+ * return either way.
+ */
+int
+cv_wait_timeout(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+	int result;
+
+	spinlock_acquire(&cv->cv_wchanlock);
+	lock_release(lock);
+	result = wchan_sleep_timeout(cv->cv_wchan, &cv->cv_wchanlock, ticks);
+	spinlock_release(&cv->cv_wchanlock);
+	lock_acquire(lock);
+
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -315,3 +633,146 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rwlock_rwchan = wchan_create(rw->rwlock_name);
+	if (rw->rwlock_rwchan == NULL) {
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rwlock_wwchan = wchan_create(rw->rwlock_name);
+	if (rw->rwlock_wwchan == NULL) {
+		wchan_destroy(rw->rwlock_rwchan);
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+	spinlock_init(&rw->rwlock_lock);
+	rw->rwlock_readers = 0;
+	rw->rwlock_rwaiting = 0;
+	rw->rwlock_wwaiting = 0;
+	rw->rwlock_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	KASSERT(rw->rwlock_readers == 0);
+	KASSERT(rw->rwlock_writer == NULL);
+	spinlock_cleanup(&rw->rwlock_lock);
+	wchan_destroy(rw->rwlock_wwchan);
+	wchan_destroy(rw->rwlock_rwchan);
+
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	KASSERT(rw->rwlock_writer != curthread);
+	while (rw->rwlock_writer != NULL || rw->rwlock_wwaiting > 0) {
+		rw->rwlock_rwaiting++;
+		wchan_sleep(rw->rwlock_rwchan, &rw->rwlock_lock);
+		rw->rwlock_rwaiting--;
+	}
+	rw->rwlock_readers++;
+	spinlock_release(&rw->rwlock_lock);
+	curthread->t_nlocks++;
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	KASSERT(rw->rwlock_readers > 0);
+	KASSERT(curthread->t_nlocks > 0);
+	curthread->t_nlocks--;
+	rw->rwlock_readers--;
+	if (rw->rwlock_readers == 0 && rw->rwlock_wwaiting > 0) {
+		wchan_wakeone(rw->rwlock_wwchan, &rw->rwlock_lock);
+	}
+	spinlock_release(&rw->rwlock_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	KASSERT(rw->rwlock_writer != curthread);
+	while (rw->rwlock_writer != NULL || rw->rwlock_readers > 0) {
+		rw->rwlock_wwaiting++;
+		wchan_sleep(rw->rwlock_wwchan, &rw->rwlock_lock);
+		rw->rwlock_wwaiting--;
+	}
+	rw->rwlock_writer = curthread;
+	spinlock_release(&rw->rwlock_lock);
+	curthread->t_nlocks++;
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	KASSERT(rw->rwlock_writer == curthread);
+	KASSERT(curthread->t_nlocks > 0);
+	curthread->t_nlocks--;
+	rw->rwlock_writer = NULL;
+	/* Writers first; the readers get in when none are left. */
+	if (rw->rwlock_wwaiting > 0) {
+		wchan_wakeone(rw->rwlock_wwchan, &rw->rwlock_lock);
+	}
+	else if (rw->rwlock_rwaiting > 0) {
+		wchan_wakeall(rw->rwlock_rwchan, &rw->rwlock_lock);
+	}
+	spinlock_release(&rw->rwlock_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	bool ret;
+
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	ret = (rw->rwlock_writer == curthread);
+	spinlock_release(&rw->rwlock_lock);
+
+	return ret;
+}
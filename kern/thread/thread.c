@@ -51,8 +51,12 @@
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
+#include <membar.h>
 #include <vnode.h>
 #include <pid.h>
+#include <kmem_cache.h>
+#include <shrinker.h>
+#include <timer.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -72,6 +76,12 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Cpus in each processor set; see pset_assign. */
+static volatile cpumask_t pset_cpus[PSET_MAX];
+static struct spinlock pset_lock = SPINLOCK_INITIALIZER;
+
+static void thread_migrator_create(struct cpu *c);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +121,111 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Object cache for thread structures. Every field is set up afresh
+ * by thread_create, so there is no constructor.
+ */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread), NULL, NULL);
+
+/*
+ * Per-cpu pool of recycled threads. A dead thread is parked in the
+ * pool of the cpu that reaps it, still holding its stack, and
+ * thread_create takes from there before going to the object cache,
+ * so forking a thread usually costs neither a thread structure nor a
+ * stack page. The pool is only touched by its own cpu, with
+ * interrupts off.
+ */
+static
+struct thread *
+thread_pool_get(void)
+{
+	struct thread *thread;
+	int s;
+
+	thread = NULL;
+	s = splhigh();
+	if (CURCPU_EXISTS() && curcpu->c_nthreadpool > 0) {
+		thread = curcpu->c_threadpool[--curcpu->c_nthreadpool];
+	}
+	splx(s);
+	return thread;
+}
+
+/*
+ * Give back a thread structure that is no longer in use: park it in
+ * this cpu's pool if it has a stack and there is room, otherwise
+ * free it and its stack.
+ */
+static
+void
+thread_release(struct thread *thread)
+{
+	bool pooled;
+	int s;
+
+	pooled = false;
+	if (thread->t_stack != NULL) {
+		thread_checkstack(thread);
+		s = splhigh();
+		if (CURCPU_EXISTS() &&
+		    curcpu->c_nthreadpool < CPU_THREADPOOL_MAX) {
+			curcpu->c_threadpool[curcpu->c_nthreadpool++] = thread;
+			pooled = true;
+		}
+		splx(s);
+	}
+	if (!pooled) {
+		if (thread->t_stack != NULL) {
+			kfree(thread->t_stack);
+		}
+		kmem_cache_free(&thread_cache, thread);
+	}
+}
+
+/*
+ * Under memory pressure, free the threads parked in this cpu's pool.
+ * Only the stacks count as pages freed; the thread structures go back
+ * to thread_cache, whose empty slabs kmem_cache's shrinker reaps. The
+ * other cpus' pools are left alone, since only their own cpu may
+ * touch them.
+ */
+static
+unsigned
+thread_shrink_count(void)
+{
+	unsigned n;
+	int s;
+
+	n = 0;
+	s = splhigh();
+	if (CURCPU_EXISTS()) {
+		n = curcpu->c_nthreadpool;
+	}
+	splx(s);
+	return n * (STACK_SIZE / PAGE_SIZE);
+}
+
+static
+unsigned
+thread_shrink_scan(unsigned npages)
+{
+	struct thread *thread;
+	unsigned freed;
+
+	freed = 0;
+	while (freed < npages && (thread = thread_pool_get()) != NULL) {
+		kfree(thread->t_stack);
+		kmem_cache_free(&thread_cache, thread);
+		freed += STACK_SIZE / PAGE_SIZE;
+	}
+	return freed;
+}
+
+static struct shrinker thread_shrinker =
+	SHRINKER_INITIALIZER("threadpool", thread_shrink_count,
+			     thread_shrink_scan, 0);
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -123,14 +238,18 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = thread_pool_get();
 	if (thread == NULL) {
-		return NULL;
+		thread = kmem_cache_alloc(&thread_cache);
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		thread_release(thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -139,17 +258,29 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	/* t_stack is NULL, or the stack of a recycled thread */
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+	thread->t_level = 0;
+	thread->t_ticks = 0;
+	thread->t_affinity = CPUMASK_ALL;
+	thread->t_pset = 0;
+	thread->t_basepri = 0;
+	thread->t_pri = 0;
+	thread->t_waitlock = NULL;
+	thread->t_heldlocks = NULL;
+	thread->t_nlocks = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Public fields */
+	thread->t_uthread = NULL;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -182,19 +313,31 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_nthreadpool = 0;
 
 	c->c_isidle = false;
+	c->c_tickless = false;
+	c->c_tlbas = NULL;
 	threadlist_init(&c->c_runqueue);
+	c->c_strays = false;
+	c->c_migrator = NULL;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	if (c->c_number >= CPUMASK_BITS) {
+		panic("cpu_create: Too many cpus\n");
+	}
+
+	/* Every cpu starts out in processor set 0. No locking: boot time. */
+	pset_cpus[0] |= CPUMASK(c->c_number);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -211,11 +354,14 @@ cpu_create(unsigned hardware_number)
 		 * make it possible to free the boot stack?)
 		 */
 		/*c->c_curthread->t_stack = ... */
+		KASSERT(c->c_curthread->t_stack == NULL);
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
 		if (c->c_curthread->t_stack == NULL) {
-			panic("cpu_create: couldn't allocate stack");
+			c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+			if (c->c_curthread->t_stack == NULL) {
+				panic("cpu_create: couldn't allocate stack");
+			}
 		}
 		thread_checkstack_init(c->c_curthread);
 	}
@@ -277,9 +423,6 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -287,7 +430,10 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	thread->t_name = NULL;
+
+	/* This recycles the stack, or frees it. */
+	thread_release(thread);
 }
 
 /*
@@ -394,7 +540,7 @@ thread_bootstrap(void)
 	KASSERT(curthread->t_proc != NULL);
 	KASSERT(curthread->t_proc == kproc);
 
-	/* Done */
+	shrinker_register(&thread_shrinker);
 }
 
 /*
@@ -443,13 +589,193 @@ thread_start_cpus(void)
 	}
 	sem_destroy(cpu_startup_sem);
 	cpu_startup_sem = NULL;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		thread_migrator_create(cpuarray_get(&allcpus, i));
+	}
+}
+
+/*
+ * The mask of all cpus in the system. cpu_create numbers them from 0
+ * up.
+ */
+cpumask_t
+thread_allcpus(void)
+{
+	unsigned n;
+
+	n = cpuarray_num(&allcpus);
+	return n >= CPUMASK_BITS ? CPUMASK_ALL : CPUMASK(n) - 1;
+}
+
+/*
+ * The cpus T may run on: those in both its affinity mask and its
+ * processor set. The two are checked against each other when set,
+ * but a cpu can be moved out of the set afterwards; then the
+ * affinity mask wins, and if that names no cpu at all, anywhere
+ * goes. So there is always somewhere to run.
+ */
+static
+cpumask_t
+thread_cpumask(struct thread *t)
+{
+	cpumask_t all, mask;
+
+	all = thread_allcpus();
+	mask = t->t_affinity & pset_cpus[t->t_pset];
+	if (mask == 0) {
+		mask = t->t_affinity & all;
+	}
+	if (mask == 0) {
+		mask = all;
+	}
+	return mask;
+}
+
+static
+bool
+thread_cpuok(struct thread *t, struct cpu *c)
+{
+	return (thread_cpumask(t) & CPUMASK(c->c_number)) != 0;
+}
+
+/*
+ * Choose a cpu for T: its own, if it may run there, or else the
+ * least loaded one it may run on. The loads are read without locks
+ * and are only a hint.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	cpumask_t mask;
+	unsigned i, numcpus, load, bestload;
+
+	mask = thread_cpumask(t);
+	if (mask & CPUMASK(t->t_cpu->c_number)) {
+		return t->t_cpu;
+	}
+
+	best = NULL;
+	bestload = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		if ((mask & CPUMASK(i)) == 0) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+		load = c->c_runqueue.tl_count + (c->c_isidle ? 0 : 1);
+		if (best == NULL || load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Whether A should run before B: the more important priority first,
+ * then the higher level.
+ */
+static
+bool
+thread_before(struct thread *a, struct thread *b)
+{
+	if (a->t_pri != b->t_pri) {
+		return a->t_pri < b->t_pri;
+	}
+	return a->t_level < b->t_level;
+}
+
+/*
+ * Put T on C's run queue, which is kept sorted by t_pri and then by
+ * t_level (see thread_before), and FIFO among equals. Most threads go
+ * in at or near the tail, so search from there. The caller holds C's
+ * run queue lock.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct thread *prev;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (c->c_migrator != NULL && !thread_cpuok(t, c)) {
+		c->c_strays = true;
+	}
+	t->t_readyclock = c->c_hardclocks;
+	THREADLIST_FORALL_REV(prev, c->c_runqueue) {
+		if (!thread_before(t, prev)) {
+			break;
+		}
+	}
+	if (prev == NULL) {
+		threadlist_addhead(&c->c_runqueue, t);
+	}
+	else {
+		threadlist_insertafter(&c->c_runqueue, prev, t);
+	}
+}
+
+/*
+ * Take the first thread off C's run queue that may run on C. Any it
+ * passes over are strays, for the migrator to move (see
+ * thread_migrator); until C has a migrator, everything runs here.
+ * The caller holds C's run queue lock.
+ */
+static
+struct thread *
+runqueue_next(struct cpu *c)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL(t, c->c_runqueue) {
+		if (c->c_migrator == NULL || thread_cpuok(t, c)) {
+			threadlist_remove(&c->c_runqueue, t);
+			return t;
+		}
+		c->c_strays = true;
+	}
+	return NULL;
 }
 
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * targetcpu might be curcpu; it might not be, too. If the thread may
+ * not run on its cpu any more it goes to one it may run on, unless
+ * the old one is still on its stack (see thread_steal); then it is
+ * left there as a stray, for the migrator.
+ *
+ * If the target cpu is busy, the thread now waiting on its run queue
+ * could be stolen, but an idle cpu with its hardclock off (see
+ * thread_idle) won't come looking; wake one. This pairs with the
+ * check in thread_idle: each side sets its own state, then looks at
+ * the other's, so at least one of them sees the other.
  */
+static
+void
+thread_kick_tickless(struct thread *target)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	membar_any_any();
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c->c_tickless && thread_cpuok(target, c)) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
@@ -465,11 +791,18 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		if (!thread_cpuok(target, targetcpu) &&
+		    target != targetcpu->c_curthread) {
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			targetcpu = thread_pickcpu(target);
+			target->t_cpu = targetcpu;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -478,12 +811,133 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!targetcpu->c_isidle) {
+		thread_kick_tickless(target);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
+/*
+ * Work stealing.
+ *
+ * A cpu with nothing to run takes a thread from the cpu with the
+ * longest run queue, rather than busy cpus pushing work out. Only the
+ * idle cpu pays for it, and it locks one other run queue, not all of
+ * them; the queue lengths it chooses by are read without locks and
+ * are only a hint.
+ *
+ * Migrating a thread isn't free: its working cache set has to follow
+ * it. So that threads do not bounce between cpus, a thread is only
+ * stolen once it has waited at least STEAL_MINWAIT of its cpu's
+ * hardclocks, and the one taken is the one nearest the tail, which is
+ * the lowest priority and the longest waiting at that level. Threads
+ * that may not run on the stealing cpu are left alone. An idle cpu
+ * tries again each time its own hardclock wakes it, and keeps its
+ * hardclock running while there is anything to try for.
+ */
+#define STEAL_MINWAIT	1
+
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, count, most;
+
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > most) {
+			most = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	THREADLIST_FORALL_REV(t, victim->c_runqueue) {
+		/*
+		 * The victim's curthread can be on its run queue
+		 * briefly, if it went to sleep and was woken again
+		 * before its cpu got out of the idle loop. Migrating
+		 * it then would be disastrous; leave it.
+		 */
+		if (t != victim->c_curthread &&
+		    victim->c_hardclocks - t->t_readyclock >= STEAL_MINWAIT &&
+		    thread_cpuok(t, curcpu->c_self)) {
+			break;
+		}
+	}
+	if (t != NULL) {
+		threadlist_remove(&victim->c_runqueue, t);
+		t->t_cpu = curcpu->c_self;
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t != NULL) {
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	return t;
+}
+
+/*
+ * Idle until an interrupt comes in; called by thread_switch with
+ * nothing to run and nothing to steal.
+ *
+ * If no other cpu has anything queued, nothing needs this cpu's
+ * hardclock until something wakes it: an IPI when a thread is made
+ * runnable here or queued behind a running one elsewhere (see
+ * thread_kick_tickless), or a device interrupt. So turn it off, and
+ * back on after. CPU 0 has to keep ticking if it drives the timer
+ * wheel from hardclock, for want of a one-shot timer device.
+ */
+static
+void
+thread_idle(void)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+	bool tickless;
+
+	tickless = curcpu->c_number != 0 || timer_hasdevice();
+	if (tickless) {
+		curcpu->c_tickless = true;
+		membar_any_any();
+		numcpus = cpuarray_num(&allcpus);
+		for (i=0; i<numcpus; i++) {
+			c = cpuarray_get(&allcpus, i);
+			if (c != curcpu->c_self &&
+			    c->c_runqueue.tl_count > 0) {
+				tickless = false;
+				curcpu->c_tickless = false;
+				break;
+			}
+		}
+	}
+
+	if (tickless) {
+		mainbus_hardclock_stop();
+	}
+	cpu_idle();
+	if (tickless) {
+		curcpu->c_tickless = false;
+		mainbus_hardclock_start();
+	}
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -491,8 +945,9 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller, as are the affinity mask,
+ * processor set and priority. It will start on the same CPU as the
+ * caller, unless the scheduler intervenes first.
  */
 int
 thread_fork(const char *name,
@@ -508,11 +963,13 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless the thread was recycled with one */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -522,6 +979,10 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+	newthread->t_pset = curthread->t_pset;
+	newthread->t_basepri = curthread->t_basepri;
+	newthread->t_pri = newthread->t_basepri;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -590,8 +1051,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. The
+	 * migrator, and a thread that has to move, do have something
+	 * to do.
+	 */
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    cur != curcpu->c_migrator && thread_cpuok(cur, curcpu->c_self)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -602,6 +1068,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		if (cur == curcpu->c_migrator) {
+			/* It waits off the run queue; see below. */
+			break;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
@@ -625,7 +1095,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
+	 * Get the next thread. If there are strays on the run queue,
+	 * that is the migrator, which waits for this off any list (and
+	 * might be cur). Otherwise it is the first thread that may run
+	 * here. While there isn't one, try to steal one from another
+	 * cpu, and failing that idle (thread_idle).
 	 * curcpu->c_isidle must be true when cpu_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -644,10 +1118,19 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
-		if (next == NULL) {
+		if (curcpu->c_strays) {
+			curcpu->c_strays = false;
+			next = curcpu->c_migrator;
+		}
+		else {
+			next = runqueue_next(curcpu->c_self);
+		}
+		if (next == NULL && !curcpu->c_strays) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL) {
+				thread_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -819,141 +1302,310 @@ thread_yield(void)
 ////////////////////////////////////////////////////////////
 
 /*
- * Scheduler.
+ * Scheduler: strict priorities, and a multi-level feedback queue
+ * within each.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Each cpu's run queue is kept sorted by priority and then by level
+ * (see runqueue_add), so thread_switch always picks the oldest thread
+ * at the highest level of the best priority waiting. A thread is
+ * preempted at the next hardclock after a more important one becomes
+ * ready. Priorities only change by request (setpriority) and by
+ * inheritance through locks (synch.c).
+ *
+ * Within a priority, a thread's quantum doubles with each level
+ * down. A thread that uses a whole quantum is demoted a level, so
+ * CPU-bound threads sink and get longer, rarer turns; a thread woken
+ * from a wait channel goes up a level, so interactive threads stay
+ * near the top. A thread at a lower level is preempted at the next
+ * hardclock after something at a higher level becomes ready.
+ *
+ * So that sunken threads do not starve, schedule() periodically puts
+ * every thread on the cpu back at the top level. Less important
+ * priorities can starve; that is what they are for.
  */
+#define SCHED_NLEVELS		4
+#define SCHED_QUANTUM(level)	(1U << (level))	/* in hardclocks */
 
+/*
+ * Give a thread woken from a wait channel a level back. The caller
+ * holds it off any run queue, so no lock is needed.
+ */
+static
 void
-schedule(void)
+thread_wakeboost(struct thread *t)
 {
+	if (t->t_level > 0) {
+		t->t_level--;
+	}
+	t->t_ticks = 0;
+}
+
+void
+thread_tick(void)
+{
+	struct thread *cur, *next;
+	bool yield;
+
+	cur = curthread;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Nothing to charge when the timer interrupts the idle loop.
+	 * The migrator is not preempted: it has strays in hand.
 	 */
+	if (curcpu->c_isidle || cur == curcpu->c_migrator) {
+		return;
+	}
+
+	/* Get off a cpu it may no longer run on; see thread_checkcpus. */
+	if (!thread_cpuok(cur, curcpu->c_self)) {
+		thread_yield();
+		return;
+	}
+
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_level)) {
+		/* Used the whole quantum: demote. */
+		if (cur->t_level < SCHED_NLEVELS - 1) {
+			cur->t_level++;
+		}
+		cur->t_ticks = 0;
+		yield = true;
+	}
+	else {
+		/* Preempt if something more important is waiting. */
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		next = threadlist_isempty(&curcpu->c_runqueue) ? NULL :
+			curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		yield = next != NULL && thread_before(next, cur);
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
+
+	if (yield) {
+		thread_yield();
+	}
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * This is called periodically from hardclock(). Move every thread on
+ * this cpu back to the top level. The run queue stays sorted, since
+ * it was sorted by priority first and everything on it is now at the
+ * same level.
  */
 void
-thread_consider_migration(void)
+schedule(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
 	struct thread *t;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	THREADLIST_FORALL(t, curcpu->c_runqueue) {
+		t->t_level = 0;
+		t->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	curthread->t_level = 0;
+	curthread->t_ticks = 0;
+}
+
+/*
+ * Set the priority T runs at. If it is on a run queue, take it off and
+ * put it back, to keep the queue sorted; thread_tick preempts whatever
+ * it now belongs ahead of. T's cpu can change until we hold its run
+ * queue lock (see thread_steal), so check again once we do.
+ */
+void
+thread_setpri(struct thread *t, int pri)
+{
+	struct cpu *c;
+	struct thread *q;
+
+	while (1) {
+		c = t->t_cpu;
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (t->t_cpu == c) {
+			break;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	THREADLIST_FORALL(q, c->c_runqueue) {
+		if (q == t) {
+			break;
+		}
+	}
+	if (q != NULL) {
+		threadlist_remove(&c->c_runqueue, t);
+		t->t_pri = pri;
+		runqueue_add(c, t);
+	}
+	else {
+		t->t_pri = pri;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Affinity and processor sets.
+ *
+ * A thread may run on the cpus in both its affinity mask and its
+ * processor set (thread_cpumask). Stealing and thread_make_runnable
+ * keep threads on those. That leaves threads already on a cpu when
+ * they stop being allowed there: queued ones, and running ones, which
+ * join the queue at their next hardclock.
+ *
+ * Those are strays, and each cpu has a migrator thread to move them.
+ * Nothing else can: a thread can't be moved while its old cpu still
+ * runs on its stack, which the cpu goes on doing even when idle until
+ * it switches to another thread, and for the same reason a thread
+ * can't move itself. thread_switch runs the migrator ahead of
+ * anything else when c_strays is set. In between it waits in state
+ * S_READY but on no list, where only its own cpu's thread_switch
+ * will look for it.
+ */
+static
+void
+thread_migrator(void *data1, unsigned long data2)
+{
+	struct threadlist strays;
+	struct thread *t, *next;
+
+	(void)data1;
+	(void)data2;
+
+	threadlist_init(&strays);
+	while (1) {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		for (t = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		     t != NULL; t = next) {
+			next = t->t_listnode.tln_next->tln_self;
+			if (!thread_cpuok(t, curcpu->c_self)) {
+				threadlist_remove(&curcpu->c_runqueue, t);
+				threadlist_addtail(&strays, t);
+			}
+		}
+		spinlock_release(&curcpu->c_runqueue_lock);
+
+		/* This sends each somewhere it may run. */
+		while ((t = threadlist_remhead(&strays)) != NULL) {
+			thread_make_runnable(t, false);
+		}
+
+		thread_yield();
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
+/*
+ * Create cpu C's migrator. It starts out waiting, so it goes together
+ * the same way as thread_fork but isn't made runnable.
+ */
+static
+void
+thread_migrator_create(struct cpu *c)
+{
+	struct thread *t;
+	char namebuf[16];
+	int result;
+
+	snprintf(namebuf, sizeof(namebuf), "<migrate #%u>", c->c_number);
+	t = thread_create(namebuf);
+	if (t == NULL) {
+		panic("thread_migrator_create: Out of memory\n");
+	}
+	if (t->t_stack == NULL) {
+		t->t_stack = kmalloc(STACK_SIZE);
+		if (t->t_stack == NULL) {
+			panic("thread_migrator_create: Out of memory\n");
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+	}
+	thread_checkstack_init(t);
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
+	t->t_cpu = c;
+	t->t_affinity = CPUMASK(c->c_number);
+	result = proc_addthread(kproc, t);
+	if (result) {
+		panic("thread_migrator_create: proc_addthread: %s\n",
+		      strerror(result));
+	}
+	t->t_iplhigh_count++;
+	switchframe_init(t, thread_migrator, NULL, 0);
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	c->c_migrator = t;
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+void
+thread_setcpus(struct thread *t, cpumask_t affinity, unsigned pset)
+{
+	KASSERT(pset < PSET_MAX);
+
+	t->t_affinity = affinity;
+	t->t_pset = pset;
+}
+
+/*
+ * After thread_setcpus or pset_assign, move the threads that may no
+ * longer run where they are. Every cpu with anything queued runs its
+ * migrator, which checks. The caller moves now, if it has to; other
+ * running threads move at their next hardclock (see thread_tick).
+ */
+void
+thread_checkcpus(void)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (c->c_migrator != NULL &&
+		    !threadlist_isempty(&c->c_runqueue)) {
+			c->c_strays = true;
+			if (c->c_isidle && c != curcpu->c_self) {
 				ipi_send(c, IPI_UNIDLE);
 			}
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	if (!thread_cpuok(curthread, curcpu->c_self)) {
+		thread_yield();
 	}
+}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+cpumask_t
+pset_getcpus(unsigned pset)
+{
+	KASSERT(pset < PSET_MAX);
+	return pset_cpus[pset];
+}
+
+/*
+ * Move cpu CPUNUM to processor set PSET. A set may be left empty;
+ * threads bound to it then run wherever their affinity masks allow.
+ */
+int
+pset_assign(unsigned cpunum, unsigned pset)
+{
+	unsigned i;
+
+	if (cpunum >= cpuarray_num(&allcpus) || pset >= PSET_MAX) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&pset_lock);
+	for (i=0; i<PSET_MAX; i++) {
+		pset_cpus[i] &= ~CPUMASK(cpunum);
+	}
+	pset_cpus[pset] |= CPUMASK(cpunum);
+	spinlock_release(&pset_lock);
+
+	thread_checkcpus();
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////
@@ -962,6 +1614,33 @@ thread_consider_migration(void)
  * Wait channel functions
  */
 
+/*
+ * Wait channels come from an object cache whose objects keep their
+ * (empty) thread list initialized while free.
+ */
+static
+int
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_init(&wc->wc_threads);
+	return 0;
+}
+
+static
+void
+wchan_dtor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_cleanup(&wc->wc_threads);
+}
+
+static struct kmem_cache wchan_cache =
+	KMEM_CACHE_INITIALIZER("wchan", sizeof(struct wchan),
+			       wchan_ctor, wchan_dtor);
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -975,11 +1654,10 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(&wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
-	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 
 	return wc;
@@ -987,13 +1665,12 @@ wchan_create(const char *name)
 
 /*
  * Destroy a wait channel. Must be empty and unlocked.
- * (The corresponding cleanup functions require this.)
  */
 void
 wchan_destroy(struct wchan *wc)
 {
-	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	kmem_cache_free(&wchan_cache, wc);
 }
 
 /*
@@ -1020,22 +1697,104 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * State shared between wchan_sleep_timeout and its timer.
+ */
+struct wchan_timeout {
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	bool wt_timedout;
+};
+
+/*
+ * Timer callback for wchan_sleep_timeout: if the thread is still on
+ * the channel, take it off and wake it. If it isn't, somebody woke
+ * it first and there is nothing to do.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *t;
+
+	spinlock_acquire(wt->wt_lock);
+	THREADLIST_FORALL(t, wt->wt_wchan->wc_threads) {
+		if (t == wt->wt_thread) {
+			break;
+		}
+	}
+	if (t != NULL) {
+		threadlist_remove(&wt->wt_wchan->wc_threads, t);
+		wt->wt_timedout = true;
+		thread_wakeboost(t);
+		thread_make_runnable(t, false);
+	}
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS timer ticks. Returns 0 if
+ * woken by wchan_wakeone/wchan_wakeall and ETIMEDOUT otherwise.
+ *
+ * The timer is armed before we go onto the channel, but its callback
+ * needs LK, which we hold until thread_switch has queued us, so it
+ * cannot miss us. After we wake up timer_cancel makes sure the
+ * callback is no longer using WT or the timer, both on our stack.
+ */
+int
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	struct timer timer;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	/* must hold the spinlock */
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/* must not hold other spinlocks */
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	wt.wt_lock = lk;
+	wt.wt_timedout = false;
+	timer_init(&timer, wchan_timeout, &wt);
+	timer_add(&timer, ticks);
+
+	thread_switch(S_SLEEP, wc, lk);
+
+	timer_cancel(&timer);
+	spinlock_acquire(lk);
+	return wt.wt_timedout ? ETIMEDOUT : 0;
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel: the most important,
+ * and of those the first to sleep.
  */
 void
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 {
-	struct thread *target;
+	struct thread *target, *t;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
-	/* Grab a thread from the channel */
-	target = threadlist_remhead(&wc->wc_threads);
+	/* Grab the most important thread from the channel */
+	target = NULL;
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (target == NULL || t->t_pri < target->t_pri) {
+			target = t;
+		}
+	}
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
 		return;
 	}
+	threadlist_remove(&wc->wc_threads, target);
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1045,6 +1804,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_wakeboost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1075,12 +1835,31 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeboost(target);
 		thread_make_runnable(target, false);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Return the best priority among PRI and the channel's sleepers.
+ */
+int
+wchan_toppri(struct wchan *wc, struct spinlock *lk, int pri)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (t->t_pri < pri) {
+			pri = t->t_pri;
+		}
+	}
+	return pri;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1134,27 +1913,25 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Queue a TLB shootdown for the specified CPU, whose IPI lock the
+ * caller holds, and interrupt it.
+ *
+ * If the queue is full, fold everything in it into a single request
+ * to flush the whole TLB (ts_npages of 0), which covers all of them.
  */
+static
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+ipi_queueshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
 	unsigned n;
 
-	spinlock_acquire(&target->c_ipi_lock);
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
 
 	n = target->c_numshootdown;
 	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+		target->c_shootdown[0].ts_vaddr = 0;
+		target->c_shootdown[0].ts_npages = 0;
+		target->c_numshootdown = 1;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
@@ -1163,10 +1940,86 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
+}
 
+/*
+ * Run the TLB shootdowns queued for this CPU. The caller holds our
+ * IPI lock.
+ *
+ * Note: depending on your VM system locking you might need to release
+ * the ipi lock while calling vm_tlbshootdown.
+ */
+static
+void
+ipi_runshootdowns(void)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_ipi_lock));
+
+	for (i=0; i<curcpu->c_numshootdown; i++) {
+		vm_tlbshootdown(&curcpu->c_shootdown[i]);
+	}
+	curcpu->c_numshootdown = 0;
+	curcpu->c_shootdown_seq++;
+	curcpu->c_ipi_pending &= ~((uint32_t)1 << IPI_TLBSHOOTDOWN);
+}
+
+/*
+ * Send a TLB shootdown IPI to the specified CPU.
+ */
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+	ipi_queueshootdown(target, mapping);
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown to every other CPU whose current thread is in
+ * address space AS, or to every other CPU if AS is NULL, and wait for
+ * each to do it.
+ *
+ * The targets are done one at a time; with most processes running on
+ * one CPU there is usually nobody to wait for. While waiting, run any
+ * shootdowns sent to us, in case the target is waiting on us in turn
+ * with interrupts off. That's also why no spinlocks may be held: the
+ * target might be spinning for one with interrupts off.
+ */
+void
+ipi_tlbshootdown_as(struct addrspace *as, const struct tlbshootdown *mapping)
+{
+	unsigned i, seq;
+	struct cpu *c;
+
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		if (as != NULL && c->c_tlbas != as) {
+			continue;
+		}
+
+		spinlock_acquire(&c->c_ipi_lock);
+		seq = c->c_shootdown_seq;
+		ipi_queueshootdown(c, mapping);
+		spinlock_release(&c->c_ipi_lock);
+
+		while (c->c_shootdown_seq == seq) {
+			spinlock_acquire(&curcpu->c_ipi_lock);
+			if (curcpu->c_ipi_pending &
+			    ((uint32_t)1 << IPI_TLBSHOOTDOWN)) {
+				ipi_runshootdowns();
+			}
+			spinlock_release(&curcpu->c_ipi_lock);
+		}
+	}
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1174,7 +2027,6 @@ void
 interprocessor_interrupt(void)
 {
 	uint32_t bits;
-	unsigned i;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
@@ -1203,15 +2055,7 @@ interprocessor_interrupt(void)
 		 */
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
-		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
-		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
-		}
-		curcpu->c_numshootdown = 0;
+		ipi_runshootdowns();
 	}
 
 	curcpu->c_ipi_pending = 0;
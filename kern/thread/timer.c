@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hierarchical timer wheel. See timer.h for the interface.
+ *
+ * Everything is protected by timer_lock. timer_clock is the tick the
+ * wheel has been processed up to, which lags the real time (from
+ * gettime) until timer_run catches it up, one tick at a time. A
+ * pending timer is filed in the lowest level whose span covers
+ * tm_expires - timer_clock, in the slot given by the corresponding
+ * bits of tm_expires. Level 0 slots therefore hold only timers due at
+ * exactly one tick, and a higher level slot is cascaded when the
+ * levels below it wrap around, which is always before any timer in
+ * it is due.
+ *
+ * timer_armed is the tick the one-shot device has been asked to
+ * interrupt at, or 0 if it hasn't been. It needs to be no later than
+ * the earliest pending expiry, since catching up runs every tick in
+ * between, cascades included; it is also kept to no later than the
+ * next time level 0 wraps, so that catching up never has more than
+ * one turn of level 0 to go through. So while timers are pending the
+ * device interrupts at least every TIMER_L0SLOTS ticks, and while
+ * none are it doesn't interrupt at all, and the wheel is simply moved
+ * to the current time when the next one is added.
+ *
+ * Only CPU 0 runs the wheel, so callbacks never run concurrently
+ * with each other; timer_running lets timer_cancel on another cpu
+ * wait for the one that is running.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <timer.h>
+
+#define TIMER_L0MASK	(TIMER_L0SLOTS - 1)
+#define TIMER_LNMASK	(TIMER_LNSLOTS - 1)
+#define TIMER_USECS	(1000000 / TIMER_HZ)	/* microseconds per tick */
+
+static struct spinlock timer_lock = SPINLOCK_INITIALIZER;
+static bool timer_started;
+static uint64_t timer_base;		/* gettime() at timer_start, usecs */
+static uint64_t timer_clock;
+static uint64_t timer_armed;
+static unsigned timer_npending;
+static struct timer *timer_wheel0[TIMER_L0SLOTS];
+static struct timer *timer_wheeln[TIMER_LEVELS - 1][TIMER_LNSLOTS];
+static struct timer *timer_running;
+
+/* One-shot device, if any */
+static void *timer_devdata;
+static void (*timer_oneshot)(void *devdata, uint32_t usecs);
+
+/* Channel for timer_sleep; only timers ever wake it. */
+static struct wchan *timer_sleepchan;
+static struct spinlock timer_sleeplock = SPINLOCK_INITIALIZER;
+
+/*
+ * Setup.
+ */
+void
+timer_bootstrap(void)
+{
+	timer_sleepchan = wchan_create("timer_sleep");
+	if (timer_sleepchan == NULL) {
+		panic("timer_bootstrap: Out of memory\n");
+	}
+}
+
+/*
+ * Microseconds of real time since timer_start.
+ */
+static
+uint64_t
+timer_usecs(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - timer_base;
+}
+
+void
+timer_start(void)
+{
+	spinlock_acquire(&timer_lock);
+	KASSERT(!timer_started);
+	timer_base = 0;
+	timer_base = timer_usecs();
+	timer_clock = 0;
+	timer_started = true;
+	spinlock_release(&timer_lock);
+}
+
+void
+timer_setdevice(void *devdata, void (*oneshot)(void *devdata, uint32_t usecs))
+{
+	spinlock_acquire(&timer_lock);
+	KASSERT(timer_oneshot == NULL);
+	timer_devdata = devdata;
+	timer_oneshot = oneshot;
+	spinlock_release(&timer_lock);
+}
+
+bool
+timer_hasdevice(void)
+{
+	return timer_oneshot != NULL;
+}
+
+/*
+ * Ask the one-shot device to interrupt at tick WHEN.
+ */
+static
+void
+timer_program(uint64_t when)
+{
+	uint64_t now, target;
+
+	KASSERT(spinlock_do_i_hold(&timer_lock));
+
+	if (timer_oneshot == NULL) {
+		return;
+	}
+
+	now = timer_usecs();
+	target = when * TIMER_USECS;
+	if (target <= now) {
+		target = now + 1;
+	}
+	else if (target - now > 0xffffffff) {
+		/* Can't be reached as TIMER_MAXTICKS is about 18 hours */
+		target = now + 0xffffffff;
+	}
+	timer_oneshot(timer_devdata, target - now);
+	timer_armed = when;
+}
+
+void
+timer_init(struct timer *t, void (*func)(void *), void *data)
+{
+	t->tm_next = NULL;
+	t->tm_prevp = NULL;
+	t->tm_expires = 0;
+	t->tm_func = func;
+	t->tm_data = data;
+}
+
+/*
+ * File T in the slot for its expiry time. Also used for cascading,
+ * where T may be due this very tick.
+ */
+static
+void
+timer_insert(struct timer *t)
+{
+	struct timer **slot;
+	uint64_t delta;
+	unsigned level, shift;
+
+	KASSERT(spinlock_do_i_hold(&timer_lock));
+	KASSERT(t->tm_expires >= timer_clock);
+
+	delta = t->tm_expires - timer_clock;
+	if (delta < TIMER_L0SLOTS) {
+		slot = &timer_wheel0[t->tm_expires & TIMER_L0MASK];
+	}
+	else {
+		level = 1;
+		shift = TIMER_L0BITS;
+		while (delta >= (uint64_t)1 << (shift + TIMER_LNBITS)) {
+			level++;
+			shift += TIMER_LNBITS;
+		}
+		KASSERT(level < TIMER_LEVELS);
+		slot = &timer_wheeln[level - 1]
+			[(t->tm_expires >> shift) & TIMER_LNMASK];
+	}
+
+	t->tm_next = *slot;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_prevp = &t->tm_next;
+	}
+	t->tm_prevp = slot;
+	*slot = t;
+}
+
+static
+void
+timer_remove(struct timer *t)
+{
+	KASSERT(spinlock_do_i_hold(&timer_lock));
+	KASSERT(t->tm_prevp != NULL);
+
+	*t->tm_prevp = t->tm_next;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_prevp = t->tm_prevp;
+	}
+	t->tm_next = NULL;
+	t->tm_prevp = NULL;
+	timer_npending--;
+}
+
+/*
+ * The next tick at which level 0 wraps around.
+ */
+static
+uint64_t
+timer_wrap(void)
+{
+	return (timer_clock | TIMER_L0MASK) + 1;
+}
+
+void
+timer_add(struct timer *t, unsigned ticks)
+{
+	uint64_t now, when;
+
+	KASSERT(t->tm_func != NULL);
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	else if (ticks > TIMER_MAXTICKS) {
+		ticks = TIMER_MAXTICKS;
+	}
+
+	spinlock_acquire(&timer_lock);
+	KASSERT(timer_started);
+	KASSERT(t->tm_prevp == NULL);
+
+	now = timer_usecs();
+	if (timer_npending == 0 && timer_running == NULL) {
+		/* Nothing to run on the way, so just move the wheel. */
+		timer_clock = now / TIMER_USECS;
+	}
+
+	/*
+	 * Count from the real time, not timer_clock, which may be
+	 * behind. Round up, so we never fire early.
+	 */
+	t->tm_expires = (now + TIMER_USECS - 1) / TIMER_USECS + ticks;
+	timer_insert(t);
+	timer_npending++;
+
+	when = t->tm_expires < timer_wrap() ? t->tm_expires : timer_wrap();
+	if (timer_armed == 0 || when < timer_armed) {
+		timer_program(when);
+	}
+	spinlock_release(&timer_lock);
+}
+
+/*
+ * Must not be called from T's own callback, as it would wait for
+ * itself forever.
+ */
+bool
+timer_cancel(struct timer *t)
+{
+	bool pending = false;
+
+	spinlock_acquire(&timer_lock);
+	while (1) {
+		if (t->tm_prevp != NULL) {
+			/* Either never fired, or re-armed by its callback */
+			timer_remove(t);
+			pending = true;
+		}
+		if (timer_running != t) {
+			break;
+		}
+		/* Callback running on CPU 0; wait for it. */
+		spinlock_release(&timer_lock);
+		spinlock_acquire(&timer_lock);
+	}
+	/*
+	 * Leave the device armed; an interrupt with nothing due just
+	 * finds nothing to do.
+	 */
+	spinlock_release(&timer_lock);
+
+	return pending;
+}
+
+/*
+ * Empty the higher level slots that timer_clock has just reached,
+ * refiling their timers lower down. Level N is only cascaded when
+ * level N-1 has wrapped to slot 0 as well.
+ */
+static
+void
+timer_cascade(void)
+{
+	struct timer *t, *next;
+	unsigned level, shift, index;
+
+	shift = TIMER_L0BITS;
+	for (level = 1; level < TIMER_LEVELS; level++) {
+		index = (timer_clock >> shift) & TIMER_LNMASK;
+
+		t = timer_wheeln[level - 1][index];
+		timer_wheeln[level - 1][index] = NULL;
+		while (t != NULL) {
+			next = t->tm_next;
+			t->tm_prevp = NULL;
+			timer_insert(t);
+			t = next;
+		}
+
+		if (index != 0) {
+			break;
+		}
+		shift += TIMER_LNBITS;
+	}
+}
+
+/*
+ * The tick the device should next interrupt at: the first nonempty
+ * level 0 slot before the wheel next wraps, or the wrap itself, when
+ * there may be something to cascade.
+ */
+static
+uint64_t
+timer_nextevent(void)
+{
+	uint64_t when;
+
+	KASSERT(spinlock_do_i_hold(&timer_lock));
+
+	when = timer_clock + 1;
+	while ((when & TIMER_L0MASK) != 0) {
+		if (timer_wheel0[when & TIMER_L0MASK] != NULL) {
+			break;
+		}
+		when++;
+	}
+	return when;
+}
+
+void
+timer_run(void)
+{
+	struct timer **slot, *t;
+	uint64_t now;
+
+	spinlock_acquire(&timer_lock);
+	if (!timer_started) {
+		spinlock_release(&timer_lock);
+		return;
+	}
+
+	timer_armed = 0;
+	now = timer_usecs() / TIMER_USECS;
+	if (timer_npending == 0 && timer_clock < now) {
+		timer_clock = now;
+	}
+	while (timer_clock < now) {
+		timer_clock++;
+		if ((timer_clock & TIMER_L0MASK) == 0) {
+			timer_cascade();
+		}
+
+		slot = &timer_wheel0[timer_clock & TIMER_L0MASK];
+		while ((t = *slot) != NULL) {
+			KASSERT(t->tm_expires == timer_clock);
+			timer_remove(t);
+			timer_running = t;
+			spinlock_release(&timer_lock);
+
+			t->tm_func(t->tm_data);
+
+			spinlock_acquire(&timer_lock);
+			timer_running = NULL;
+		}
+	}
+
+	/*
+	 * Callbacks and other cpus may have armed the device in the
+	 * meantime; only ever move it earlier.
+	 */
+	if (timer_npending > 0) {
+		now = timer_nextevent();
+		if (timer_armed == 0 || now < timer_armed) {
+			timer_program(now);
+		}
+	}
+	spinlock_release(&timer_lock);
+}
+
+uint64_t
+timer_now(void)
+{
+	uint64_t now;
+
+	spinlock_acquire(&timer_lock);
+	now = timer_started ? timer_usecs() / TIMER_USECS : 0;
+	spinlock_release(&timer_lock);
+
+	return now;
+}
+
+/*
+ * Sleep for TICKS ticks. Nobody wakes timer_sleepchan, so each
+ * sleeper is woken exactly once, by its own timer.
+ */
+void
+timer_sleep(unsigned ticks)
+{
+	unsigned chunk;
+	int result;
+
+	spinlock_acquire(&timer_sleeplock);
+	while (ticks > 0) {
+		chunk = ticks > TIMER_MAXTICKS ? TIMER_MAXTICKS : ticks;
+		result = wchan_sleep_timeout(timer_sleepchan,
+					     &timer_sleeplock, chunk);
+		KASSERT(result == ETIMEDOUT);
+		ticks -= chunk;
+	}
+	spinlock_release(&timer_sleeplock);
+}
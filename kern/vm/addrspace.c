@@ -29,14 +29,21 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <synch.h>
+#include <membar.h>
+#include <cpu.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <shm.h>
+#include <zswap.h>
+#include <kmem_cache.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -48,6 +55,27 @@
  *
  */
 
+/*
+ * List of all address spaces, so that background scanners (KSM) can
+ * find them. Lock ordering: as_list_lock before any as_lock.
+ */
+static struct lock *as_list_lock;
+static struct addrspace *as_list;
+
+/* regions come from their own object cache. */
+static struct kmem_cache region_cache =
+	KMEM_CACHE_INITIALIZER("region", sizeof(struct region), NULL, NULL);
+
+void
+as_bootstrap(void)
+{
+	as_list_lock = lock_create("as_list");
+	if (as_list_lock == NULL) {
+		panic("as_bootstrap: Out of memory\n");
+	}
+	as_list = NULL;
+}
+
 /* Called by a new process, sets up structures necessary to represent new process. */
 struct addrspace *
 as_create(void)
@@ -61,6 +89,9 @@ as_create(void)
 
 	/* Initialise the regions linked list to be empty. */
 	as->regions = NULL;
+	as->as_evict_hand = 0;
+	as->as_rss = 0;
+	as->as_wss = 0;
 
 	/* Initialise the 2-level pagetable by allocating memory for the 1st level table. */
 	as->pagetable = (paddr_t **)alloc_kpages(1);
@@ -75,9 +106,69 @@ as_create(void)
 		as->pagetable[i] = NULL;
 	}
 
+	as->as_lock = rwlock_create("addrspace");
+	if (as->as_lock == NULL) {
+		free_kpages((vaddr_t)as->pagetable);
+		kfree(as);
+		return NULL;
+	}
+
+	/* make the address space visible to background scanners. */
+	lock_acquire(as_list_lock);
+	as->as_next = as_list;
+	as_list = as;
+	lock_release(as_list_lock);
+
 	return as;
 }
 
+/*
+ * Return the Nth address space on the list with its as_lock held, or
+ * NULL if there are fewer than N+1. Scanners walk the list by index
+ * so that they need not hold as_list_lock while they work.
+ */
+struct addrspace *
+as_lock_nth(unsigned n)
+{
+	struct addrspace *as;
+
+	lock_acquire(as_list_lock);
+	for (as = as_list; as != NULL && n > 0; as = as->as_next) {
+		n--;
+	}
+	if (as != NULL) {
+		rwlock_acquire_write(as->as_lock);
+	}
+	lock_release(as_list_lock);
+
+	return as;
+}
+
+/*
+ * Acquire the as_lock of AS if AS is still on the list, for callers
+ * holding a pointer that may have gone stale. Returns false, holding
+ * nothing, if it is not, or if the caller already holds the lock.
+ */
+bool
+as_lock_live(struct addrspace *as)
+{
+	struct addrspace *cur;
+
+	lock_acquire(as_list_lock);
+	for (cur = as_list; cur != NULL && cur != as; cur = cur->as_next) {
+		/* nothing */
+	}
+	if (cur != NULL && rwlock_do_i_hold_write(cur->as_lock)) {
+		cur = NULL;
+	}
+	if (cur != NULL) {
+		rwlock_acquire_write(cur->as_lock);
+	}
+	lock_release(as_list_lock);
+
+	return cur != NULL;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -89,11 +180,13 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
-	struct region *cur_reg;
+	struct region *cur_reg, *new_reg;
 	int permissions, readable, writeable, executable, result;
 	int i, j;
 	size_t memsize;
 	vaddr_t vaddr;
+
+	rwlock_acquire_write(old->as_lock);
 	cur_reg = old->regions;
 
 	/* copy the permissions and region structure */
@@ -106,24 +199,71 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		vaddr = cur_reg->reg_vbase;
 		result = as_define_region(newas, vaddr, memsize, readable, writeable, executable);
 		if (result != 0) {
+			rwlock_release_write(old->as_lock);
 			return result;
 		}
+		new_reg = as_region_lookup(newas, vaddr);
+		/* the child inherits any madvise() hint on the region. */
+		new_reg->reg_advice = cur_reg->reg_advice;
+		/* and maps the same segment for shared regions. */
+		if (cur_reg->reg_shm != NULL) {
+			shm_incref(cur_reg->reg_shm);
+			new_reg->reg_shm = cur_reg->reg_shm;
+		}
 
 		cur_reg = cur_reg->reg_next;
 	}
 
 	paddr_t paddr, entryLo;
+	rwlock_acquire_write(newas->as_lock);
 	for (i = 0; i < TABLE_SIZE; i++) {
 		if (old->pagetable[i] != NULL) {
 			newas->pagetable[i] = (paddr_t *)alloc_kpages(1);
 			if (newas->pagetable[i] == NULL) {
+				rwlock_release_write(newas->as_lock);
+				rwlock_release_write(old->as_lock);
 				return ENOMEM;
 			}
 			for (j = 0; j < TABLE_SIZE; j++) {
-				if (old->pagetable[i][j] != 0) {
+				vaddr = ((vaddr_t)i << 22) | ((vaddr_t)j << 12);
+				if ((old->pagetable[i][j] & PTE_ZSWAP) != 0) {
+					/* evicted page: the child gets it uncompressed. */
+					paddr = (paddr_t)alloc_kpages(1);
+					if (paddr == 0) {
+						rwlock_release_write(newas->as_lock);
+						rwlock_release_write(old->as_lock);
+						return ENOMEM;
+					}
+					result = zswap_load(PTE_TO_ZSWAP(old->pagetable[i][j]), paddr);
+					if (result != 0) {
+						free_kpages(paddr);
+						rwlock_release_write(newas->as_lock);
+						rwlock_release_write(old->as_lock);
+						return result;
+					}
+					entryLo = KVADDR_TO_PADDR(paddr) | TLBLO_VALID;
+					if ((as_region_lookup(old, vaddr)->permissions & RF_W) != 0) {
+						entryLo |= TLBLO_DIRTY;
+					}
+					newas->pagetable[i][j] = entryLo;
+					frame_setrmap(paddr, newas, vaddr);
+					newas->as_rss++;
+				} else if (old->pagetable[i][j] != 0 &&
+				    as_region_lookup(old, vaddr)->reg_shm != NULL) {
+					/* shared page: the child maps the same frame. */
+					newas->pagetable[i][j] = old->pagetable[i][j];
+				} else if (old->pagetable[i][j] != 0 &&
+				    frame_refcount(PADDR_TO_KVADDR(old->pagetable[i][j] & PAGE_FRAME)) > 1) {
+					/* KSM merged page: it stays merged in the child. */
+					frame_incref(PADDR_TO_KVADDR(old->pagetable[i][j] & PAGE_FRAME));
+					newas->pagetable[i][j] = old->pagetable[i][j];
+					newas->as_rss++;
+				} else if (old->pagetable[i][j] != 0) {
 					/* allocate a new frame for the copied entry. */
 					paddr = (paddr_t)alloc_kpages(1);
 					if (paddr == 0) {
+						rwlock_release_write(newas->as_lock);
+						rwlock_release_write(old->as_lock);
 						return ENOMEM;
 					}
 					/* copy data from old frame to new frame. */
@@ -135,6 +275,8 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 					}
 					/* insert new entry into new address space pagetable. */
 					newas->pagetable[i][j] = entryLo;
+					frame_setrmap(paddr, newas, vaddr);
+					newas->as_rss++;
 				} else {
 					newas->pagetable[i][j] = 0;
 				}
@@ -144,6 +286,9 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		}
 	}
 
+	rwlock_release_write(newas->as_lock);
+	rwlock_release_write(old->as_lock);
+
 	// kprintf("========== AS COPY FINISHED\n");
 	/* copy the necessary page data to the destination */
 
@@ -158,14 +303,34 @@ as_destroy(struct addrspace *as)
 	 * Clean up as needed.
 	 */
 	unsigned int i, j;
+	vaddr_t vaddr;
+	struct addrspace **prevp;
 	struct region *cur_reg;
 	struct region *next_reg;
 
+	/* take the address space off the list... */
+	lock_acquire(as_list_lock);
+	for (prevp = &as_list; *prevp != as; prevp = &(*prevp)->as_next) {
+		KASSERT(*prevp != NULL);
+	}
+	*prevp = as->as_next;
+	lock_release(as_list_lock);
+
+	/* ...and wait for any scanner still working on it to finish. */
+	rwlock_acquire_write(as->as_lock);
+	rwlock_release_write(as->as_lock);
+	rwlock_destroy(as->as_lock);
+
 	/* free all 2nd level tables in page table */
 	for (i = 0; i < TABLE_SIZE; i++) {
 		if (as->pagetable[i] != NULL) {
 			for (j = 0; j < TABLE_SIZE; j++) {
-				if (as->pagetable[i][j] != 0) {
+				vaddr = ((vaddr_t)i << 22) | ((vaddr_t)j << 12);
+				/* frames of shared regions belong to their segment. */
+				if ((as->pagetable[i][j] & PTE_ZSWAP) != 0) {
+					zswap_free(PTE_TO_ZSWAP(as->pagetable[i][j]));
+				} else if (as->pagetable[i][j] != 0 &&
+				    as_region_lookup(as, vaddr)->reg_shm == NULL) {
 					//kprintf("free address 0x%08x, virtual address 0x%08x\n", as->pagetable[i][j] & PAGE_FRAME, i<<22 | j<<12);
 					free_kpages((paddr_t)(PADDR_TO_KVADDR(as->pagetable[i][j]) & PAGE_FRAME));
 				}
@@ -181,7 +346,10 @@ as_destroy(struct addrspace *as)
 	cur_reg = as->regions;
 	while(cur_reg != NULL) {
 		next_reg = cur_reg->reg_next;
-		kfree(cur_reg);
+		if (cur_reg->reg_shm != NULL) {
+			shm_decref(cur_reg->reg_shm);
+		}
+		kmem_cache_free(&region_cache, cur_reg);
 		cur_reg = next_reg;
 	}
 
@@ -190,20 +358,29 @@ as_destroy(struct addrspace *as)
 	return;
 }
 
+/*
+ * Besides flushing the TLB, record in c_tlbas which address space the
+ * current thread runs in, so that vm_tlbinvalidate knows which other
+ * CPUs to send shootdowns to. The entries a kernel thread leaves
+ * behind don't need shooting down: they are flushed before any user
+ * thread runs here again.
+ */
 void as_activate(void) {
 	int i, spl;
 	struct addrspace *as;
 
 	as = proc_getas();
-	if (as == NULL) {
-		return;
-	}
 
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	curcpu->c_tlbas = as;
+	if (as != NULL) {
+		/* publish c_tlbas before loading anything from as. */
+		membar_any_any();
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
 	}
 
 	splx(spl);
@@ -221,6 +398,7 @@ void as_deactivate(void) {
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+	curcpu->c_tlbas = NULL;
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
@@ -228,6 +406,55 @@ void as_deactivate(void) {
 	splx(spl);
 }
 
+/*
+ * Allocate a region structure for NPAGES pages at page-aligned VADDR.
+ */
+static struct region *
+region_create(vaddr_t vaddr, size_t npages, int permissions)
+{
+	struct region *new_reg;
+
+	/* allocate memory for new region. */
+	new_reg = kmem_cache_alloc(&region_cache);
+	if (new_reg == NULL) {
+		return NULL;
+	}
+
+	/* save new region attributes. */
+	new_reg->reg_npages = npages;
+	new_reg->reg_vbase = vaddr;
+	new_reg->reg_next = NULL;
+	new_reg->permissions = permissions;
+	new_reg->reg_advice = MADV_NORMAL;
+	new_reg->reg_shm = NULL;
+
+	return new_reg;
+}
+
+/*
+ * Add a region to the end of the address space's region list. The
+ * caller holds as_lock.
+ */
+static void
+region_append(struct addrspace *as, struct region *new_reg)
+{
+	struct region *cur_reg;
+
+	KASSERT(rwlock_do_i_hold_write(as->as_lock));
+
+	/* if the regions list is null make this new region the head of the linked list. */
+	if (as->regions == NULL) {
+		as->regions = new_reg;
+	} else {
+		/* otherwise add the new region to the end of the list. */
+		cur_reg = as->regions;
+		while(cur_reg->reg_next != NULL) {
+			cur_reg = cur_reg->reg_next;
+		}
+		cur_reg->reg_next = new_reg;
+	}
+}
+
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
@@ -242,7 +469,6 @@ int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	struct region *cur_reg;
 	struct region *new_reg;
 	size_t npages;
 
@@ -269,29 +495,14 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
 	npages = memsize / PAGE_SIZE;
 
-	/* allocate memory for new region. */
-	new_reg = kmalloc(sizeof(struct region));
+	new_reg = region_create(vaddr, npages, readable | writeable | executable);
 	if (new_reg == NULL) {
 		return ENOMEM;
 	}
 
-	/* save new region attributes. */
-	new_reg->reg_npages = npages;
-	new_reg->reg_vbase = vaddr;
-	new_reg->reg_next = NULL;
-	new_reg->permissions = readable | writeable | executable;
-
-	/* if the regions list is null make this new region the head of the linked list. */
-	if (as->regions == NULL) {
-		as->regions = new_reg;
-	} else {
-		/* otherwise add the new region to the end of the list. */
-		cur_reg = as->regions;
-		while(cur_reg->reg_next != NULL) {
-			cur_reg = cur_reg->reg_next;
-		}
-		cur_reg->reg_next = new_reg;
-	}
+	rwlock_acquire_write(as->as_lock);
+	region_append(as, new_reg);
+	rwlock_release_write(as->as_lock);
 
 	return 0;
 }
@@ -305,6 +516,7 @@ as_prepare_load(struct addrspace *as)
 	}
 
 	struct region *cur_reg;
+	rwlock_acquire_write(as->as_lock);
 	cur_reg = as->regions;
 
 	// set read / write permissions for all regions
@@ -313,6 +525,7 @@ as_prepare_load(struct addrspace *as)
 		cur_reg->permissions = cur_reg->permissions << 3 | RF_R | RF_W;
 		cur_reg = cur_reg->reg_next;
 	}
+	rwlock_release_write(as->as_lock);
 
 	return 0;
 }
@@ -327,6 +540,7 @@ as_complete_load(struct addrspace *as)
 
 	int i, spl;
 	struct region *cur_reg;
+	rwlock_acquire_write(as->as_lock);
 	cur_reg = as->regions;
 
 	// reset write permissions to what they were originally
@@ -338,11 +552,13 @@ as_complete_load(struct addrspace *as)
 		if ((cur_reg->permissions & RF_W) == 0) {
 			int result = pagetable_update(as->pagetable, cur_reg->reg_vbase, cur_reg->reg_npages);
 			if (result != 0) {
+				rwlock_release_write(as->as_lock);
 				return result;
 			}
 		}
 		cur_reg = cur_reg->reg_next;
 	}
+	rwlock_release_write(as->as_lock);
 
 	/* flush the TLB to remove any read/write entries that should be readonly. */
 	spl = splhigh();
@@ -380,3 +596,403 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+
+/*
+ * Return the region of the address space containing vaddr, or NULL if
+ * vaddr does not lie within any defined region.
+ */
+struct region *
+as_region_lookup(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *cur_reg;
+
+	cur_reg = as->regions;
+	while (cur_reg != NULL) {
+		if (vaddr >= cur_reg->reg_vbase && vaddr <
+		    cur_reg->reg_vbase + cur_reg->reg_npages*PAGE_SIZE) {
+			return cur_reg;
+		}
+		cur_reg = cur_reg->reg_next;
+	}
+	return NULL;
+}
+
+/*
+ * MADV_DONTNEED for advise_range. As in vfree, the frames are only
+ * freed after one TLB shootdown for the whole range. The caller holds
+ * as_lock.
+ */
+static int
+advise_dontneed(struct addrspace *as, vaddr_t vaddr, vaddr_t vend)
+{
+	struct region *cur_reg;
+	vaddr_t va;
+	paddr_t entryLo;
+	bool flush;
+	int result;
+
+	flush = false;
+	for (va = vaddr; va < vend; va += PAGE_SIZE) {
+		result = pagetable_lookup(as->pagetable, va, &entryLo);
+		if (result != 0) {
+			return result;
+		}
+		if ((entryLo & PTE_ZSWAP) != 0) {
+			/* evicted: just drop the compressed copy. */
+			pagetable_insert(as->pagetable, va, 0);
+			zswap_free(PTE_TO_ZSWAP(entryLo));
+		} else if (entryLo != 0) {
+			pagetable_insert(as->pagetable, va,
+					 entryLo & ~(paddr_t)TLBLO_VALID);
+			flush = true;
+		}
+	}
+	if (!flush) {
+		return 0;
+	}
+
+	vm_tlbinvalidate(as, vaddr, (vend - vaddr) / PAGE_SIZE);
+
+	/* only the pages that were resident are left. */
+	for (va = vaddr; va < vend; va += PAGE_SIZE) {
+		pagetable_lookup(as->pagetable, va, &entryLo);
+		if (entryLo == 0) {
+			continue;
+		}
+		pagetable_insert(as->pagetable, va, 0);
+		/* shared frames stay with their segment. */
+		cur_reg = as_region_lookup(as, va);
+		if (cur_reg->reg_shm == NULL) {
+			free_kpages(PADDR_TO_KVADDR(entryLo & PAGE_FRAME));
+			as->as_rss--;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Body of as_advise for a range already checked to be mapped. The
+ * caller holds as_lock.
+ */
+static int
+advise_range(struct addrspace *as, vaddr_t vaddr, vaddr_t vend, int advice)
+{
+	struct region *cur_reg;
+	vaddr_t va;
+	paddr_t entryLo;
+	int result;
+
+	if (advice == MADV_DONTNEED) {
+		return advise_dontneed(as, vaddr, vend);
+	}
+
+	for (va = vaddr; va < vend; va += PAGE_SIZE) {
+		cur_reg = as_region_lookup(as, va);
+
+		switch (advice) {
+		    case MADV_NORMAL:
+		    case MADV_RANDOM:
+		    case MADV_SEQUENTIAL:
+			cur_reg->reg_advice = advice;
+			break;
+
+		    case MADV_WILLNEED:
+			result = pagetable_lookup(as->pagetable, va, &entryLo);
+			if (result != 0) {
+				return result;
+			}
+			if (entryLo == 0 || (entryLo & PTE_ZSWAP) != 0) {
+				/* only a hint; stop quietly when memory is short. */
+				if (vm_map_page(as, cur_reg, va, &entryLo)) {
+					return 0;
+				}
+			}
+			break;
+
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Apply an madvise() hint to the page-aligned range [vaddr, vaddr+len).
+ *
+ * MADV_DONTNEED releases the frames backing the range straight away;
+ * the next touch of each page zero-fills it again through vm_fault.
+ * In a shared region it only drops this address space's mappings, and
+ * the data is still there on the next touch.
+ * MADV_WILLNEED maps the whole range now so later accesses only take
+ * TLB refills. MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL record an
+ * access pattern on every region the range touches; vm_fault does
+ * fault-around on MADV_SEQUENTIAL regions.
+ *
+ * Every page of the range must lie in a defined region.
+ */
+int
+as_advise(struct addrspace *as, vaddr_t vaddr, size_t len, int advice)
+{
+	vaddr_t va, vend;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	if (advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+		return EINVAL;
+	}
+
+	/* the range must lie entirely within user space. */
+	if (vaddr >= MIPS_KSEG0 || len > MIPS_KSEG0 - vaddr) {
+		return EINVAL;
+	}
+	vend = vaddr + ROUNDUP(len, PAGE_SIZE);
+
+	rwlock_acquire_write(as->as_lock);
+
+	/* the whole range must be mapped before anything is changed. */
+	for (va = vaddr; va < vend; va += PAGE_SIZE) {
+		if (as_region_lookup(as, va) == NULL) {
+			rwlock_release_write(as->as_lock);
+			return ENOMEM;
+		}
+	}
+
+	result = advise_range(as, vaddr, vend, advice);
+	rwlock_release_write(as->as_lock);
+
+	return result;
+}
+
+/*
+ * Find a free range of NPAGES pages for a region the kernel places
+ * itself (shared segments, thread stacks). These go in the highest
+ * free range below the stack that is still above the lowest region of
+ * the program image, so the search steps down past any region that is
+ * in the way. The caller holds as_lock.
+ */
+static int
+region_findfree(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+	struct region *cur_reg, *conflict;
+	vaddr_t vbase, vend, floor;
+	size_t memsize;
+
+	KASSERT(rwlock_do_i_hold_write(as->as_lock));
+
+	if (npages == 0 || npages > USERSTACK / PAGE_SIZE) {
+		return EINVAL;
+	}
+	memsize = npages * PAGE_SIZE;
+
+	if (as->regions == NULL) {
+		return EINVAL;
+	}
+
+	/* never map below the lowest region, which is the program text. */
+	floor = as->regions->reg_vbase;
+	for (cur_reg = as->regions; cur_reg != NULL; cur_reg = cur_reg->reg_next) {
+		if (cur_reg->reg_vbase < floor) {
+			floor = cur_reg->reg_vbase;
+		}
+	}
+
+	vend = USERSTACK - STACK_NPAGES*PAGE_SIZE;
+	while (vend >= floor + memsize) {
+		vbase = vend - memsize;
+
+		conflict = NULL;
+		for (cur_reg = as->regions; cur_reg != NULL;
+		     cur_reg = cur_reg->reg_next) {
+			if (cur_reg->reg_vbase < vend && vbase <
+			    cur_reg->reg_vbase + cur_reg->reg_npages*PAGE_SIZE) {
+				conflict = cur_reg;
+				break;
+			}
+		}
+
+		if (conflict == NULL) {
+			*ret = vbase;
+			return 0;
+		}
+
+		/* try again just below the region in the way. */
+		vend = conflict->reg_vbase;
+	}
+
+	return ENOMEM;
+}
+
+/*
+ * Map NPAGES pages of shared segment SO into the address space, at an
+ * address chosen by region_findfree. On success the new region holds
+ * the caller's reference to SO.
+ */
+int
+as_define_shared(struct addrspace *as, struct shm_object *so, size_t npages,
+		 int readable, int writeable, vaddr_t *ret)
+{
+	struct region *new_reg;
+	vaddr_t vbase;
+	int result;
+
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	rwlock_acquire_write(as->as_lock);
+	result = region_findfree(as, npages, &vbase);
+	if (result) {
+		rwlock_release_write(as->as_lock);
+		return result;
+	}
+
+	new_reg = region_create(vbase, npages, readable | writeable);
+	if (new_reg == NULL) {
+		rwlock_release_write(as->as_lock);
+		return ENOMEM;
+	}
+	new_reg->reg_shm = so;
+	region_append(as, new_reg);
+	rwlock_release_write(as->as_lock);
+
+	*ret = vbase;
+	return 0;
+}
+
+/*
+ * Unmap the shared region beginning at VADDR and drop its reference
+ * to the segment. The frames themselves stay with the segment.
+ */
+int
+as_remove_shared(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *cur_reg, **prevp;
+	vaddr_t va, vend;
+	paddr_t entryLo;
+	int result;
+
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	rwlock_acquire_write(as->as_lock);
+	for (prevp = &as->regions; *prevp != NULL; prevp = &(*prevp)->reg_next) {
+		if ((*prevp)->reg_vbase == vaddr) {
+			break;
+		}
+	}
+	cur_reg = *prevp;
+	if (cur_reg == NULL || cur_reg->reg_shm == NULL) {
+		rwlock_release_write(as->as_lock);
+		return EINVAL;
+	}
+
+	/* clear the mappings before the region goes away. */
+	vend = cur_reg->reg_vbase + cur_reg->reg_npages*PAGE_SIZE;
+	for (va = cur_reg->reg_vbase; va < vend; va += PAGE_SIZE) {
+		result = pagetable_lookup(as->pagetable, va, &entryLo);
+		if (result != 0) {
+			rwlock_release_write(as->as_lock);
+			return result;
+		}
+		if (entryLo != 0) {
+			result = pagetable_insert(as->pagetable, va, 0);
+			if (result != 0) {
+				rwlock_release_write(as->as_lock);
+				return result;
+			}
+		}
+	}
+	/* one shootdown for the region, before the segment can go. */
+	vm_tlbinvalidate(as, cur_reg->reg_vbase, cur_reg->reg_npages);
+
+	*prevp = cur_reg->reg_next;
+	rwlock_release_write(as->as_lock);
+	shm_decref(cur_reg->reg_shm);
+	kmem_cache_free(&region_cache, cur_reg);
+
+	return 0;
+}
+
+/*
+ * Make a stack for a new thread: STACK_NPAGES pages, in a private
+ * region at an address chosen by region_findfree. Hands back the base
+ * of the region, to pass to as_remove_threadstack later, and the
+ * initial stack pointer.
+ */
+int
+as_define_threadstack(struct addrspace *as, vaddr_t *base, vaddr_t *stackptr)
+{
+	struct region *new_reg;
+	vaddr_t vbase;
+	int result;
+
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	rwlock_acquire_write(as->as_lock);
+	result = region_findfree(as, STACK_NPAGES, &vbase);
+	if (result) {
+		rwlock_release_write(as->as_lock);
+		return result;
+	}
+
+	new_reg = region_create(vbase, STACK_NPAGES, RF_R | RF_W);
+	if (new_reg == NULL) {
+		rwlock_release_write(as->as_lock);
+		return ENOMEM;
+	}
+	region_append(as, new_reg);
+	rwlock_release_write(as->as_lock);
+
+	*base = vbase;
+	*stackptr = vbase + STACK_NPAGES*PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Remove a thread stack made by as_define_threadstack, freeing its
+ * pages. Nothing may be running on it any more.
+ */
+int
+as_remove_threadstack(struct addrspace *as, vaddr_t base)
+{
+	struct region *cur_reg, **prevp;
+	int result;
+
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	rwlock_acquire_write(as->as_lock);
+	for (prevp = &as->regions; *prevp != NULL; prevp = &(*prevp)->reg_next) {
+		if ((*prevp)->reg_vbase == base) {
+			break;
+		}
+	}
+	cur_reg = *prevp;
+	if (cur_reg == NULL || cur_reg->reg_shm != NULL ||
+	    cur_reg->reg_npages != STACK_NPAGES) {
+		rwlock_release_write(as->as_lock);
+		return EINVAL;
+	}
+
+	result = advise_range(as, base, base + STACK_NPAGES*PAGE_SIZE,
+			      MADV_DONTNEED);
+	if (result) {
+		rwlock_release_write(as->as_lock);
+		return result;
+	}
+
+	*prevp = cur_reg->reg_next;
+	rwlock_release_write(as->as_lock);
+	kmem_cache_free(&region_cache, cur_reg);
+
+	return 0;
+}
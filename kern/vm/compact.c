@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Physical memory compaction. See compact.h.
+ *
+ * A pass looks for the window of the wanted size with no pinned frames
+ * and the fewest movable ones, then takes every frame in it: first the
+ * free frames are claimed outright, then each movable page is copied
+ * to a new frame elsewhere and its old frame kept rather than freed.
+ * Once the whole window is held it is either handed to the allocating
+ * thread as one run or, from the background thread, freed again so
+ * that the failed allocation succeeds when retried. If any frame
+ * cannot be taken, the pass frees what it took and gives up.
+ *
+ * The old mapping is shot down on every CPU running the address space
+ * before the page is copied, so nothing can write the old frame after.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <compact.h>
+
+static struct semaphore *compact_sem;   /* wakes the background thread */
+static bool compact_ready;              /* set once bootstrapped */
+
+/* compact_spinlock protects everything below. */
+static struct spinlock compact_spinlock = SPINLOCK_INITIALIZER;
+static unsigned compact_want;           /* run size to free in background */
+
+static struct {
+	unsigned cs_passes;             /* compaction passes */
+	unsigned cs_runs;               /* passes that got a run */
+	unsigned cs_migrated;           /* pages moved */
+	unsigned cs_deferred;           /* left to the background thread */
+} compact_stats;
+
+/*
+ * Whether the current thread may sleep, and so take as_list_lock and
+ * an as_lock. It must hold no sleep locks either: as_copy holds an
+ * as_lock while it waits for shm_lock, and shm_open holds shm_lock
+ * while it allocates, so compacting inline there could deadlock.
+ */
+static
+bool
+compact_cansleep(void)
+{
+	return CURCPU_EXISTS() &&
+		curthread->t_in_interrupt == false &&
+		curthread->t_curspl == 0 &&
+		curcpu->c_spinlocks == 0 &&
+		curthread->t_nlocks == 0;
+}
+
+/*
+ * Find the window of NPAGES frames with no pinned frames and the
+ * fewest movable ones. The frame table can change under us, so this
+ * is only an estimate; compact_take checks each frame again.
+ */
+static
+bool
+compact_findwindow(unsigned npages, unsigned *ret)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	unsigned nframes, i, len, cost, bestcost;
+	int state;
+
+	nframes = ram_getsize() / PAGE_SIZE;
+	bestcost = npages + 1;
+	len = 0;
+	cost = 0;
+
+	for (i = 0; i < nframes; i++) {
+		state = frame_info((paddr_t)i * PAGE_SIZE, &as, &vaddr);
+		if (state == FRAME_PINNED) {
+			len = 0;
+			cost = 0;
+			continue;
+		}
+		if (state == FRAME_MOVABLE) {
+			cost++;
+		}
+		len++;
+
+		/* slide the window: drop the frame falling off the back. */
+		if (len > npages) {
+			len = npages;
+			state = frame_info((paddr_t)(i - npages) * PAGE_SIZE,
+					   &as, &vaddr);
+			if (state == FRAME_MOVABLE && cost > 0) {
+				cost--;
+			}
+		}
+
+		if (len == npages && cost < bestcost) {
+			bestcost = cost;
+			*ret = i + 1 - npages;
+			if (cost == 0) {
+				break;
+			}
+		}
+	}
+
+	return bestcost <= npages;
+}
+
+/*
+ * Move the page in the frame at PADDR, which the reverse map says AS
+ * maps at VADDR, to a new frame. The old frame is left allocated to
+ * the caller.
+ */
+static
+int
+compact_migrate(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	vaddr_t oldkvaddr, newkvaddr;
+	paddr_t entryLo;
+	int result;
+
+	if (!as_lock_live(as)) {
+		return EBUSY;
+	}
+
+	/* the reverse map is a hint: check the page is still ours. */
+	oldkvaddr = PADDR_TO_KVADDR(paddr);
+	result = pagetable_lookup(as->pagetable, vaddr, &entryLo);
+	if (result != 0 || (entryLo & TLBLO_VALID) == 0 ||
+	    (entryLo & PAGE_FRAME) != paddr ||
+	    frame_refcount(oldkvaddr) != 1) {
+		rwlock_release_write(as->as_lock);
+		return EBUSY;
+	}
+
+	newkvaddr = alloc_kpages(1);
+	if (newkvaddr == 0) {
+		rwlock_release_write(as->as_lock);
+		return ENOMEM;
+	}
+
+	/*
+	 * Unload the old mapping before copying. Any touch of the page
+	 * from here on faults, and waits for as_lock until the entry
+	 * points at the new frame.
+	 */
+	vm_tlbinvalidate(as, vaddr, 1);
+	memmove((void *)newkvaddr, (const void *)oldkvaddr, PAGE_SIZE);
+	entryLo = (entryLo & ~(paddr_t)PAGE_FRAME) | KVADDR_TO_PADDR(newkvaddr);
+
+	/* the entry exists, so this cannot fail. */
+	result = pagetable_insert(as->pagetable, vaddr, entryLo);
+	KASSERT(result == 0);
+
+	frame_setrmap(newkvaddr, as, vaddr);
+	frame_setrmap(oldkvaddr, NULL, 0);
+	rwlock_release_write(as->as_lock);
+
+	spinlock_acquire(&compact_spinlock);
+	compact_stats.cs_migrated++;
+	spinlock_release(&compact_spinlock);
+
+	return 0;
+}
+
+/*
+ * Make one compaction pass for a run of NPAGES frames. On success the
+ * caller holds every frame of the run, each as a single frame, and
+ * *RET is the physical address of the first.
+ */
+static
+int
+compact_take(unsigned npages, paddr_t *ret)
+{
+	struct bitmap *held;
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	unsigned first, i;
+	int result;
+
+	spinlock_acquire(&compact_spinlock);
+	compact_stats.cs_passes++;
+	spinlock_release(&compact_spinlock);
+
+	if (!compact_findwindow(npages, &first)) {
+		return ENOMEM;
+	}
+
+	held = bitmap_create(npages);
+	if (held == NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Claim the free frames first, so that the new frames for the
+	 * pages being moved cannot come from inside the window.
+	 */
+	for (i = 0; i < npages; i++) {
+		paddr = (paddr_t)(first + i) * PAGE_SIZE;
+		if (frame_info(paddr, &as, &vaddr) == FRAME_FREE &&
+		    frame_claim(paddr) == 0) {
+			bitmap_mark(held, i);
+		}
+	}
+
+	result = 0;
+	for (i = 0; i < npages && result == 0; i++) {
+		if (bitmap_isset(held, i)) {
+			continue;
+		}
+		paddr = (paddr_t)(first + i) * PAGE_SIZE;
+		if (frame_info(paddr, &as, &vaddr) == FRAME_MOVABLE) {
+			result = compact_migrate(paddr, as, vaddr);
+		} else {
+			result = EBUSY;
+		}
+		if (result == 0) {
+			bitmap_mark(held, i);
+		}
+	}
+
+	if (result) {
+		/* give back what we took. */
+		for (i = 0; i < npages; i++) {
+			if (bitmap_isset(held, i)) {
+				paddr = (paddr_t)(first + i) * PAGE_SIZE;
+				free_kpages(PADDR_TO_KVADDR(paddr));
+			}
+		}
+		bitmap_destroy(held);
+		return result;
+	}
+	bitmap_destroy(held);
+
+	spinlock_acquire(&compact_spinlock);
+	compact_stats.cs_runs++;
+	spinlock_release(&compact_spinlock);
+
+	*ret = (paddr_t)first * PAGE_SIZE;
+	return 0;
+}
+
+paddr_t
+compact_alloc(unsigned npages)
+{
+	paddr_t paddr;
+
+	if (!compact_ready) {
+		return 0;
+	}
+
+	if (!compact_cansleep()) {
+		spinlock_acquire(&compact_spinlock);
+		if (npages > compact_want) {
+			compact_want = npages;
+		}
+		compact_stats.cs_deferred++;
+		spinlock_release(&compact_spinlock);
+		V(compact_sem);
+		return 0;
+	}
+
+	if (compact_take(npages, &paddr) != 0) {
+		return 0;
+	}
+	frame_joinrun(paddr, npages);
+	return paddr;
+}
+
+static
+void
+compact_thread(void *unused1, unsigned long unused2)
+{
+	paddr_t paddr;
+	unsigned npages, i;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		P(compact_sem);
+
+		spinlock_acquire(&compact_spinlock);
+		npages = compact_want;
+		compact_want = 0;
+		spinlock_release(&compact_spinlock);
+
+		if (npages == 0 || compact_take(npages, &paddr) != 0) {
+			continue;
+		}
+
+		/* leave the run free for the allocation to be retried. */
+		for (i = 0; i < npages; i++) {
+			free_kpages(PADDR_TO_KVADDR(paddr + i * PAGE_SIZE));
+		}
+	}
+}
+
+void
+compact_bootstrap(void)
+{
+	int result;
+
+	compact_sem = sem_create("compact", 0);
+	if (compact_sem == NULL) {
+		panic("compact_bootstrap: Out of memory\n");
+	}
+
+	result = thread_fork("compact", NULL, compact_thread, NULL, 0);
+	if (result) {
+		panic("compact_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	compact_ready = true;
+}
+
+void
+compact_printstats(void)
+{
+	spinlock_acquire(&compact_spinlock);
+	kprintf("Compaction: %u passes, %u runs freed, %u pages migrated, "
+		"%u deferred to the background\n",
+		compact_stats.cs_passes, compact_stats.cs_runs,
+		compact_stats.cs_migrated, compact_stats.cs_deferred);
+	spinlock_release(&compact_spinlock);
+}
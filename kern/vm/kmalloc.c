@@ -28,9 +28,14 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include "opt-unsw.h"
 
 /*
  * Kernel malloc.
@@ -58,11 +63,13 @@ fill_deadbeef(void *vptr, size_t len)
 //
 // It works like this:
 //
-//    We allocate one page at a time and fill it with objects of size k,
-//    for various k. Each page has its own freelist, maintained by a
-//    linked list in the first word of each object. Each page also has a
-//    freecount, so we know when the page is completely free and can
-//    release it.
+//    We allocate one slab at a time and fill it with objects of size k,
+//    for various k. A slab is usually one page; for the sizes that do
+//    not divide a page evenly it is a few contiguous pages, so that
+//    the tail left over is small. Each slab has its own freelist,
+//    maintained by a linked list in the first word of each object.
+//    Each slab also has a freecount, so we know when the slab is
+//    completely free and can release it.
 //
 //    No assumptions are made about the sizes k; they need not be
 //    powers of two. Note, however, that malloc must always return
@@ -73,6 +80,11 @@ fill_deadbeef(void *vptr, size_t len)
 //    more blocks would fit on a page than with the existing block
 //    sizes, and large numbers of items of the new size are allocated.
 //
+//    Allocations too big for the largest block size but only a few
+//    pages long go to the large-object allocator further down, which
+//    hands out runs of 512-byte grains from multi-page chunks rather
+//    than rounding up to whole pages.
+//
 //    The free counts and addresses of the pages are maintained in
 //    another list.  Maintaining this table is a nuisance, because it
 //    cannot recursively use the subpage allocator. (We could probably
@@ -121,15 +133,40 @@ fill_deadbeef(void *vptr, size_t len)
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+/*
+ * MAGAZINES keeps per-cpu caches of free blocks in front of the
+ * subpage allocator (see below). It needs the unsw frame descriptors
+ * to find a block's size without the lock, and it is left off with
+ * GUARDS and LABELS: blocks parked in a magazine look allocated to
+ * the heap checks and leak dumps, and carry stale guards and labels.
+ */
+#if OPT_UNSW && !defined(GUARDS) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
 
-#define NSIZES 8
-static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define NSIZES 16
+static const size_t sizes[NSIZES] = {
+	16, 24, 32, 48, 64, 96, 128, 192,
+	256, 384, 512, 768, 1024, 1536, 2048, 3072
+};
+
+/*
+ * Pages per slab for each size. 768, 1536, and 3072 waste a quarter
+ * or more of a single page (or, for 768, get only 5 blocks), so they
+ * use three-page slabs, which they divide exactly.
+ */
+static const unsigned slabpages[NSIZES] = {
+	1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 3, 1, 3, 1, 3
+};
 
 #define SMALLEST_SUBPAGE_SIZE 16
-#define LARGEST_SUBPAGE_SIZE 2048
+#define LARGEST_SUBPAGE_SIZE 3072
+#define MAXBLOCKS_PER_SLAB (PAGE_SIZE / SMALLEST_SUBPAGE_SIZE)
 
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
@@ -157,13 +194,19 @@ struct pageref {
 #define PR_BLOCKTYPE(pr) ((pr)->pageaddr_and_blocktype & ~PAGE_FRAME)
 #define MKPAB(pa, blk)   (((pa)&PAGE_FRAME) | ((blk) & ~PAGE_FRAME))
 
+/* Size in bytes, and number of blocks, of a slab of type BLK. */
+#define SLABSIZE(blk)    (slabpages[blk] * PAGE_SIZE)
+#define SLABBLOCKS(blk)  (SLABSIZE(blk) / sizes[blk])
+
+/* Block type in the pageref of a large-object chunk (see below). */
+#define LOBJ_BLOCKTYPE   NSIZES
+
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole thing. The per-cpu magazines (see
+ * MAGAZINES) sit in front of it and take most of the traffic; the
+ * pages and pagerefs themselves are only touched under this lock.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -174,8 +217,8 @@ static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
  * We can only allocate whole pages of pageref structure at a time.
  * This is a struct type for such a page.
  *
- * Each pageref page contains 256 pagerefs, which can manage up to
- * 256 * 4K = 1M of kernel heap.
+ * Each pageref page contains 256 pagerefs, which can manage 256
+ * slabs, or at least 256 * 4K = 1M of kernel heap.
  */
 
 #define NPAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
@@ -347,6 +390,589 @@ static struct pageref *allbase;
 
 ////////////////////////////////////////
 
+/*
+ * Large-object chunks.
+ *
+ * Allocations bigger than LARGEST_SUBPAGE_SIZE but no more than
+ * LOBJ_MAXSIZE are carved out of LOBJ_CHUNKPAGES-page chunks in
+ * units of LOBJ_GRAIN bytes, so that (for instance) 4100 bytes costs
+ * 4608 rather than two whole pages. Like the frame table, each chunk
+ * keeps one bit per grain saying whether it is in use and one saying
+ * whether the next grain belongs to the same object, which is all
+ * kfree needs to find the object's length.
+ *
+ * A chunk's pageref (blocktype LOBJ_BLOCKTYPE) is embedded in its
+ * descriptor so that the unsw frame descriptors can point at it just
+ * as they point at subpage slabs. Chunks are on lobjbase only, not on
+ * sizebases or allbase.
+ */
+
+#define LOBJ_CHUNKPAGES 4
+#define LOBJ_GRAIN 512
+#define LOBJ_NGRAINS (LOBJ_CHUNKPAGES * PAGE_SIZE / LOBJ_GRAIN)
+#define LOBJ_MAXSIZE (3 * PAGE_SIZE)
+
+struct lobjchunk {
+	struct pageref lc_pr;		/* must be first */
+	struct lobjchunk *lc_next;	/* list of all chunks */
+	uint32_t lc_inuse;		/* grains allocated */
+	uint32_t lc_notlast;		/* grains continued by the next */
+};
+
+static struct lobjchunk *lobjbase;
+
+////////////////////////////////////////
+
+/*
+ * Internal fragmentation counters.
+ *
+ * For every allocation, count the bytes asked for and the bytes
+ * actually set aside for it, by size class, plus one bucket for large
+ * objects and one for whole pages. These are totals since boot, not
+ * live figures, which is what is wanted to compare size class tables.
+ * They are kept per cpu, with interrupts off, so that the magazine
+ * fast path doesn't have to take a lock to count.
+ */
+
+#define KSTAT_MAXCPUS  32	/* System/161 supports at most 32 cpus */
+#define KSTAT_LOBJ     NSIZES
+#define KSTAT_PAGES    (NSIZES + 1)
+#define KSTAT_NBUCKETS (NSIZES + 2)
+
+struct kfragstat {
+	unsigned kf_allocs;		/* allocations */
+	uint64_t kf_requested;		/* bytes the callers asked for */
+	uint64_t kf_granted;		/* bytes set aside for them */
+};
+
+static struct kfragstat kfragstats[KSTAT_MAXCPUS][KSTAT_NBUCKETS];
+
+/*
+ * The bytes set aside for an allocation of REQUESTED from BUCKET.
+ */
+static
+size_t
+kfrag_granted(unsigned bucket, size_t requested)
+{
+	if (bucket == KSTAT_LOBJ) {
+		return ROUNDUP(requested, LOBJ_GRAIN);
+	}
+	if (bucket == KSTAT_PAGES) {
+		return ROUNDUP(requested, PAGE_SIZE);
+	}
+	KASSERT(bucket < NSIZES);
+	return sizes[bucket];
+}
+
+/*
+ * Count an allocation of REQUESTED bytes from BUCKET.
+ */
+static
+void
+kfrag_account(unsigned bucket, size_t requested)
+{
+	struct kfragstat *kf;
+	size_t granted;
+	int s;
+
+	KASSERT(bucket < KSTAT_NBUCKETS);
+	granted = kfrag_granted(bucket, requested);
+	KASSERT(requested <= granted);
+
+	s = splhigh();
+	if (CURCPU_EXISTS() && curcpu->c_number < KSTAT_MAXCPUS) {
+		kf = &kfragstats[curcpu->c_number][bucket];
+		kf->kf_allocs++;
+		kf->kf_requested += requested;
+		kf->kf_granted += granted;
+	}
+	splx(s);
+}
+
+/*
+ * Print the name of a bucket, for lining up in a table.
+ */
+static
+void
+kfrag_printbucket(unsigned bucket)
+{
+	if (bucket == KSTAT_LOBJ) {
+		kprintf("large  ");
+	}
+	else if (bucket == KSTAT_PAGES) {
+		kprintf("pages  ");
+	}
+	else {
+		kprintf("%-5lu  ", (unsigned long) sizes[bucket]);
+	}
+}
+
+/*
+ * Print the fragmentation counters, summed over all cpus.
+ */
+static
+void
+kfrag_printstats(void)
+{
+	struct kfragstat sum, total;
+	unsigned cpu, i;
+
+	total.kf_allocs = 0;
+	total.kf_requested = total.kf_granted = 0;
+	kprintf("Internal fragmentation since boot:\n");
+	for (i=0; i<KSTAT_NBUCKETS; i++) {
+		sum.kf_allocs = 0;
+		sum.kf_requested = sum.kf_granted = 0;
+		for (cpu=0; cpu<KSTAT_MAXCPUS; cpu++) {
+			sum.kf_allocs += kfragstats[cpu][i].kf_allocs;
+			sum.kf_requested += kfragstats[cpu][i].kf_requested;
+			sum.kf_granted += kfragstats[cpu][i].kf_granted;
+		}
+		if (sum.kf_allocs == 0) {
+			continue;
+		}
+		kfrag_printbucket(i);
+		kprintf("%8u allocs  %10llu requested  %10llu used  "
+			"%3llu%% wasted\n", sum.kf_allocs,
+			sum.kf_requested, sum.kf_granted,
+			100 * (sum.kf_granted - sum.kf_requested) /
+			sum.kf_granted);
+		total.kf_allocs += sum.kf_allocs;
+		total.kf_requested += sum.kf_requested;
+		total.kf_granted += sum.kf_granted;
+	}
+	if (total.kf_granted > 0) {
+		kprintf("total  %8u allocs  %10llu requested  %10llu used  "
+			"%3llu%% wasted\n", total.kf_allocs,
+			total.kf_requested, total.kf_granted,
+			100 * (total.kf_granted - total.kf_requested) /
+			total.kf_granted);
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Allocation-site tracking.
+ *
+ * Unlike LABELS, this can be turned on and off at runtime (khtrack).
+ * While it is on, every kmalloc is recorded in a hash table keyed by
+ * the address returned, with the call site, the size asked for, and
+ * the bucket it came from; kfree removes the record. Each call site
+ * keeps its live blocks and bytes, and the live bytes it had at the
+ * last kheap_nextgeneration, so khtop can show both who holds the
+ * most memory and who has grown since. Blocks allocated while
+ * tracking was off, or when the tables were full, are not seen.
+ *
+ * The tables are allocated when tracking is turned on and given back
+ * when it is turned off, so a kernel that never uses this pays only
+ * for the ktrack_on test in kmalloc and kfree. The tables come from
+ * alloc_kpages rather than kmalloc, so recording never recurses.
+ */
+
+#define KTRACK_NRECPAGES 8
+#define KTRACK_NHASH     256
+
+struct ktrackrec {
+	struct ktrackrec *kr_next;	/* hash chain or free list */
+	vaddr_t kr_addr;		/* block handed out */
+	uint32_t kr_size;		/* bytes asked for */
+	uint16_t kr_site;		/* index into ktrack_sites */
+	uint16_t kr_bucket;		/* size class, or KSTAT_LOBJ/PAGES */
+};
+
+struct ktracksite {
+	vaddr_t ks_site;		/* return address of kmalloc */
+	unsigned ks_allocs;		/* allocations while tracking */
+	unsigned ks_blocks;		/* live blocks */
+	size_t ks_bytes;		/* live bytes asked for */
+	size_t ks_genbytes;		/* ks_bytes at the last generation */
+};
+
+#define KTRACK_RECSPERPAGE (PAGE_SIZE / sizeof(struct ktrackrec))
+#define KTRACK_NSITES      (PAGE_SIZE / sizeof(struct ktracksite))
+
+/* ktrack_spinlock protects everything below. */
+static struct spinlock ktrack_spinlock = SPINLOCK_INITIALIZER;
+static volatile bool ktrack_on;		/* checked without the lock */
+static vaddr_t ktrack_recpages[KTRACK_NRECPAGES];
+static struct ktracksite *ktrack_sites;
+static struct ktrackrec *ktrack_hash[KTRACK_NHASH];
+static struct ktrackrec *ktrack_freerecs;
+static unsigned ktrack_generation;	/* generations since turned on */
+static unsigned ktrack_dropped;		/* allocations not recorded */
+static size_t ktrack_classreq[KSTAT_NBUCKETS];	/* live bytes asked for */
+static size_t ktrack_classgot[KSTAT_NBUCKETS];	/* live bytes set aside */
+static unsigned ktrack_classblocks[KSTAT_NBUCKETS];
+
+static
+unsigned
+ktrack_hashaddr(vaddr_t addr)
+{
+	return ((addr >> 4) ^ (addr >> 12)) % KTRACK_NHASH;
+}
+
+/*
+ * Find the site table entry for SITE, making one if need be. Returns
+ * -1 if the table is full. The table is open-addressed.
+ */
+static
+int
+ktrack_findsite(vaddr_t site)
+{
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&ktrack_spinlock));
+
+	i = (site >> 2) % KTRACK_NSITES;
+	for (n=0; n<KTRACK_NSITES; n++) {
+		if (ktrack_sites[i].ks_site == site) {
+			return i;
+		}
+		if (ktrack_sites[i].ks_site == 0) {
+			ktrack_sites[i].ks_site = site;
+			return i;
+		}
+		i = (i + 1) % KTRACK_NSITES;
+	}
+	return -1;
+}
+
+/*
+ * Record that SITE got ADDR, SIZE bytes, from BUCKET.
+ */
+static
+void
+ktrack_alloc(vaddr_t addr, vaddr_t site, unsigned bucket, size_t size)
+{
+	struct ktrackrec *kr;
+	unsigned h;
+	int si;
+
+	spinlock_acquire(&ktrack_spinlock);
+	if (!ktrack_on) {
+		spinlock_release(&ktrack_spinlock);
+		return;
+	}
+	si = ktrack_findsite(site);
+	if (si < 0 || ktrack_freerecs == NULL) {
+		ktrack_dropped++;
+		spinlock_release(&ktrack_spinlock);
+		return;
+	}
+	kr = ktrack_freerecs;
+	ktrack_freerecs = kr->kr_next;
+
+	kr->kr_addr = addr;
+	kr->kr_size = size;
+	kr->kr_site = si;
+	kr->kr_bucket = bucket;
+	h = ktrack_hashaddr(addr);
+	kr->kr_next = ktrack_hash[h];
+	ktrack_hash[h] = kr;
+
+	ktrack_sites[si].ks_allocs++;
+	ktrack_sites[si].ks_blocks++;
+	ktrack_sites[si].ks_bytes += size;
+	ktrack_classreq[bucket] += size;
+	ktrack_classgot[bucket] += kfrag_granted(bucket, size);
+	ktrack_classblocks[bucket]++;
+	spinlock_release(&ktrack_spinlock);
+}
+
+/*
+ * Forget the record for ADDR, if there is one. Must be called before
+ * the block is actually freed, lest it be handed out and recorded
+ * again first.
+ */
+static
+void
+ktrack_free(vaddr_t addr)
+{
+	struct ktrackrec *kr, **prev;
+	struct ktracksite *ks;
+
+	spinlock_acquire(&ktrack_spinlock);
+	if (!ktrack_on) {
+		spinlock_release(&ktrack_spinlock);
+		return;
+	}
+	for (prev = &ktrack_hash[ktrack_hashaddr(addr)]; *prev != NULL;
+	     prev = &(*prev)->kr_next) {
+		kr = *prev;
+		if (kr->kr_addr != addr) {
+			continue;
+		}
+		*prev = kr->kr_next;
+
+		ks = &ktrack_sites[kr->kr_site];
+		KASSERT(ks->ks_blocks > 0 && ks->ks_bytes >= kr->kr_size);
+		ks->ks_blocks--;
+		ks->ks_bytes -= kr->kr_size;
+		ktrack_classreq[kr->kr_bucket] -= kr->kr_size;
+		ktrack_classgot[kr->kr_bucket] -=
+			kfrag_granted(kr->kr_bucket, kr->kr_size);
+		ktrack_classblocks[kr->kr_bucket]--;
+
+		kr->kr_next = ktrack_freerecs;
+		ktrack_freerecs = kr;
+		break;
+	}
+	spinlock_release(&ktrack_spinlock);
+}
+
+/*
+ * Turn tracking on or off. Turning it on starts from nothing: blocks
+ * already allocated are not counted.
+ */
+int
+kheap_track(bool on)
+{
+	vaddr_t recpages[KTRACK_NRECPAGES];
+	vaddr_t sitepage;
+	struct ktrackrec *kr;
+	unsigned i, j;
+
+	if (on) {
+		/* Get the tables without the spinlock; see above. */
+		sitepage = alloc_kpages(1);
+		for (i=0; i<KTRACK_NRECPAGES; i++) {
+			recpages[i] = sitepage ? alloc_kpages(1) : 0;
+			if (recpages[i] == 0) {
+				break;
+			}
+		}
+		if (i < KTRACK_NRECPAGES) {
+			while (i > 0) {
+				free_kpages(recpages[--i]);
+			}
+			if (sitepage != 0) {
+				free_kpages(sitepage);
+			}
+			return ENOMEM;
+		}
+		bzero((void *)sitepage, PAGE_SIZE);
+
+		spinlock_acquire(&ktrack_spinlock);
+		if (ktrack_on) {
+			/* Already on; give the new tables back. */
+			spinlock_release(&ktrack_spinlock);
+			for (i=0; i<KTRACK_NRECPAGES; i++) {
+				free_kpages(recpages[i]);
+			}
+			free_kpages(sitepage);
+			return 0;
+		}
+		ktrack_freerecs = NULL;
+		for (i=0; i<KTRACK_NRECPAGES; i++) {
+			ktrack_recpages[i] = recpages[i];
+			kr = (struct ktrackrec *)recpages[i];
+			for (j=0; j<KTRACK_RECSPERPAGE; j++) {
+				kr[j].kr_next = ktrack_freerecs;
+				ktrack_freerecs = &kr[j];
+			}
+		}
+		ktrack_sites = (struct ktracksite *)sitepage;
+		for (i=0; i<KTRACK_NHASH; i++) {
+			ktrack_hash[i] = NULL;
+		}
+		for (i=0; i<KSTAT_NBUCKETS; i++) {
+			ktrack_classreq[i] = 0;
+			ktrack_classgot[i] = 0;
+			ktrack_classblocks[i] = 0;
+		}
+		ktrack_generation = 0;
+		ktrack_dropped = 0;
+		ktrack_on = true;
+		spinlock_release(&ktrack_spinlock);
+		return 0;
+	}
+
+	spinlock_acquire(&ktrack_spinlock);
+	if (!ktrack_on) {
+		spinlock_release(&ktrack_spinlock);
+		return 0;
+	}
+	ktrack_on = false;
+	for (i=0; i<KTRACK_NRECPAGES; i++) {
+		recpages[i] = ktrack_recpages[i];
+		ktrack_recpages[i] = 0;
+	}
+	sitepage = (vaddr_t)ktrack_sites;
+	ktrack_sites = NULL;
+	ktrack_freerecs = NULL;
+	spinlock_release(&ktrack_spinlock);
+
+	for (i=0; i<KTRACK_NRECPAGES; i++) {
+		free_kpages(recpages[i]);
+	}
+	free_kpages(sitepage);
+	return 0;
+}
+
+/*
+ * Start a new tracking generation: remember each site's live bytes,
+ * so that the next report shows the growth since now.
+ */
+static
+void
+ktrack_nextgeneration(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&ktrack_spinlock);
+	if (ktrack_on) {
+		for (i=0; i<KTRACK_NSITES; i++) {
+			ktrack_sites[i].ks_genbytes = ktrack_sites[i].ks_bytes;
+		}
+		ktrack_generation++;
+	}
+	spinlock_release(&ktrack_spinlock);
+}
+
+/*
+ * Print the N call sites holding the most live memory, and the live
+ * fragmentation of each size class.
+ */
+void
+kheap_printtop(unsigned n)
+{
+	uint16_t order[KTRACK_NSITES];
+	struct ktracksite *ks;
+	unsigned nsites, i, j, best;
+	uint16_t tmp;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&ktrack_spinlock);
+	if (!ktrack_on) {
+		spinlock_release(&ktrack_spinlock);
+		kprintf("Heap tracking is off; turn it on with khtrack on\n");
+		return;
+	}
+
+	nsites = 0;
+	for (i=0; i<KTRACK_NSITES; i++) {
+		if (ktrack_sites[i].ks_site != 0) {
+			order[nsites++] = i;
+		}
+	}
+	if (n > nsites) {
+		n = nsites;
+	}
+
+	/* Selection sort for the top N by live bytes. */
+	for (i=0; i<n; i++) {
+		best = i;
+		for (j=i+1; j<nsites; j++) {
+			if (ktrack_sites[order[j]].ks_bytes >
+			    ktrack_sites[order[best]].ks_bytes) {
+				best = j;
+			}
+		}
+		tmp = order[i];
+		order[i] = order[best];
+		order[best] = tmp;
+	}
+
+	kprintf("Top %u of %u call sites, generation %u, "
+		"%u allocations not tracked:\n",
+		n, nsites, ktrack_generation, ktrack_dropped);
+	kprintf("  site        live bytes  blocks  since gen  allocs\n");
+	for (i=0; i<n; i++) {
+		ks = &ktrack_sites[order[i]];
+		kprintf("  0x%08lx  %10lu  %6u  %9ld  %6u\n",
+			(unsigned long)ks->ks_site,
+			(unsigned long)ks->ks_bytes, ks->ks_blocks,
+			(long)ks->ks_bytes - (long)ks->ks_genbytes,
+			ks->ks_allocs);
+	}
+
+	kprintf("Live fragmentation of tracked blocks:\n");
+	for (i=0; i<KSTAT_NBUCKETS; i++) {
+		if (ktrack_classblocks[i] == 0) {
+			continue;
+		}
+		kfrag_printbucket(i);
+		kprintf("%8u blocks  %10lu requested  %10lu used  "
+			"%3lu%% wasted\n", ktrack_classblocks[i],
+			(unsigned long)ktrack_classreq[i],
+			(unsigned long)ktrack_classgot[i],
+			(unsigned long)(100 *
+			  (uint64_t)(ktrack_classgot[i] - ktrack_classreq[i]) /
+			  ktrack_classgot[i]));
+	}
+	spinlock_release(&ktrack_spinlock);
+}
+
+////////////////////////////////////////
+
+#ifdef MAGAZINES
+
+/*
+ * Per-cpu magazines.
+ *
+ * Each cpu keeps a small stack of free blocks of each size so that
+ * most kmalloc and kfree calls never touch kmalloc_spinlock. An empty
+ * magazine is refilled, and a full one drained, half a magazine at a
+ * time under the lock. Blocks parked in a magazine still count as
+ * allocated on their slab, so a magazine is capped at one slab's worth
+ * of blocks to bound how much memory it can pin.
+ *
+ * A magazine is only touched by its own cpu with interrupts off,
+ * which keeps the thread from migrating and keeps interrupt handlers
+ * that call kmalloc out.
+ */
+
+#define KMAG_MAXBLOCKS 16	/* most blocks held per magazine */
+#define KMAG_MAXCPUS   32	/* System/161 supports at most 32 cpus */
+
+struct kmagazine {
+	unsigned km_count;			/* blocks in km_blocks[] */
+	void *km_blocks[KMAG_MAXBLOCKS];	/* stack of free blocks */
+	unsigned km_allochits;			/* kmalloc from magazine */
+	unsigned km_allocmisses;		/* kmalloc that refilled */
+	unsigned km_freehits;			/* kfree into magazine */
+	unsigned km_freemisses;			/* kfree that drained */
+};
+
+static struct kmagazine kmagazines[KMAG_MAXCPUS][NSIZES];
+
+/*
+ * Print the magazine counters.
+ */
+static
+void
+kmag_printstats(void)
+{
+	struct kmagazine *km;
+	unsigned cpu, i;
+	unsigned hits, misses;
+
+	hits = misses = 0;
+	kprintf("Magazines:\n");
+	for (cpu=0; cpu<KMAG_MAXCPUS; cpu++) {
+		for (i=0; i<NSIZES; i++) {
+			km = &kmagazines[cpu][i];
+			if (km->km_allochits + km->km_allocmisses +
+			    km->km_freehits + km->km_freemisses == 0) {
+				continue;
+			}
+			kprintf("cpu%-2u size %-4lu %2u held  "
+				"alloc %u hit %u miss  free %u hit %u miss\n",
+				cpu, (unsigned long) sizes[i], km->km_count,
+				km->km_allochits, km->km_allocmisses,
+				km->km_freehits, km->km_freemisses);
+			hits += km->km_allochits + km->km_freehits;
+			misses += km->km_allocmisses + km->km_freemisses;
+		}
+	}
+	kprintf("%u hits, %u misses\n", hits, misses);
+}
+
+#endif /* MAGAZINES */
+
+////////////////////////////////////////
+
 #ifdef GUARDS
 
 /* Space returned to the client is filled with GUARD_RETBYTE */
@@ -500,8 +1126,7 @@ checksubpage(struct pageref *pr)
 	int nfree=0;
 	size_t blocksize;
 #ifdef CHECKGUARDS
-	const unsigned maxblocks = PAGE_SIZE / SMALLEST_SUBPAGE_SIZE;
-	const unsigned numfreewords = DIVROUNDUP(maxblocks, 32);
+	const unsigned numfreewords = DIVROUNDUP(MAXBLOCKS_PER_SLAB, 32);
 	uint32_t isfree[numfreewords], mask;
 	unsigned numblocks, blocknum, i;
 	size_t smallerblocksize;
@@ -531,7 +1156,7 @@ checksubpage(struct pageref *pr)
 	KASSERT(prpage < MIPS_KSEG1);
 #endif
 
-	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	KASSERT(pr->freelist_offset < SLABSIZE(blktype));
 	KASSERT(pr->freelist_offset % blocksize == 0);
 
 	fla = prpage + pr->freelist_offset;
@@ -539,7 +1164,7 @@ checksubpage(struct pageref *pr)
 
 	for (; fl != NULL; fl = fl->next) {
 		fla = (vaddr_t)fl;
-		KASSERT(fla >= prpage && fla < prpage + PAGE_SIZE);
+		KASSERT(fla >= prpage && fla < prpage + SLABSIZE(blktype));
 		KASSERT((fla-prpage) % blocksize == 0);
 #ifdef CHECKBEEF
 		checkdeadbeef(fl, blocksize);
@@ -556,7 +1181,8 @@ checksubpage(struct pageref *pr)
 	KASSERT(nfree==pr->nfree);
 
 #ifdef CHECKGUARDS
-	numblocks = PAGE_SIZE / blocksize;
+	numblocks = SLABBLOCKS(blktype);
+	KASSERT(numblocks <= MAXBLOCKS_PER_SLAB);
 	for (i=0; i<numblocks; i++) {
 		mask = 1U << (i % 32);
 		if ((isfree[i / 32] & mask) == 0) {
@@ -640,7 +1266,7 @@ void
 dump_subpage(struct pageref *pr, unsigned generation)
 {
 	unsigned blocksize = sizes[PR_BLOCKTYPE(pr)];
-	unsigned numblocks = PAGE_SIZE / blocksize;
+	unsigned numblocks = SLABBLOCKS(PR_BLOCKTYPE(pr));
 	unsigned numfreewords = DIVROUNDUP(numblocks, 32);
 	uint32_t isfree[numfreewords], mask;
 	vaddr_t prpage;
@@ -705,6 +1331,7 @@ kheap_nextgeneration(void)
 	mallocgeneration++;
 	spinlock_release(&kmalloc_spinlock);
 #endif
+	ktrack_nextgeneration();
 }
 
 void
@@ -740,7 +1367,7 @@ kheap_dumpall(void)
 ////////////////////////////////////////
 
 /*
- * Print the allocated/freed map of a single kernel heap page.
+ * Print the allocated/freed map of a single kernel heap slab.
  */
 static
 void
@@ -750,7 +1377,7 @@ subpage_stats(struct pageref *pr)
 	struct freelist *fl;
 	int blktype;
 	unsigned i, n, index;
-	uint32_t freemap[PAGE_SIZE / (SMALLEST_SUBPAGE_SIZE*32)];
+	uint32_t freemap[MAXBLOCKS_PER_SLAB / 32];
 
 	checksubpage(pr);
 	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
@@ -765,7 +1392,7 @@ subpage_stats(struct pageref *pr)
 	KASSERT(blktype >= 0 && blktype < NSIZES);
 
 	/* compute how many bits we need in freemap and assert we fit */
-	n = PAGE_SIZE / sizes[blktype];
+	n = SLABBLOCKS(blktype);
 	KASSERT(n <= 32 * ARRAYCOUNT(freemap));
 
 	if (pr->freelist_offset != INVALID_OFFSET) {
@@ -794,6 +1421,41 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+/*
+ * Print the grain map of a large-object chunk.
+ */
+static
+void
+lobj_stats(struct lobjchunk *lc)
+{
+	unsigned i, nfree;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	nfree = 0;
+	for (i=0; i<LOBJ_NGRAINS; i++) {
+		if ((lc->lc_inuse & ((uint32_t)1 << i)) == 0) {
+			nfree++;
+		}
+	}
+
+	kprintf("at 0x%08lx: large  %u/%u grains free\n",
+		(unsigned long)PR_PAGEADDR(&lc->lc_pr), nfree, LOBJ_NGRAINS);
+	kprintf("   ");
+	for (i=0; i<LOBJ_NGRAINS; i++) {
+		if ((lc->lc_inuse & ((uint32_t)1 << i)) == 0) {
+			kprintf(".");
+		}
+		else if (lc->lc_notlast & ((uint32_t)1 << i)) {
+			kprintf("=");
+		}
+		else {
+			kprintf("*");
+		}
+	}
+	kprintf("\n");
+}
+
 /*
  * Print the whole heap.
  */
@@ -801,6 +1463,7 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	struct lobjchunk *lc;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -811,7 +1474,18 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+	kprintf("Large-object allocator status:\n");
+
+	for (lc = lobjbase; lc != NULL; lc = lc->lc_next) {
+		lobj_stats(lc);
+	}
+
 	spinlock_release(&kmalloc_spinlock);
+
+#ifdef MAGAZINES
+	kmag_printstats();
+#endif
+	kfrag_printstats();
 }
 
 ////////////////////////////////////////
@@ -867,29 +1541,310 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take one block off the freelist of PR, which must have one.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_take(struct pageref *pr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
+	struct freelist *fl;	// free list entry
 	void *retptr;		// our result
 
-	volatile int i;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < SLABSIZE(PR_BLOCKTYPE(pr)));
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < SLABSIZE(PR_BLOCKTYPE(pr)));
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return retptr;
+}
+
+/*
+ * Put the block at OFFSET back on PR's freelist. If that leaves the
+ * whole slab free, unhook the slab and return its address, which the
+ * caller hands to free_kpages after dropping kmalloc_spinlock.
+ * Otherwise return 0.
+ */
+static
+vaddr_t
+subpage_release(struct pageref *pr, vaddr_t offset)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(offset < SLABSIZE(blktype) && offset % sizes[blktype] == 0);
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fla = prpage + offset;
+	fl = (struct freelist *)fla;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= SLABBLOCKS(blktype));
+	if (pr->nfree < SLABBLOCKS(blktype)) {
+		return 0;
+	}
+
+	/* Whole slab is free. */
+	remove_lists(pr, blktype);
+	freepageref(pr);
+#if OPT_UNSW
+	for (fla = prpage; fla < prpage + SLABSIZE(blktype); fla += PAGE_SIZE) {
+		frame_setowner(fla, NULL);
+	}
+#endif
+	return prpage;
+}
+
+#ifdef MAGAZINES
+
+/*
+ * Capacity of a magazine for blocks of type BLKTYPE.
+ */
+static
+unsigned
+kmag_limit(unsigned blktype)
+{
+	unsigned n;
+
+	n = SLABBLOCKS(blktype);
+	return n < KMAG_MAXBLOCKS ? n : KMAG_MAXBLOCKS;
+}
+
+/*
+ * Return the current cpu's magazine for BLKTYPE, or NULL if there
+ * isn't one yet (early in boot, before curcpu is set up).
+ */
+static
+struct kmagazine *
+kmag_mine(unsigned blktype)
+{
+	if (!CURCPU_EXISTS() || curcpu->c_number >= KMAG_MAXCPUS) {
+		return NULL;
+	}
+	return &kmagazines[curcpu->c_number][blktype];
+}
+
+/*
+ * Move up to half a magazine of free blocks from the heap pages into
+ * KM. Only pages already on hand are used; if there are none the
+ * caller falls back to subpage_kmalloc's slow path, which gets a new
+ * page.
+ */
+static
+void
+kmag_refill(struct kmagazine *km, unsigned blktype)
+{
+	struct pageref *pr;
+	unsigned batch;
+
+	batch = kmag_limit(blktype) / 2;
+	if (batch == 0) {
+		batch = 1;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	for (pr = sizebases[blktype];
+	     pr != NULL && km->km_count < batch;
+	     pr = pr->next_samesize) {
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+		while (pr->nfree > 0 && km->km_count < batch) {
+			km->km_blocks[km->km_count++] = subpage_take(pr);
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Return the oldest half of a full magazine to the heap pages, and
+ * release any pages that become entirely free.
+ */
+static
+void
+kmag_drain(struct kmagazine *km, unsigned blktype)
+{
+	vaddr_t freepages[KMAG_MAXBLOCKS];
+	unsigned nfreepages, batch, i;
+	struct pageref *pr;
+	vaddr_t block;
+
+	batch = kmag_limit(blktype) / 2;
+	if (batch == 0) {
+		batch = 1;
+	}
+	KASSERT(batch <= km->km_count);
+	nfreepages = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<batch; i++) {
+		block = (vaddr_t)km->km_blocks[i];
+		pr = frame_getowner(block & PAGE_FRAME);
+		KASSERT(pr != NULL);
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+		block = subpage_release(pr, block - PR_PAGEADDR(pr));
+		if (block != 0) {
+			freepages[nfreepages++] = block;
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	/* slide the newer (cache-warm) blocks down */
+	for (i=batch; i<km->km_count; i++) {
+		km->km_blocks[i - batch] = km->km_blocks[i];
+	}
+	km->km_count -= batch;
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+/*
+ * Get a block of type BLKTYPE from this cpu's magazine, refilling it
+ * if it is empty. Returns NULL if nothing could be had without
+ * allocating a new page.
+ */
+static
+void *
+kmag_get(unsigned blktype)
+{
+	struct kmagazine *km;
+	void *ret;
+	int s;
+
+	ret = NULL;
+	s = splhigh();
+	km = kmag_mine(blktype);
+	if (km != NULL) {
+		if (km->km_count > 0) {
+			km->km_allochits++;
+		}
+		else {
+			km->km_allocmisses++;
+			kmag_refill(km, blktype);
+		}
+		if (km->km_count > 0) {
+			ret = km->km_blocks[--km->km_count];
+		}
+	}
+	splx(s);
+	return ret;
+}
+
+/*
+ * Park a freed block of type BLKTYPE in this cpu's magazine, draining
+ * it first if it is full. Returns false if there is no magazine to
+ * use.
+ */
+static
+bool
+kmag_put(unsigned blktype, vaddr_t block)
+{
+	struct kmagazine *km;
+	unsigned i;
+	int s;
+
+	s = splhigh();
+	km = kmag_mine(blktype);
+	if (km == NULL) {
+		splx(s);
+		return false;
+	}
+	/* this block should not already be in the magazine! */
+	for (i=0; i<km->km_count; i++) {
+		KASSERT(km->km_blocks[i] != (void *)block);
+	}
+	if (km->km_count < kmag_limit(blktype)) {
+		km->km_freehits++;
+	}
+	else {
+		km->km_freemisses++;
+		kmag_drain(km, blktype);
+	}
+	km->km_blocks[km->km_count++] = (void *)block;
+	splx(s);
+	return true;
+}
+
+#endif /* MAGAZINES */
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	struct pageref *pr;	// pageref for page we're allocating from
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+	void *retptr;		// our result
+
+	volatile int i;
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
 
 #ifdef GUARDS
 	clientsz = sz;
@@ -907,6 +1862,13 @@ subpage_kmalloc(size_t sz
 	sz = sizes[blktype];
 #endif
 
+#ifdef MAGAZINES
+	retptr = kmag_get(blktype);
+	if (retptr != NULL) {
+		return retptr;
+	}
+#endif
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
@@ -921,25 +1883,7 @@ subpage_kmalloc(size_t sz
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_take(pr);
 #ifdef GUARDS
 			retptr = establishguardband(retptr, clientsz, sz);
 #endif
@@ -955,7 +1899,7 @@ subpage_kmalloc(size_t sz
 	}
 
 	/*
-	 * No page of the right size available.
+	 * No slab of the right size available.
 	 * Make a new one.
 	 *
 	 * We release the spinlock while calling alloc_kpages. This
@@ -964,22 +1908,28 @@ subpage_kmalloc(size_t sz
 	 */
 
 	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
+	prpage = alloc_kpages(slabpages[blktype]);
 	if (prpage==0) {
-		/* Out of memory. */
-		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		/*
+		 * Out of memory. A multi-page slab failing is expected
+		 * under fragmentation, and kmalloc falls back to a
+		 * single page, so only complain about a page.
+		 */
+		if (slabpages[blktype] == 1) {
+			kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		}
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
 #ifdef CHECKBEEF
-	/* deadbeef the whole page, as it probably starts zeroed */
-	fill_deadbeef((void *)prpage, PAGE_SIZE);
+	/* deadbeef the whole slab, as it probably starts zeroed */
+	fill_deadbeef((void *)prpage, SLABSIZE(blktype));
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
 	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
+		/* Couldn't allocate accounting space for the new slab. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
@@ -987,7 +1937,12 @@ subpage_kmalloc(size_t sz
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	pr->nfree = SLABBLOCKS(blktype);
+#if OPT_UNSW
+	for (fla = prpage; fla < prpage + SLABSIZE(blktype); fla += PAGE_SIZE) {
+		frame_setowner(fla, pr);
+	}
+#endif
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -1029,9 +1984,8 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	vaddr_t freepage;	// page left entirely free, if any
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
@@ -1061,6 +2015,25 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
+#if OPT_UNSW
+	/*
+	 * The frame's descriptor points straight at its pageref; pages
+	 * that came from alloc_kpages directly have none, and large
+	 * object chunks have one of their own. It cannot change while
+	 * the block is allocated, so no lock is needed.
+	 */
+	pr = frame_getowner(ptraddr & PAGE_FRAME);
+	if (pr == NULL || PR_BLOCKTYPE(pr) == LOBJ_BLOCKTYPE) {
+		/* Not on any of our slabs - not a subpage allocation */
+		return -1;
+	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(ptraddr >= prpage && ptraddr < prpage + SLABSIZE(blktype));
+#else
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
@@ -1078,21 +2051,23 @@ subpage_kfree(void *ptr)
 		KASSERT(blktype>=0 && blktype<NSIZES);
 		checksubpage(pr);
 
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+		if (ptraddr >= prpage && ptraddr < prpage + SLABSIZE(blktype)) {
 			break;
 		}
 	}
 
+	spinlock_release(&kmalloc_spinlock);
+
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
+#endif
 
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	if (offset >= SLABSIZE(blktype) || offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -1108,54 +2083,259 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
+#ifdef MAGAZINES
+	if (kmag_put(blktype, ptraddr)) {
+		return 0;
+	}
+#endif
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpage(pr);
+	freepage = subpage_release(pr, offset);
+	spinlock_release(&kmalloc_spinlock);
 
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
+	if (freepage != 0) {
+		/* Call free_kpages without kmalloc_spinlock. */
+		free_kpages(freepage);
+	}
 
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
+
+	return 0;
+}
+
+////////////////////////////////////////
+
+/*
+ * Find a chunk with NGRAINS free grains in a row. Returns the chunk
+ * and sets *FIRST to the index of the first grain, or returns NULL.
+ */
+static
+struct lobjchunk *
+lobj_fit(unsigned ngrains, unsigned *first)
+{
+	struct lobjchunk *lc;
+	uint32_t mask;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(ngrains > 0 && ngrains < 32);
+
+	mask = ((uint32_t)1 << ngrains) - 1;
+	for (lc = lobjbase; lc != NULL; lc = lc->lc_next) {
+		for (i=0; i + ngrains <= LOBJ_NGRAINS; i++) {
+			if ((lc->lc_inuse & (mask << i)) == 0) {
+				*first = i;
+				return lc;
 			}
 		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
+	}
+	return NULL;
+}
+
+/*
+ * Make a new, empty, large-object chunk. Called without the spinlock.
+ */
+static
+struct lobjchunk *
+lobj_newchunk(void)
+{
+	struct lobjchunk *lc;
+	vaddr_t base;
+
+	lc = kmalloc(sizeof(*lc));
+	if (lc == NULL) {
+		return NULL;
+	}
+	base = alloc_kpages(LOBJ_CHUNKPAGES);
+	if (base == 0) {
+		kfree(lc);
+		return NULL;
+	}
+	KASSERT(base % PAGE_SIZE == 0);
+
+	lc->lc_pr.pageaddr_and_blocktype = MKPAB(base, LOBJ_BLOCKTYPE);
+	lc->lc_next = NULL;
+	lc->lc_inuse = 0;
+	lc->lc_notlast = 0;
+#if OPT_UNSW
+	{
+		vaddr_t va;
+
+		for (va = base; va < base + LOBJ_CHUNKPAGES * PAGE_SIZE;
+		     va += PAGE_SIZE) {
+			frame_setowner(va, &lc->lc_pr);
+		}
+	}
 #endif
+	return lc;
+}
+
+/*
+ * Release an empty chunk that is on no list. Called without the
+ * spinlock.
+ */
+static
+void
+lobj_destroychunk(struct lobjchunk *lc)
+{
+	vaddr_t base;
+
+	KASSERT(lc->lc_inuse == 0);
+
+	base = PR_PAGEADDR(&lc->lc_pr);
+#if OPT_UNSW
+	{
+		vaddr_t va;
+
+		for (va = base; va < base + LOBJ_CHUNKPAGES * PAGE_SIZE;
+		     va += PAGE_SIZE) {
+			frame_setowner(va, NULL);
+		}
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
+#endif
+	free_kpages(base);
+	kfree(lc);
+}
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
+/*
+ * Allocate SZ bytes from a large-object chunk, making a new chunk if
+ * none has room. Returns 0 if no chunk could be had, in which case
+ * the caller falls back to whole pages.
+ */
+static
+vaddr_t
+lobj_kmalloc(size_t sz)
+{
+	struct lobjchunk *lc, *newlc;
+	unsigned ngrains, first;
+	uint32_t mask;
+	vaddr_t va;
+
+	KASSERT(sz > 0 && sz <= LOBJ_MAXSIZE);
+	ngrains = DIVROUNDUP(sz, LOBJ_GRAIN);
+	mask = ((uint32_t)1 << ngrains) - 1;
+	newlc = NULL;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	lc = lobj_fit(ngrains, &first);
+	if (lc == NULL) {
+		/*
+		 * No room. Make a new chunk without the spinlock, as
+		 * subpage_kmalloc does; things may change behind our
+		 * back, so look again afterwards.
+		 */
 		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+		newlc = lobj_newchunk();
+		if (newlc == NULL) {
+			return 0;
+		}
+		spinlock_acquire(&kmalloc_spinlock);
+		lc = lobj_fit(ngrains, &first);
+		if (lc == NULL) {
+			lc = newlc;
+			newlc = NULL;
+			lc->lc_next = lobjbase;
+			lobjbase = lc;
+			first = 0;
+		}
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+
+	lc->lc_inuse |= mask << first;
+	lc->lc_notlast |= (mask >> 1) << first;
+	va = PR_PAGEADDR(&lc->lc_pr) + first * LOBJ_GRAIN;
+	spinlock_release(&kmalloc_spinlock);
+
+	if (newlc != NULL) {
+		/* Didn't need it after all. */
+		lobj_destroychunk(newlc);
 	}
+	return va;
+}
+
+/*
+ * Free a pointer previously returned from lobj_kmalloc. If the
+ * pointer is not in any chunk we recognize, return -1.
+ */
+static
+int
+lobj_kfree(void *ptr)
+{
+	struct lobjchunk *lc, **prev;
+	vaddr_t ptraddr, base;
+	unsigned first, i;
+	uint32_t bit;
+
+	ptraddr = (vaddr_t)ptr;
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
+#if OPT_UNSW
+	lc = frame_getowner(ptraddr & PAGE_FRAME);
+	if (lc != NULL && PR_BLOCKTYPE(&lc->lc_pr) != LOBJ_BLOCKTYPE) {
+		lc = NULL;
+	}
+#else
+	for (lc = lobjbase; lc != NULL; lc = lc->lc_next) {
+		base = PR_PAGEADDR(&lc->lc_pr);
+		if (ptraddr >= base &&
+		    ptraddr < base + LOBJ_CHUNKPAGES * PAGE_SIZE) {
+			break;
+		}
+	}
 #endif
+	if (lc == NULL) {
+		/* Not in any of our chunks */
+		spinlock_release(&kmalloc_spinlock);
+		return -1;
+	}
 
+	base = PR_PAGEADDR(&lc->lc_pr);
+	KASSERT(ptraddr >= base &&
+		ptraddr < base + LOBJ_CHUNKPAGES * PAGE_SIZE);
+	first = (ptraddr - base) / LOBJ_GRAIN;
+
+	/* It must be the first grain of an allocated object. */
+	bit = (uint32_t)1 << first;
+	if ((ptraddr - base) % LOBJ_GRAIN != 0 ||
+	    (lc->lc_inuse & bit) == 0 ||
+	    (first > 0 && (lc->lc_notlast & (bit >> 1)) != 0)) {
+		panic("kfree: large object free of invalid addr %p\n", ptr);
+	}
+
+	for (i = first; ; i++) {
+		KASSERT(i < LOBJ_NGRAINS);
+		bit = (uint32_t)1 << i;
+		KASSERT((lc->lc_inuse & bit) != 0);
+		lc->lc_inuse &= ~bit;
+		if ((lc->lc_notlast & bit) == 0) {
+			break;
+		}
+		lc->lc_notlast &= ~bit;
+	}
+
+	/*
+	 * Clear the object to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef(ptr, (i + 1 - first) * LOBJ_GRAIN);
+
+	if (lc->lc_inuse != 0) {
+		spinlock_release(&kmalloc_spinlock);
+		return 0;
+	}
+
+	/* Whole chunk is free. */
+	for (prev = &lobjbase; *prev != lc; prev = &(*prev)->lc_next) {
+		KASSERT(*prev != NULL);
+	}
+	*prev = lc->lc_next;
+	spinlock_release(&kmalloc_spinlock);
+
+	lobj_destroychunk(lc);
 	return 0;
 }
 
@@ -1163,46 +2343,74 @@ subpage_kfree(void *ptr)
 ////////////////////////////////////////////////////////////
 
 /*
- * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
+ * Count an allocation of SZ bytes from BUCKET that returned PTR to
+ * the caller at SITE, and return PTR.
+ */
+static
+void *
+kheap_allocated(void *ptr, unsigned bucket, size_t sz, vaddr_t site)
+{
+	if (ptr != NULL) {
+		kfrag_account(bucket, sz);
+		if (ktrack_on) {
+			ktrack_alloc((vaddr_t)ptr, site, bucket, sz);
+		}
+	}
+	return ptr;
+}
+
+/*
+ * Allocate a block of size SZ. Small blocks come from subpage_kmalloc;
+ * blocks of a few pages that are not a whole number of pages come
+ * from lobj_kmalloc; everything else, and anything those cannot
+ * satisfy, goes straight to alloc_kpages.
  */
 void *
 kmalloc(size_t sz)
 {
 	size_t checksz;
-#ifdef LABELS
-	vaddr_t label;
-#endif
+	unsigned long npages;
+	unsigned blktype;
+	vaddr_t address;
+	vaddr_t site;
+	void *ptr;
 
-#ifdef LABELS
 #ifdef __GNUC__
-	label = (vaddr_t)__builtin_return_address(0);
+	site = (vaddr_t)__builtin_return_address(0);
 #else
 #error "Don't know how to get return address with this compiler"
 #endif /* __GNUC__ */
-#endif /* LABELS */
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
-	if (checksz >= LARGEST_SUBPAGE_SIZE) {
-		unsigned long npages;
-		vaddr_t address;
-
-		/* Round up to a whole number of pages. */
-		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
-			return NULL;
+	if (checksz <= LARGEST_SUBPAGE_SIZE) {
+#ifdef LABELS
+		ptr = subpage_kmalloc(sz, site);
+#else
+		ptr = subpage_kmalloc(sz);
+#endif
+		blktype = blocktype(checksz);
+		if (ptr != NULL || slabpages[blktype] == 1) {
+			return kheap_allocated(ptr, blktype, sz, site);
 		}
-		KASSERT(address % PAGE_SIZE == 0);
+		/* A single page may still be had when a slab can't. */
+	}
+	else if (sz <= LOBJ_MAXSIZE && sz % PAGE_SIZE != 0) {
+		address = lobj_kmalloc(sz);
+		if (address != 0) {
+			return kheap_allocated((void *)address, KSTAT_LOBJ,
+					       sz, site);
+		}
+	}
 
-		return (void *)address;
+	/* Round up to a whole number of pages. */
+	npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
+	address = alloc_kpages(npages);
+	if (address==0) {
+		return NULL;
 	}
+	KASSERT(address % PAGE_SIZE == 0);
 
-#ifdef LABELS
-	return subpage_kmalloc(sz, label);
-#else
-	return subpage_kmalloc(sz);
-#endif
+	return kheap_allocated((void *)address, KSTAT_PAGES, sz, site);
 }
 
 /*
@@ -1211,14 +2419,18 @@ kmalloc(size_t sz)
 void
 kfree(void *ptr)
 {
+	if (ptr != NULL && ktrack_on) {
+		ktrack_free((vaddr_t)ptr);
+	}
+
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Try subpage first, then large objects; if both fail, assume
+	 * it's a whole-page allocation.
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	} else if (subpage_kfree(ptr) && lobj_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
 }
-
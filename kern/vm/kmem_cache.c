@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Object caches. See kmem_cache.h.
+ *
+ * Each slab is one page from alloc_kpages, with a struct kc_slab at
+ * the start and the objects after it. Because slabs are page-aligned,
+ * kmem_cache_free finds an object's slab by masking its address. A
+ * free object is linked to the next through a word placed after the
+ * object itself, so linking it does not disturb constructed state.
+ *
+ * Slabs with free objects are on the cache's partial list, and up to
+ * KC_MAXEMPTY slabs with no objects in use are kept aside in case
+ * they are soon needed again; any more empty slabs than that go
+ * straight back to the page allocator. Full slabs are not on any
+ * list.
+ *
+ * Constructors and destructors are always called without any cache
+ * lock held, so they may use kmalloc and other caches.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <shrinker.h>
+#include <kmem_cache.h>
+
+/* alignment of objects within a slab */
+#define KC_ALIGN 8
+
+/* empty slabs a cache keeps until kmem_cache_reap */
+#define KC_MAXEMPTY 4
+
+struct kc_slab {
+	struct kmem_cache *ks_cache;    /* cache this slab belongs to */
+	struct kc_slab *ks_next;        /* next slab on partial/empty list */
+	struct kc_slab *ks_prev;        /* previous on partial list */
+	void *ks_free;                  /* first free object */
+	unsigned ks_nfree;              /* number of free objects */
+	unsigned ks_nobjs;              /* number of objects */
+};
+
+#define KC_HDRSIZE         ROUNDUP(sizeof(struct kc_slab), KC_ALIGN)
+#define KC_LINKOFF(kc)     ROUNDUP((kc)->kc_size, sizeof(void *))
+#define KC_STRIDE(kc)      ROUNDUP(KC_LINKOFF(kc) + sizeof(void *), KC_ALIGN)
+#define KC_LINK(kc, obj)   ((void **)((char *)(obj) + KC_LINKOFF(kc)))
+#define KC_SLABOF(obj)     ((struct kc_slab *)((vaddr_t)(obj) & PAGE_FRAME))
+
+/* list of all caches that have ever had a slab, for stats and reaping */
+static struct spinlock kc_list_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kc_list;
+
+////////////////////////////////////////////////////////////
+// slabs
+
+/*
+ * Take SLAB off KC's partial list. The caller holds kc_lock.
+ */
+static
+void
+kc_unlink(struct kmem_cache *kc, struct kc_slab *slab)
+{
+	if (slab->ks_prev != NULL) {
+		slab->ks_prev->ks_next = slab->ks_next;
+	} else {
+		KASSERT(kc->kc_partial == slab);
+		kc->kc_partial = slab->ks_next;
+	}
+	if (slab->ks_next != NULL) {
+		slab->ks_next->ks_prev = slab->ks_prev;
+	}
+	slab->ks_next = slab->ks_prev = NULL;
+}
+
+/*
+ * Put SLAB at the head of KC's partial list. The caller holds kc_lock.
+ */
+static
+void
+kc_push(struct kmem_cache *kc, struct kc_slab *slab)
+{
+	slab->ks_prev = NULL;
+	slab->ks_next = kc->kc_partial;
+	if (kc->kc_partial != NULL) {
+		kc->kc_partial->ks_prev = slab;
+	}
+	kc->kc_partial = slab;
+}
+
+/*
+ * Run the destructor on every (free) object of SLAB and give its page
+ * back.
+ */
+static
+void
+kc_destroyslab(struct kc_slab *slab)
+{
+	struct kmem_cache *kc = slab->ks_cache;
+	void *obj, *next;
+
+	KASSERT(slab->ks_nfree == slab->ks_nobjs);
+
+	for (obj = slab->ks_free; obj != NULL; obj = next) {
+		next = *KC_LINK(kc, obj);
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(obj);
+		}
+	}
+	free_kpages((vaddr_t)slab);
+}
+
+/*
+ * Set up a new slab for KC, constructing all its objects.
+ */
+static
+struct kc_slab *
+kc_grow(struct kmem_cache *kc)
+{
+	struct kc_slab *slab;
+	vaddr_t page;
+	void *obj;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	slab = (struct kc_slab *)page;
+	slab->ks_cache = kc;
+	slab->ks_next = slab->ks_prev = NULL;
+	slab->ks_free = NULL;
+	slab->ks_nobjs = (PAGE_SIZE - KC_HDRSIZE) / KC_STRIDE(kc);
+	KASSERT(slab->ks_nobjs > 0);
+
+	/* backwards, so the free list comes out in address order. */
+	for (i = slab->ks_nobjs; i-- > 0; ) {
+		obj = (void *)(page + KC_HDRSIZE + i * KC_STRIDE(kc));
+		if (kc->kc_ctor != NULL && kc->kc_ctor(obj) != 0) {
+			/* undo the ones already constructed. */
+			slab->ks_nfree = slab->ks_nobjs = slab->ks_nobjs - i - 1;
+			kc_destroyslab(slab);
+			return NULL;
+		}
+		*KC_LINK(kc, obj) = slab->ks_free;
+		slab->ks_free = obj;
+	}
+	slab->ks_nfree = slab->ks_nobjs;
+
+	return slab;
+}
+
+/*
+ * Put KC on the list of all caches, if it isn't already.
+ */
+static
+void
+kc_list_add(struct kmem_cache *kc)
+{
+	spinlock_acquire(&kc_list_lock);
+	if (!kc->kc_listed) {
+		kc->kc_next = kc_list;
+		kc_list = kc;
+		kc->kc_listed = true;
+	}
+	spinlock_release(&kc_list_lock);
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	bzero(kc, sizeof(*kc));
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	KASSERT((PAGE_SIZE - KC_HDRSIZE) / KC_STRIDE(kc) > 0);
+
+	kc_list_add(kc);
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **prevp;
+	struct kc_slab *slab;
+
+	KASSERT(kc->kc_inuse == 0);
+	KASSERT(kc->kc_partial == NULL);
+
+	spinlock_acquire(&kc_list_lock);
+	if (kc->kc_listed) {
+		for (prevp = &kc_list; *prevp != kc;
+		     prevp = &(*prevp)->kc_next) {
+			KASSERT(*prevp != NULL);
+		}
+		*prevp = kc->kc_next;
+	}
+	spinlock_release(&kc_list_lock);
+
+	while (kc->kc_empty != NULL) {
+		slab = kc->kc_empty;
+		kc->kc_empty = slab->ks_next;
+		kc_destroyslab(slab);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kc_slab *slab;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	while (kc->kc_partial == NULL) {
+		if (kc->kc_empty != NULL) {
+			slab = kc->kc_empty;
+			kc->kc_empty = slab->ks_next;
+			kc->kc_nempty--;
+			kc_push(kc, slab);
+			break;
+		}
+
+		/* Call alloc_kpages and constructors without kc_lock. */
+		spinlock_release(&kc->kc_lock);
+		slab = kc_grow(kc);
+		if (slab == NULL) {
+			return NULL;
+		}
+		if (!kc->kc_listed) {
+			kc_list_add(kc);
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kc->kc_nslabs++;
+		kc->kc_grows++;
+		kc_push(kc, slab);
+	}
+
+	slab = kc->kc_partial;
+	obj = slab->ks_free;
+	KASSERT(obj != NULL);
+	slab->ks_free = *KC_LINK(kc, obj);
+	slab->ks_nfree--;
+	if (slab->ks_nfree == 0) {
+		kc_unlink(kc, slab);
+	}
+	kc->kc_inuse++;
+	kc->kc_allocs++;
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kc_slab *slab, *victim;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	slab = KC_SLABOF(obj);
+	KASSERT(slab->ks_cache == kc);
+	victim = NULL;
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(slab->ks_nfree < slab->ks_nobjs);
+	*KC_LINK(kc, obj) = slab->ks_free;
+	slab->ks_free = obj;
+	if (slab->ks_nfree++ == 0) {
+		/* it was full. */
+		kc_push(kc, slab);
+	}
+	if (slab->ks_nfree == slab->ks_nobjs) {
+		/* nothing in use: keep a few such slabs, free the rest. */
+		kc_unlink(kc, slab);
+		if (kc->kc_nempty < KC_MAXEMPTY) {
+			slab->ks_next = kc->kc_empty;
+			kc->kc_empty = slab;
+			kc->kc_nempty++;
+		} else {
+			victim = slab;
+			kc->kc_nslabs--;
+			kc->kc_shrinks++;
+		}
+	}
+	kc->kc_inuse--;
+	kc->kc_frees++;
+	spinlock_release(&kc->kc_lock);
+
+	if (victim != NULL) {
+		kc_destroyslab(victim);
+	}
+}
+
+unsigned
+kmem_cache_reap(void)
+{
+	struct kmem_cache *kc;
+	struct kc_slab *slab, *reaped;
+	unsigned npages;
+
+	/* collect the empty slabs... */
+	reaped = NULL;
+	spinlock_acquire(&kc_list_lock);
+	for (kc = kc_list; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		while (kc->kc_empty != NULL) {
+			slab = kc->kc_empty;
+			kc->kc_empty = slab->ks_next;
+			slab->ks_next = reaped;
+			reaped = slab;
+			kc->kc_nslabs--;
+			kc->kc_shrinks++;
+		}
+		kc->kc_nempty = 0;
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kc_list_lock);
+
+	/* ...and destroy them with no locks held. */
+	npages = 0;
+	while (reaped != NULL) {
+		slab = reaped;
+		reaped = slab->ks_next;
+		kc_destroyslab(slab);
+		npages++;
+	}
+
+	return npages;
+}
+
+/*
+ * Under memory pressure the empty slabs are the first thing to go.
+ * Reaping takes all of them whatever NPAGES is; they are cheap to
+ * set up again.
+ */
+static
+unsigned
+kc_shrink_count(void)
+{
+	struct kmem_cache *kc;
+	unsigned npages;
+
+	npages = 0;
+	spinlock_acquire(&kc_list_lock);
+	for (kc = kc_list; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		npages += kc->kc_nempty;
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kc_list_lock);
+
+	return npages;
+}
+
+static
+unsigned
+kc_shrink_scan(unsigned npages)
+{
+	(void)npages;
+	return kmem_cache_reap();
+}
+
+static struct shrinker kc_shrinker =
+	SHRINKER_INITIALIZER("kmem_cache", kc_shrink_count, kc_shrink_scan, 0);
+
+void
+kmem_cache_bootstrap(void)
+{
+	shrinker_register(&kc_shrinker);
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned nslabs, inuse, allocs, frees, grows, shrinks, perslab;
+
+	kprintf("%-10s %5s %5s %5s %6s %6s %8s %8s %6s %6s\n",
+		"cache", "size", "slot", "/slab", "slabs", "inuse",
+		"allocs", "frees", "grows", "shrnks");
+
+	spinlock_acquire(&kc_list_lock);
+	for (kc = kc_list; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		nslabs = kc->kc_nslabs;
+		inuse = kc->kc_inuse;
+		allocs = kc->kc_allocs;
+		frees = kc->kc_frees;
+		grows = kc->kc_grows;
+		shrinks = kc->kc_shrinks;
+		spinlock_release(&kc->kc_lock);
+
+		perslab = (PAGE_SIZE - KC_HDRSIZE) / KC_STRIDE(kc);
+		kprintf("%-10s %5u %5u %5u %6u %6u %8u %8u %6u %6u\n",
+			kc->kc_name, (unsigned)kc->kc_size,
+			(unsigned)KC_STRIDE(kc), perslab, nslabs, inuse,
+			allocs, frees, grows, shrinks);
+	}
+	spinlock_release(&kc_list_lock);
+}
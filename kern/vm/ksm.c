@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel samepage merging. See ksm.h.
+ *
+ * Merged frames live in the stable table, which holds one reference
+ * on each so that a merged frame stays put while pages join and leave
+ * it. Pages seen during the current scan that might be worth merging
+ * go in the unstable table, which holds no references; its entries
+ * are only hints and are always compared word by word before use.
+ *
+ * A page is only considered once its checksum has been the same for
+ * two scans in a row, so that pages being actively written are not
+ * merged only to be copied again straight away.
+ *
+ * A page table entry changed here is shot down on every CPU running
+ * the address space before the frame it pointed at is let go.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <ksm.h>
+
+/* hash chains in each of the tables. */
+#define KSM_NBUCKETS  64
+
+/* seconds to sleep between scans. */
+#define KSM_INTERVAL  2
+
+struct ksm_node {
+	uint32_t kn_sum;                /* checksum of the frame */
+	vaddr_t kn_kvaddr;              /* the frame */
+	struct ksm_node *kn_next;       /* next on hash chain */
+};
+
+/* ksm_lock protects the stable table and the counters. */
+static struct lock *ksm_lock;
+static struct ksm_node *ksm_stable[KSM_NBUCKETS];
+static unsigned ksm_scans;              /* full scans completed */
+static unsigned ksm_merges;             /* pages ever merged */
+
+/* only used by the scanner thread. */
+static struct ksm_node *ksm_unstable[KSM_NBUCKETS];
+static uint32_t *ksm_sums;              /* last checksum, by frame number */
+
+/*
+ * FNV-1a over the words of a frame.
+ */
+static
+uint32_t
+ksm_checksum(vaddr_t kvaddr)
+{
+	const uint32_t *words = (const uint32_t *)kvaddr;
+	uint32_t sum = 2166136261U;
+	unsigned i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		sum ^= words[i];
+		sum *= 16777619U;
+	}
+	return sum;
+}
+
+/*
+ * Compare the contents of two frames.
+ */
+static
+bool
+ksm_samepage(vaddr_t a, vaddr_t b)
+{
+	const uint32_t *wa = (const uint32_t *)a;
+	const uint32_t *wb = (const uint32_t *)b;
+	unsigned i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (wa[i] != wb[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find a frame other than KVADDR in TABLE with the same contents.
+ */
+static
+struct ksm_node *
+ksm_find(struct ksm_node **table, uint32_t sum, vaddr_t kvaddr)
+{
+	struct ksm_node *node;
+
+	for (node = table[sum % KSM_NBUCKETS]; node != NULL;
+	     node = node->kn_next) {
+		if (node->kn_sum == sum && node->kn_kvaddr != kvaddr &&
+		    ksm_samepage(node->kn_kvaddr, kvaddr)) {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+static
+int
+ksm_insert(struct ksm_node **table, uint32_t sum, vaddr_t kvaddr)
+{
+	struct ksm_node *node;
+
+	node = kmalloc(sizeof(*node));
+	if (node == NULL) {
+		return ENOMEM;
+	}
+	node->kn_sum = sum;
+	node->kn_kvaddr = kvaddr;
+	node->kn_next = table[sum % KSM_NBUCKETS];
+	table[sum % KSM_NBUCKETS] = node;
+	return 0;
+}
+
+/*
+ * Look at one private page, mapped at VADDR in AS by page table entry
+ * *PTE. The caller holds as_lock.
+ */
+static
+void
+ksm_scan_page(struct addrspace *as, vaddr_t vaddr, paddr_t *pte)
+{
+	struct ksm_node *node;
+	vaddr_t kvaddr;
+	unsigned frame;
+	uint32_t sum;
+
+	kvaddr = PADDR_TO_KVADDR(*pte & PAGE_FRAME);
+	frame = (*pte & PAGE_FRAME) / PAGE_SIZE;
+
+	/* already merged. */
+	if (frame_refcount(kvaddr) != 1) {
+		return;
+	}
+
+	/* skip pages that changed since the last scan. */
+	sum = ksm_checksum(kvaddr);
+	if (ksm_sums[frame] != sum) {
+		ksm_sums[frame] = sum;
+		return;
+	}
+
+	lock_acquire(ksm_lock);
+
+	node = ksm_find(ksm_stable, sum, kvaddr);
+	if (node != NULL) {
+		/* map the merged frame readonly and drop our copy. */
+		frame_incref(node->kn_kvaddr);
+		*pte = KVADDR_TO_PADDR(node->kn_kvaddr) | TLBLO_VALID;
+		vm_tlbinvalidate(as, vaddr, 1);
+		free_kpages(kvaddr);
+		ksm_merges++;
+	} else if (ksm_find(ksm_unstable, sum, kvaddr) != NULL) {
+		/*
+		 * Another page matches. Make this frame a merged frame
+		 * so the other page can join it on the next scan.
+		 */
+		if (ksm_insert(ksm_stable, sum, kvaddr) == 0) {
+			frame_incref(kvaddr);
+			*pte &= ~(paddr_t)TLBLO_DIRTY;
+			vm_tlbinvalidate(as, vaddr, 1);
+		}
+	} else {
+		/* only a hint, so running out of memory does no harm. */
+		(void)ksm_insert(ksm_unstable, sum, kvaddr);
+	}
+
+	lock_release(ksm_lock);
+}
+
+/*
+ * Scan the private pages of an address space. Frames of shared memory
+ * segments are owned by the segment and are left alone. The caller
+ * holds as_lock.
+ */
+static
+void
+ksm_scan_as(struct addrspace *as)
+{
+	struct region *reg;
+	vaddr_t vaddr;
+	unsigned i, j;
+
+	for (i = 0; i < TABLE_SIZE; i++) {
+		if (as->pagetable[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < TABLE_SIZE; j++) {
+			/* skip empty entries and pages evicted to zswap. */
+			if ((as->pagetable[i][j] & TLBLO_VALID) == 0) {
+				continue;
+			}
+			vaddr = ((vaddr_t)i << 22) | ((vaddr_t)j << 12);
+			reg = as_region_lookup(as, vaddr);
+			if (reg == NULL || reg->reg_shm != NULL) {
+				continue;
+			}
+			ksm_scan_page(as, vaddr, &as->pagetable[i][j]);
+		}
+	}
+}
+
+/*
+ * End of a scan: forget the candidates, and free merged frames that
+ * nobody maps any more.
+ */
+static
+void
+ksm_endscan(void)
+{
+	struct ksm_node *node, **prevp;
+	unsigned i;
+
+	for (i = 0; i < KSM_NBUCKETS; i++) {
+		while (ksm_unstable[i] != NULL) {
+			node = ksm_unstable[i];
+			ksm_unstable[i] = node->kn_next;
+			kfree(node);
+		}
+	}
+
+	lock_acquire(ksm_lock);
+	for (i = 0; i < KSM_NBUCKETS; i++) {
+		prevp = &ksm_stable[i];
+		while (*prevp != NULL) {
+			node = *prevp;
+			if (frame_refcount(node->kn_kvaddr) == 1) {
+				*prevp = node->kn_next;
+				free_kpages(node->kn_kvaddr);
+				kfree(node);
+			} else {
+				prevp = &node->kn_next;
+			}
+		}
+	}
+	ksm_scans++;
+	lock_release(ksm_lock);
+}
+
+static
+void
+ksm_thread(void *unused1, unsigned long unused2)
+{
+	struct addrspace *as;
+	unsigned n;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		for (n = 0; (as = as_lock_nth(n)) != NULL; n++) {
+			ksm_scan_as(as);
+			rwlock_release_write(as->as_lock);
+		}
+		ksm_endscan();
+		clocksleep(KSM_INTERVAL);
+	}
+}
+
+void
+ksm_bootstrap(void)
+{
+	unsigned nframes, i;
+	int result;
+
+	ksm_lock = lock_create("ksm");
+	if (ksm_lock == NULL) {
+		panic("ksm_bootstrap: Out of memory\n");
+	}
+
+	nframes = ram_getsize() / PAGE_SIZE;
+	ksm_sums = kmalloc(nframes * sizeof(uint32_t));
+	if (ksm_sums == NULL) {
+		panic("ksm_bootstrap: Out of memory\n");
+	}
+	for (i = 0; i < nframes; i++) {
+		ksm_sums[i] = 0;
+	}
+
+	result = thread_fork("ksm", NULL, ksm_thread, NULL, 0);
+	if (result) {
+		panic("ksm_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+/*
+ * Print how much memory merging is saving. A merged frame mapped N
+ * times saves N-1 frames.
+ */
+void
+ksm_printstats(void)
+{
+	struct ksm_node *node;
+	unsigned i, frames, mappings, saved, refs;
+
+	lock_acquire(ksm_lock);
+
+	frames = mappings = saved = 0;
+	for (i = 0; i < KSM_NBUCKETS; i++) {
+		for (node = ksm_stable[i]; node != NULL;
+		     node = node->kn_next) {
+			/* one reference belongs to the stable table. */
+			refs = frame_refcount(node->kn_kvaddr) - 1;
+			frames++;
+			mappings += refs;
+			if (refs > 1) {
+				saved += refs - 1;
+			}
+		}
+	}
+
+	kprintf("KSM status:\n");
+	kprintf("    %u full scans, %u pages merged in total\n",
+		ksm_scans, ksm_merges);
+	kprintf("    %u merged frames mapped %u times (%u frames saved)\n",
+		frames, mappings, saved);
+
+	lock_release(ksm_lock);
+}
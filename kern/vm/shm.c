@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shared memory segments. See shm.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <shm.h>
+
+/*
+ * shm_lock protects the list of named segments and the reference
+ * counts of all segments. It is never held while waiting for a
+ * segment's so_lock.
+ */
+static struct lock *shm_lock;
+static struct shm_object *shm_names;
+
+void
+shm_bootstrap(void)
+{
+	shm_lock = lock_create("shm");
+	if (shm_lock == NULL) {
+		panic("shm_bootstrap: Out of memory\n");
+	}
+	shm_names = NULL;
+}
+
+/*
+ * Allocate a segment with no frames yet and a single reference.
+ */
+static
+struct shm_object *
+shm_object_create(const char *name, unsigned npages)
+{
+	struct shm_object *so;
+	unsigned i;
+
+	so = kmalloc(sizeof(*so));
+	if (so == NULL) {
+		return NULL;
+	}
+
+	so->so_name = NULL;
+	if (name != NULL) {
+		so->so_name = kstrdup(name);
+		if (so->so_name == NULL) {
+			kfree(so);
+			return NULL;
+		}
+	}
+
+	so->so_pages = kmalloc(npages * sizeof(vaddr_t));
+	if (so->so_pages == NULL) {
+		kfree(so->so_name);
+		kfree(so);
+		return NULL;
+	}
+	for (i = 0; i < npages; i++) {
+		so->so_pages[i] = 0;
+	}
+
+	so->so_lock = lock_create("shm object");
+	if (so->so_lock == NULL) {
+		kfree(so->so_pages);
+		kfree(so->so_name);
+		kfree(so);
+		return NULL;
+	}
+
+	so->so_npages = npages;
+	so->so_refcount = 1;
+	so->so_next = NULL;
+	return so;
+}
+
+/*
+ * Free a segment and all its frames. No references may remain.
+ */
+static
+void
+shm_object_destroy(struct shm_object *so)
+{
+	unsigned i;
+
+	KASSERT(so->so_refcount == 0);
+
+	for (i = 0; i < so->so_npages; i++) {
+		if (so->so_pages[i] != 0) {
+			free_kpages(so->so_pages[i]);
+		}
+	}
+	lock_destroy(so->so_lock);
+	kfree(so->so_pages);
+	kfree(so->so_name);
+	kfree(so);
+}
+
+int
+shm_create(unsigned npages, struct shm_object **ret)
+{
+	struct shm_object *so;
+
+	KASSERT(npages > 0);
+
+	so = shm_object_create(NULL, npages);
+	if (so == NULL) {
+		return ENOMEM;
+	}
+	*ret = so;
+	return 0;
+}
+
+int
+shm_open(const char *name, unsigned npages, struct shm_object **ret)
+{
+	struct shm_object *so;
+
+	KASSERT(npages > 0);
+
+	/* Same rules as semfs: a flat namespace with no . or .. entries. */
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return EINVAL;
+	}
+	if (strchr(name, '/') != NULL) {
+		return EINVAL;
+	}
+
+	lock_acquire(shm_lock);
+	for (so = shm_names; so != NULL; so = so->so_next) {
+		if (!strcmp(so->so_name, name)) {
+			if (so->so_npages < npages) {
+				lock_release(shm_lock);
+				return EINVAL;
+			}
+			so->so_refcount++;
+			lock_release(shm_lock);
+			*ret = so;
+			return 0;
+		}
+	}
+
+	so = shm_object_create(name, npages);
+	if (so == NULL) {
+		lock_release(shm_lock);
+		return ENOMEM;
+	}
+	/* One reference for the name and one for the caller. */
+	so->so_refcount = 2;
+	so->so_next = shm_names;
+	shm_names = so;
+	lock_release(shm_lock);
+
+	*ret = so;
+	return 0;
+}
+
+int
+shm_unlink(const char *name)
+{
+	struct shm_object *so, **prevp;
+
+	lock_acquire(shm_lock);
+	for (prevp = &shm_names; *prevp != NULL; prevp = &(*prevp)->so_next) {
+		so = *prevp;
+		if (!strcmp(so->so_name, name)) {
+			*prevp = so->so_next;
+			so->so_next = NULL;
+			lock_release(shm_lock);
+			/* drop the name's reference. */
+			shm_decref(so);
+			return 0;
+		}
+	}
+	lock_release(shm_lock);
+	return ENOENT;
+}
+
+void
+shm_incref(struct shm_object *so)
+{
+	lock_acquire(shm_lock);
+	KASSERT(so->so_refcount > 0);
+	so->so_refcount++;
+	lock_release(shm_lock);
+}
+
+void
+shm_decref(struct shm_object *so)
+{
+	bool last;
+
+	lock_acquire(shm_lock);
+	KASSERT(so->so_refcount > 0);
+	so->so_refcount--;
+	last = (so->so_refcount == 0);
+	lock_release(shm_lock);
+
+	if (last) {
+		shm_object_destroy(so);
+	}
+}
+
+int
+shm_getpage(struct shm_object *so, unsigned index, vaddr_t *ret)
+{
+	vaddr_t kvaddr;
+
+	KASSERT(index < so->so_npages);
+
+	lock_acquire(so->so_lock);
+	kvaddr = so->so_pages[index];
+	if (kvaddr == 0) {
+		/* first touch by any process: hand out a zero-filled frame. */
+		kvaddr = alloc_kpages(1);
+		if (kvaddr == 0) {
+			lock_release(so->so_lock);
+			return ENOMEM;
+		}
+		bzero((void *)kvaddr, PAGE_SIZE);
+		so->so_pages[index] = kvaddr;
+	}
+	lock_release(so->so_lock);
+
+	*ret = kvaddr;
+	return 0;
+}
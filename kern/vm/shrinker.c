@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Memory pressure callbacks. See shrinker.h.
+ *
+ * The list only ever grows, at the tail, and a shrinker's sh_next is
+ * never changed once it is on the list, so the list can be walked
+ * without the lock; the lock is only needed to append and to update
+ * the statistics.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <shrinker.h>
+
+/* shrinker_spinlock protects everything below. */
+static struct spinlock shrinker_spinlock = SPINLOCK_INITIALIZER;
+static struct shrinker *shrinker_list;
+static struct shrinker **shrinker_tail = &shrinker_list;
+
+static struct {
+	unsigned ss_runs;               /* shrinker_run calls */
+	unsigned ss_failures;           /* runs that freed nothing */
+	unsigned ss_freed;              /* pages freed */
+} shrinker_stats;
+
+void
+shrinker_register(struct shrinker *sh)
+{
+	KASSERT(sh->sh_count != NULL);
+	KASSERT(sh->sh_scan != NULL);
+
+	sh->sh_next = NULL;
+	spinlock_acquire(&shrinker_spinlock);
+	*shrinker_tail = sh;
+	shrinker_tail = &sh->sh_next;
+	spinlock_release(&shrinker_spinlock);
+}
+
+unsigned
+shrinker_run(unsigned npages, bool maysleep)
+{
+	struct shrinker *sh;
+	unsigned freed, n;
+
+	spinlock_acquire(&shrinker_spinlock);
+	sh = shrinker_list;
+	spinlock_release(&shrinker_spinlock);
+
+	freed = 0;
+	for (; sh != NULL && freed < npages; sh = sh->sh_next) {
+		if ((sh->sh_flags & SHRINKER_SLEEPS) && !maysleep) {
+			continue;
+		}
+		if (sh->sh_count() == 0) {
+			continue;
+		}
+		n = sh->sh_scan(npages - freed);
+		freed += n;
+
+		spinlock_acquire(&shrinker_spinlock);
+		sh->sh_calls++;
+		sh->sh_freed += n;
+		spinlock_release(&shrinker_spinlock);
+	}
+
+	spinlock_acquire(&shrinker_spinlock);
+	shrinker_stats.ss_runs++;
+	if (freed == 0) {
+		shrinker_stats.ss_failures++;
+	}
+	shrinker_stats.ss_freed += freed;
+	spinlock_release(&shrinker_spinlock);
+
+	return freed;
+}
+
+void
+shrinker_printstats(void)
+{
+	struct shrinker *sh;
+
+	spinlock_acquire(&shrinker_spinlock);
+	kprintf("Shrinkers: %u runs, %u freed nothing, %u pages freed\n",
+		shrinker_stats.ss_runs, shrinker_stats.ss_failures,
+		shrinker_stats.ss_freed);
+	spinlock_release(&shrinker_spinlock);
+
+	/* sh_count may take other spinlocks: call it without ours. */
+	for (sh = shrinker_list; sh != NULL; sh = sh->sh_next) {
+		kprintf("    %-12s %6u reclaimable, %6u calls, %6u freed%s\n",
+			sh->sh_name, sh->sh_count(), sh->sh_calls,
+			sh->sh_freed,
+			(sh->sh_flags & SHRINKER_SLEEPS) ? " (sleeps)" : "");
+	}
+}
@@ -1,17 +1,38 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <thread.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <machine/tlb.h>
 #include <spl.h>
+#include <cpu.h>
+#include <membar.h>
 
 #include <proc.h>
 #include <current.h>
+#include <shm.h>
+#include <synch.h>
+#include <ksm.h>
+#include <zswap.h>
+#include <wset.h>
+#include <vmalloc.h>
+#include <compact.h>
+#include <shrinker.h>
+#include "opt-ksm.h"
 
 /* Place your page table functions here */
 
+/* number of pages mapped ahead of a fault in an MADV_SEQUENTIAL region. */
+#define VM_FAULTAROUND_NPAGES 8
+
+/* number of pages vm_fault tries to evict when it runs out of frames. */
+#define VM_RECLAIM_NPAGES 8
+
+/* number of pages vm_evict picks before shooting down their TLB entries. */
+#define VM_EVICT_BATCH 16
+
 /* 
  * insert a pagetable entry that maps to the provided entryLo. 
  */
@@ -108,16 +129,372 @@ int pagetable_update(paddr_t **pagetable, vaddr_t reg_vbase, size_t reg_npages)
     return 0;
 }
 
+/*
+ * map the page containing vaddr, which lies in region reg of address
+ * space as. private regions get a fresh zero-filled frame, or the
+ * decompressed contents if the page was evicted to zswap; shared
+ * regions map the segment's frame for that page, which is allocated on
+ * the first touch by any process. the resulting entryLo is handed back
+ * for loading into the TLB.
+ */
+int vm_map_page(struct addrspace *as, struct region *reg, vaddr_t vaddr,
+                paddr_t *entryLo) {
+    vaddr_t kvaddr;
+    paddr_t oldentry;
+    int result;
+
+    result = pagetable_lookup(as->pagetable, vaddr, &oldentry);
+    if (result != 0) {
+        return result;
+    }
+
+    if (reg->reg_shm != NULL) {
+        /* find (or allocate) the segment's frame for this page. */
+        result = shm_getpage(reg->reg_shm,
+                             (vaddr - reg->reg_vbase) / PAGE_SIZE, &kvaddr);
+        if (result != 0) {
+            return result;
+        }
+    } else {
+        /* allocate a new frame for the page. */
+        kvaddr = alloc_kpages(1);
+        if (kvaddr == 0) {
+            return ENOMEM;
+        }
+
+        if ((oldentry & PTE_ZSWAP) != 0) {
+            /* bring the page back from the compressed store. */
+            result = zswap_load(PTE_TO_ZSWAP(oldentry), kvaddr);
+            if (result != 0) {
+                free_kpages(kvaddr);
+                return result;
+            }
+        } else {
+            /* zero fill the frame. */
+            bzero((void *)kvaddr, (size_t)PAGE_SIZE);
+        }
+    }
+
+    /* convert to physical address and add permissions to entryLo. */
+    *entryLo = KVADDR_TO_PADDR(kvaddr) | TLBLO_VALID;
+
+    /* add the dirty bit if vaddr is in a writable region. */
+    if ((reg->permissions & RF_W) != 0) {
+        *entryLo |= TLBLO_DIRTY;
+    }
+
+    /* place entry in pagetable. */
+    result = pagetable_insert(as->pagetable, vaddr, *entryLo);
+    if (result != 0) {
+        /* the frame of a shared page belongs to the segment. */
+        if (reg->reg_shm == NULL) {
+            free_kpages(kvaddr);
+        }
+        return result;
+    }
+
+    /* the compressed copy is no longer needed. */
+    if ((oldentry & PTE_ZSWAP) != 0) {
+        zswap_free(PTE_TO_ZSWAP(oldentry));
+    }
+
+    if (reg->reg_shm == NULL) {
+        /* record the mapping so compaction can move the frame. */
+        frame_setrmap(kvaddr, as, vaddr & PAGE_FRAME);
+        as->as_rss++;
+    }
+
+    return 0;
+}
+
+/*
+ * the faulting process's RLIMIT_RSS in pages, or 0 if it has none.
+ */
+static unsigned vm_rsslimit(void) {
+    rlim_t limit;
+
+    spinlock_acquire(&curproc->p_lock);
+    limit = curproc->p_rsslimit.rlim_cur;
+    spinlock_release(&curproc->p_lock);
+
+    if (limit == RLIM_INFINITY) {
+        return 0;
+    }
+    /* always leave room for the page being faulted in. */
+    if (limit < PAGE_SIZE) {
+        return 1;
+    }
+    if (limit / PAGE_SIZE > MIPS_KSEG0 / PAGE_SIZE) {
+        return 0;
+    }
+    return limit / PAGE_SIZE;
+}
+
+/*
+ * fault-around for regions advised MADV_SEQUENTIAL: map the next few
+ * untouched pages after faultaddress so a linear scan takes one fault
+ * per VM_FAULTAROUND_NPAGES pages. this is opportunistic, so running
+ * out of memory simply stops it early.
+ */
+static void vm_faultaround(struct addrspace *as, struct region *reg,
+                           vaddr_t faultaddress) {
+    vaddr_t vaddr, reg_vend;
+    paddr_t entryLo;
+    unsigned int i, rsslimit;
+
+    reg_vend = reg->reg_vbase + reg->reg_npages*PAGE_SIZE;
+    vaddr = (faultaddress & PAGE_FRAME) + PAGE_SIZE;
+    rsslimit = vm_rsslimit();
+
+    for (i = 0; i < VM_FAULTAROUND_NPAGES && vaddr < reg_vend; i++) {
+        /* read-ahead must not push the process over its RSS limit. */
+        if (rsslimit != 0 && as->as_rss >= rsslimit) {
+            return;
+        }
+        if (pagetable_lookup(as->pagetable, vaddr, &entryLo) != 0) {
+            return;
+        }
+        if (entryLo == 0 && vm_map_page(as, reg, vaddr, &entryLo) != 0) {
+            return;
+        }
+        vaddr += PAGE_SIZE;
+    }
+}
+
+/*
+ * invalidate the TLB entries that map the npages pages starting at
+ * the page containing vaddr, on this CPU and on every other CPU
+ * running a thread of as (all of them for kernel pages, as NULL).
+ * npages of 0 drops every entry of as, for changes scattered over
+ * the whole address space. returns once they are all gone, so the
+ * caller may then free or reuse the frames. the page table entries
+ * must already be changed.
+ */
+void vm_tlbinvalidate(struct addrspace *as, vaddr_t vaddr, unsigned npages) {
+    struct tlbshootdown ts;
+
+    ts.ts_vaddr = vaddr & PAGE_FRAME;
+    ts.ts_npages = npages;
+    vm_tlbshootdown(&ts);
+
+    /* order the page table changes before reading other CPUs' c_tlbas. */
+    membar_any_any();
+    ipi_tlbshootdown_as(as, &ts);
+}
+
+/*
+ * the VM's shrinker evicts resident user pages into zswap. taking
+ * each address space's as_lock means it may sleep, so it only runs
+ * for callers that hold no locks (vm_fault, when t_nlocks is 0), not
+ * from alloc_kpages.
+ */
+static unsigned vm_shrink_count(void) {
+    struct addrspace *as;
+    unsigned int n, npages;
+
+    npages = 0;
+    for (n = 0; (as = as_lock_nth(n)) != NULL; n++) {
+        npages += as->as_rss;
+        rwlock_release_write(as->as_lock);
+    }
+    return npages;
+}
+
+static struct shrinker vm_shrinker =
+    SHRINKER_INITIALIZER("vm", vm_shrink_count, vm_reclaim, SHRINKER_SLEEPS);
+
 void vm_bootstrap(void)
 {
     /* Initialise VM sub-system.  You probably want to initialise your 
        frame table here as well.
     */
     /* Not required to initialise frame table for this years submission. */
+
+    vmalloc_bootstrap();
+    as_bootstrap();
+    shm_bootstrap();
+    zswap_bootstrap();
+    wset_bootstrap();
+    compact_bootstrap();
+    shrinker_register(&vm_shrinker);
+#if OPT_KSM
+    ksm_bootstrap();
+#endif
+}
+
+static int vm_tlbmiss(struct addrspace *as, vaddr_t faultaddress);
+
+/*
+ * a write hit a page whose entry is not dirty. in a writable region
+ * that means KSM merged the page into a shared read-only frame: give
+ * this address space its own copy, or just make the entry dirty again
+ * if nobody else maps the frame any more. the caller holds as_lock.
+ */
+static int vm_copyonwrite(struct addrspace *as, vaddr_t faultaddress) {
+    struct region *cur_reg;
+    paddr_t entryLo;
+    vaddr_t oldkvaddr, newkvaddr;
+    bool copied;
+    int i, spl, result;
+
+    /* writes to readonly regions are genuine permission violations. */
+    cur_reg = as_region_lookup(as, faultaddress);
+    if (cur_reg == NULL || (cur_reg->permissions & RF_W) == 0) {
+        return EFAULT;
+    }
+
+    result = pagetable_lookup(as->pagetable, faultaddress, &entryLo);
+    if (result != 0) {
+        return result;
+    }
+    if ((entryLo & TLBLO_VALID) == 0) {
+        /* evicted since the TLB entry was loaded: fault it back in. */
+        return vm_tlbmiss(as, faultaddress);
+    }
+
+    oldkvaddr = PADDR_TO_KVADDR(entryLo & PAGE_FRAME);
+    copied = false;
+    if (frame_refcount(oldkvaddr) > 1) {
+        /* still shared: copy the frame and drop our reference to it. */
+        newkvaddr = alloc_kpages(1);
+        if (newkvaddr == 0) {
+            return ENOMEM;
+        }
+        memmove((void *)newkvaddr, (const void *)oldkvaddr, PAGE_SIZE);
+        entryLo = KVADDR_TO_PADDR(newkvaddr) | TLBLO_VALID;
+        frame_setrmap(newkvaddr, as, faultaddress & PAGE_FRAME);
+        copied = true;
+    }
+    entryLo |= TLBLO_DIRTY | PTE_REF;
+
+    /* the second-level table exists, so this cannot fail. */
+    result = pagetable_insert(as->pagetable, faultaddress, entryLo);
+    KASSERT(result == 0);
+
+    if (copied) {
+        /* other threads of as must stop reading the old frame too. */
+        vm_tlbinvalidate(as, faultaddress, 1);
+        free_kpages(oldkvaddr);
+    }
+
+    /* replace the readonly TLB entry that caused the fault. */
+    entryLo &= ~(paddr_t)PTE_SWBITS;
+    spl = splhigh();
+    i = tlb_probe(faultaddress & TLBHI_VPAGE, 0);
+    if (i >= 0) {
+        tlb_write(faultaddress & TLBHI_VPAGE, entryLo, i);
+    } else {
+        tlb_random(faultaddress & TLBHI_VPAGE, entryLo);
+    }
+    splx(spl);
+
+    return 0;
 }
 
 /*
- * called when faultaddress was not found in TLB.
+ * mark the page at faultaddress referenced, for the working-set
+ * sampler and the eviction clock, and load its entry into the TLB.
+ */
+static void vm_tlbload(struct addrspace *as, vaddr_t faultaddress,
+                       paddr_t entryLo) {
+    int spl, result;
+
+    if ((entryLo & PTE_REF) == 0) {
+        entryLo |= PTE_REF;
+        /* the entry exists, so this cannot fail. */
+        result = pagetable_insert(as->pagetable, faultaddress, entryLo);
+        KASSERT(result == 0);
+    }
+
+    /* Disable interrupts on this CPU and load the TLB. */
+    spl = splhigh();
+    tlb_random(faultaddress & TLBHI_VPAGE, entryLo & ~(paddr_t)PTE_SWBITS);
+    splx(spl);
+}
+
+/*
+ * fast path for a TLB miss on a page that is resident and already
+ * marked referenced. loading it needs nothing written to the page
+ * table, so as_lock is only taken for reading and faults like this
+ * in the same address space do not serialise. returns false, having
+ * done nothing, for anything else.
+ */
+static bool vm_tlbrefill(struct addrspace *as, vaddr_t faultaddress) {
+    paddr_t entryLo;
+    bool hit;
+
+    rwlock_acquire_read(as->as_lock);
+    hit = as->regions != NULL &&
+          pagetable_lookup(as->pagetable, faultaddress, &entryLo) == 0 &&
+          entryLo != 0 && (entryLo & (PTE_ZSWAP | PTE_REF)) == PTE_REF;
+    if (hit) {
+        vm_tlbload(as, faultaddress, entryLo);
+    }
+    rwlock_release_read(as->as_lock);
+
+    return hit;
+}
+
+/*
+ * handle a TLB miss on faultaddress. the caller holds as_lock.
+ */
+static int vm_tlbmiss(struct addrspace *as, vaddr_t faultaddress) {
+    unsigned int rsslimit;
+
+    /* the valid regions list should not be null */
+    if (as->regions == NULL) {
+        return EFAULT;
+    }
+
+    /* Check if faultaddress exists in pagetable and store entryLo. */
+    paddr_t entryLo;
+    int result = pagetable_lookup(as->pagetable, faultaddress, &entryLo);
+    if (result != 0) {
+        return result;
+    }
+
+    if (entryLo != 0 && (entryLo & PTE_ZSWAP) == 0) {
+        /* An entry was found, load the TLB. */
+        vm_tlbload(as, faultaddress, entryLo);
+        return 0;
+    }
+
+    /* check to see if the faultaddress lies within a valid region. */
+    struct region *cur_reg;
+    cur_reg = as_region_lookup(as, faultaddress);
+
+    if (cur_reg != NULL) {
+        /* at the RSS limit, make room by trimming our own coldest pages. */
+        rsslimit = vm_rsslimit();
+        if (cur_reg->reg_shm == NULL && rsslimit != 0 &&
+            as->as_rss >= rsslimit) {
+            vm_evict(as, as->as_rss - rsslimit + 1);
+        }
+
+        /* allocate and map (or page back in) a frame for the faultaddress. */
+        result = vm_map_page(as, cur_reg, faultaddress, &entryLo);
+        if (result != 0) {
+            return result;
+        }
+
+        /* load the TLB. */
+        vm_tlbload(as, faultaddress, entryLo);
+
+        /* fault in the following pages too if the region is being scanned. */
+        if (cur_reg->reg_advice == MADV_SEQUENTIAL) {
+            vm_faultaround(as, cur_reg, faultaddress);
+        }
+
+        return 0;
+    }
+
+    /* faultaddress in invalid region exit with EFAULT. */
+    return EFAULT;
+}
+
+/*
+ * called when faultaddress was not found in TLB, or on a write to a
+ * TLB entry without the dirty bit.
  * retrieves virtual memory mapping from pagetable and loads the TLB.
  * if virtual memory mapping does not exist in pagetable it is retrieved from disk.
  * returns EFAULT if memory reference is invalid.
@@ -126,8 +503,6 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
 
     switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		/* Attempt to violate READONLY memory permission, return EFAULT. */
-		return EFAULT;
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -135,6 +510,11 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
 		return EINVAL;
 	}
 
+    /* kseg2 belongs to vmalloc, whatever process is running. */
+    if (faultaddress >= MIPS_KSEG2) {
+        return vmalloc_fault(faulttype, faultaddress);
+    }
+
     if (curproc == NULL) {
 		/*
 		 * No process. This is probably a kernel fault early
@@ -159,86 +539,219 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
         return EFAULT;
     }
 
-    /* the valid regions list should not be null */
-    if (as->regions == NULL) {
-        return EFAULT;
+    if (faulttype != VM_FAULT_READONLY &&
+        vm_tlbrefill(as, faultaddress)) {
+        return 0;
     }
 
-    /* Check if faultaddress exists in pagetable and store entryLo. */
-    paddr_t entryLo;
-    int result = pagetable_lookup(as->pagetable, faultaddress, &entryLo);
-    if (result != 0) {
-        return result;
+    int result;
+    unsigned int tries;
+    for (tries = 0; ; tries++) {
+        rwlock_acquire_write(as->as_lock);
+        if (faulttype == VM_FAULT_READONLY) {
+            /* a copy-on-write split, or an attempt to write readonly memory. */
+            result = vm_copyonwrite(as, faultaddress);
+        } else {
+            result = vm_tlbmiss(as, faultaddress);
+        }
+        rwlock_release_write(as->as_lock);
+
+        /*
+         * out of frames: run the shrinkers, which may compress some
+         * pages away, and try again. the sleeping ones take as_lock
+         * and as_list_lock, so they only run if we hold no sleep
+         * locks: a fault in copyin/copyout may come with some held.
+         */
+        if (result != ENOMEM || tries > 0 ||
+            shrinker_run(VM_RECLAIM_NPAGES, curthread->t_nlocks == 0) == 0) {
+            return result;
+        }
     }
+}
 
-    if (entryLo != 0) {
-        /* An entry was found, disable interrupts on this CPU and load the TLB. */
-	    int spl = splhigh();
-        tlb_random(faultaddress & TLBHI_VPAGE, entryLo);
-        splx(spl);
-
-        return 0;
+/*
+ * compress the nvictims pages of as at victims out to zswap. their TLB
+ * entries, and those of any page whose reference bit vm_evict cleared,
+ * go first in one shootdown for the whole address space, so nobody
+ * writes a page while it is compressed or after its frame is freed;
+ * as_lock keeps them from being loaded again. returns the number of
+ * pages evicted.
+ */
+static unsigned vm_evict_batch(struct addrspace *as, const vaddr_t *victims,
+                               unsigned nvictims) {
+    paddr_t *entry;
+    vaddr_t vaddr, kvaddr;
+    unsigned int i, evicted, handle;
+
+    vm_tlbinvalidate(as, 0, 0);
+
+    evicted = 0;
+    for (i = 0; i < nvictims; i++) {
+        vaddr = victims[i];
+        entry = &as->pagetable[vaddr >> 22][vaddr << 10 >> 22];
+        if ((*entry & TLBLO_VALID) == 0) {
+            /* picked again on the second lap, and already gone. */
+            continue;
+        }
+        kvaddr = PADDR_TO_KVADDR(*entry & PAGE_FRAME);
+        /* zswap takes the frame if the page compresses. */
+        frame_setrmap(kvaddr, NULL, 0);
+        if (zswap_store(kvaddr, &handle) != 0) {
+            frame_setrmap(kvaddr, as, vaddr);
+            continue;
+        }
+        *entry = ZSWAP_TO_PTE(handle);
+        as->as_rss--;
+        evicted++;
     }
+    return evicted;
+}
 
-    /* check to see if the faultaddress lies within a valid region. */
+/*
+ * evict up to npages private pages of as into zswap, sweeping the
+ * pagetable like a clock hand from where the last call stopped. pages
+ * referenced since the hand last passed get a second chance, so the
+ * coldest go first. shared and KSM-merged frames are left alone since
+ * other address spaces map them too. victims are handed to
+ * vm_evict_batch VM_EVICT_BATCH at a time, so N pages cost one
+ * shootdown per batch rather than N. returns the number of pages
+ * evicted. the caller holds as_lock.
+ */
+unsigned vm_evict(struct addrspace *as, unsigned npages) {
     struct region *cur_reg;
-    cur_reg = as->regions;
-    while (cur_reg != NULL) {
-        /* break if faultaddress is in current region. */
-        if  (faultaddress >= cur_reg->reg_vbase && faultaddress < 
-                    cur_reg->reg_vbase + cur_reg->reg_npages*PAGE_SIZE) {
-            break;
+    paddr_t *entry;
+    vaddr_t vaddr, kvaddr;
+    vaddr_t victims[VM_EVICT_BATCH];
+    unsigned int nblocks, t1, t2, scanned, evicted, nvictims;
+    bool flush;
+
+    KASSERT(rwlock_do_i_hold_write(as->as_lock));
+
+    nblocks = MIPS_KSEG0 >> 22;
+    t1 = (as->as_evict_hand >> 22) % nblocks;
+    t2 = as->as_evict_hand << 10 >> 22;
+    evicted = 0;
+    nvictims = 0;
+    flush = false;
+
+    /* two laps: the first may only clear reference bits. */
+    for (scanned = 0; scanned <= 2*nblocks && evicted + nvictims < npages;
+         scanned++) {
+        if (as->pagetable[t1] == NULL) {
+            t2 = TABLE_SIZE;
+        }
+        for (; t2 < TABLE_SIZE && evicted + nvictims < npages; t2++) {
+            entry = &as->pagetable[t1][t2];
+            if ((*entry & TLBLO_VALID) == 0) {
+                continue;
+            }
+            vaddr = ((vaddr_t)t1 << 22) | ((vaddr_t)t2 << 12);
+            cur_reg = as_region_lookup(as, vaddr);
+            kvaddr = PADDR_TO_KVADDR(*entry & PAGE_FRAME);
+            if (cur_reg == NULL || cur_reg->reg_shm != NULL ||
+                frame_refcount(kvaddr) > 1) {
+                continue;
+            }
+            if ((*entry & PTE_REF) != 0) {
+                /* recently used: clear the bit and see if it is set again. */
+                *entry &= ~(paddr_t)PTE_REF;
+                flush = true;
+                continue;
+            }
+            victims[nvictims++] = vaddr;
+            if (nvictims == VM_EVICT_BATCH) {
+                evicted += vm_evict_batch(as, victims, nvictims);
+                nvictims = 0;
+                flush = false;
+            }
+        }
+        if (t2 >= TABLE_SIZE) {
+            t1 = (t1 + 1) % nblocks;
+            t2 = 0;
         }
-        cur_reg = cur_reg->reg_next;
     }
 
-    if (cur_reg != NULL) {
-        paddr_t paddr;
-
-        /* allocate a new frame for the faultaddress. */
-        paddr = (paddr_t)alloc_kpages(1);
-        if (paddr == 0) {
-            return ENOMEM;
-        }
+    if (nvictims > 0 || flush) {
+        evicted += vm_evict_batch(as, victims, nvictims);
+    }
 
-        /* zero fill the frame. */
-        bzero((void *)paddr, (size_t)PAGE_SIZE);
+    as->as_evict_hand = ((vaddr_t)t1 << 22) | ((vaddr_t)t2 << 12);
+    return evicted;
+}
 
-        /* convert to physical address and add permissions to entryLo. */
-        entryLo = KVADDR_TO_PADDR(paddr) | TLBLO_VALID;
+/*
+ * evict up to npages pages from whichever address spaces have them.
+ * address spaces holding more than their estimated working set give
+ * up the excess first; after that, take pages round-robin starting
+ * with the one after where the last call stopped. returns the number
+ * of pages evicted.
+ */
+unsigned vm_reclaim(unsigned npages) {
+    static unsigned int next_as = 0;
+    struct addrspace *as;
+    unsigned int evicted, excess, n, wrapped;
 
-        /* add the dirty bit if fault address is in a writable region. */
-        if ((cur_reg->permissions & RF_W) != 0) {
-            entryLo |= TLBLO_DIRTY;
+    evicted = 0;
+    for (n = 0; evicted < npages && (as = as_lock_nth(n)) != NULL; n++) {
+        excess = as->as_rss > as->as_wss ? as->as_rss - as->as_wss : 0;
+        if (excess > npages - evicted) {
+            excess = npages - evicted;
         }
-
-        /* place etnry in pagetable. */
-        result = pagetable_insert(as->pagetable, faultaddress, entryLo);
-        if (result != 0) {
-            return result;
+        if (excess > 0) {
+            evicted += vm_evict(as, excess);
         }
+        rwlock_release_write(as->as_lock);
+    }
 
-        /* Disable interrupts on this CPU and load the TLB. */
-	    int spl = splhigh();
-        tlb_random(faultaddress & TLBHI_VPAGE, entryLo);
-		splx(spl);
-
-        return 0;
+    wrapped = 0;
+    n = next_as;
+    while (evicted < npages) {
+        as = as_lock_nth(n);
+        if (as == NULL) {
+            /* off the end of the list: start again from the front once. */
+            if (wrapped || next_as == 0) {
+                break;
+            }
+            wrapped = 1;
+            n = 0;
+            continue;
+        }
+        evicted += vm_evict(as, npages - evicted);
+        rwlock_release_write(as->as_lock);
+        n++;
+        if (wrapped && n >= next_as) {
+            break;
+        }
     }
+    next_as = n;
 
-    /* faultaddress in invalid region exit with EFAULT. */
-    return EFAULT;
+    return evicted;
 }
 
 /*
- *
- * SMP-specific functions.  Unused in our configuration.
+ * drop this CPU's TLB entries for the pages in ts. called for our own
+ * changes by vm_tlbinvalidate, and for other CPUs' from
+ * interprocessor_interrupt. more pages than the TLB holds, or
+ * ts_npages of 0, flush the lot.
  */
-
-void
-vm_tlbshootdown(const struct tlbshootdown *ts)
-{
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
+void vm_tlbshootdown(const struct tlbshootdown *ts) {
+    unsigned n;
+    int i, spl;
+
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    spl = splhigh();
+    if (ts->ts_npages == 0 || ts->ts_npages > NUM_TLB) {
+        for (i = 0; i < NUM_TLB; i++) {
+            tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+        }
+    } else {
+        for (n = 0; n < ts->ts_npages; n++) {
+            i = tlb_probe((ts->ts_vaddr + n*PAGE_SIZE) & TLBHI_VPAGE, 0);
+            if (i >= 0) {
+                tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+            }
+        }
+    }
+    splx(spl);
 }
 
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Virtually contiguous kernel memory. See vmalloc.h.
+ *
+ * The vmalloc area starts at the bottom of kseg2 and is twice the size
+ * of physical memory, so running out of addresses is not a concern
+ * before running out of frames. The kernel pagetable is a flat array
+ * with one entry per page of the area, in the same format as a user
+ * pagetable entry. An entry of zero is a free page of the area; any
+ * other value means the page is reserved, mapped or not.
+ *
+ * Allocations are found first-fit, like alloc_multiple_frames does for
+ * frames. The entries of an allocation carry VMA_CONT on every page but
+ * the last, so vfree knows where it ends, and the guard page after it
+ * holds VMA_GUARD, which is never valid.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <machine/tlb.h>
+#include <vmalloc.h>
+
+#define VMALLOC_BASE    MIPS_KSEG2
+#define VMALLOC_MAXPAGES ((0xffffffff - VMALLOC_BASE + 1) / PAGE_SIZE)
+
+/* software bits in a kernel pagetable entry (below PTE_SWBITS). */
+#define VMA_CONT        0x00000001      /* allocation continues */
+#define VMA_GUARD       0x00000002      /* reserved, never mapped */
+
+/* vmalloc_spinlock protects everything below. */
+static struct spinlock vmalloc_spinlock = SPINLOCK_INITIALIZER;
+static paddr_t *vmalloc_pt;             /* kernel pagetable */
+static unsigned vmalloc_npages;         /* pages in the vmalloc area */
+
+static struct {
+	unsigned vs_inuse;              /* pages mapped now */
+	unsigned vs_allocs;             /* successful vmallocs */
+	unsigned vs_frees;              /* vfrees */
+	unsigned vs_fails;              /* vmallocs that failed */
+	unsigned vs_faults;             /* TLB misses handled */
+} vmalloc_stats;
+
+void
+vmalloc_bootstrap(void)
+{
+	paddr_t *pt;
+	unsigned npages, i;
+
+	npages = ram_getsize() / PAGE_SIZE * 2;
+	if (npages > VMALLOC_MAXPAGES) {
+		npages = VMALLOC_MAXPAGES;
+	}
+	pt = kmalloc(npages * sizeof(paddr_t));
+	if (pt == NULL) {
+		panic("vmalloc_bootstrap: Out of memory\n");
+	}
+	for (i = 0; i < npages; i++) {
+		pt[i] = 0;
+	}
+
+	spinlock_acquire(&vmalloc_spinlock);
+	vmalloc_pt = pt;
+	vmalloc_npages = npages;
+	spinlock_release(&vmalloc_spinlock);
+}
+
+/*
+ * Find and reserve NPAGES free pages of the area followed by a guard
+ * page. Returns the index of the first page, or vmalloc_npages if
+ * there is no room. The caller holds vmalloc_spinlock.
+ */
+static
+unsigned
+vmalloc_reserve(unsigned npages)
+{
+	unsigned i, j;
+
+	KASSERT(spinlock_do_i_hold(&vmalloc_spinlock));
+
+	/*
+	 * scan from 'i' for npages + 1 free entries. If a used entry is
+	 * encountered, restart the scan from after that point.
+	 */
+	i = 0; j = 0;
+	while (i + j < vmalloc_npages && j < npages + 1) {
+		if (vmalloc_pt[i + j] != 0) {
+			i = i + j + 1;
+			j = 0;
+		}
+		else {
+			j++;
+		}
+	}
+	if (j < npages + 1) {
+		return vmalloc_npages;
+	}
+
+	for (j = 0; j < npages + 1; j++) {
+		vmalloc_pt[i + j] = VMA_GUARD;
+	}
+	return i;
+}
+
+/*
+ * Release entries FIRST .. FIRST+NPAGES-1 and their guard page, and
+ * free whatever frames they map. The entries must not be valid.
+ */
+static
+void
+vmalloc_release(unsigned first, unsigned npages)
+{
+	paddr_t pte;
+	unsigned i;
+
+	/* the entries are still reserved, so nobody else touches them. */
+	for (i = first; i < first + npages; i++) {
+		pte = vmalloc_pt[i];
+		KASSERT((pte & TLBLO_VALID) == 0);
+		if ((pte & TLBLO_PPAGE) != 0) {
+			free_kpages(PADDR_TO_KVADDR(pte & TLBLO_PPAGE));
+		}
+	}
+
+	spinlock_acquire(&vmalloc_spinlock);
+	for (i = first; i < first + npages + 1; i++) {
+		vmalloc_pt[i] = 0;
+	}
+	spinlock_release(&vmalloc_spinlock);
+}
+
+void *
+vmalloc(size_t size)
+{
+	unsigned npages, first, i;
+	vaddr_t kvaddr;
+	paddr_t pte;
+
+	npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (npages == 0) {
+		npages = 1;
+	}
+
+	spinlock_acquire(&vmalloc_spinlock);
+	first = vmalloc_reserve(npages);
+	if (first == vmalloc_npages) {
+		vmalloc_stats.vs_fails++;
+		spinlock_release(&vmalloc_spinlock);
+		return NULL;
+	}
+	spinlock_release(&vmalloc_spinlock);
+
+	/*
+	 * Fill in the frames one at a time. alloc_kpages is called
+	 * without the lock held, and the entries stay invalid until the
+	 * whole allocation has its frames.
+	 */
+	for (i = 0; i < npages; i++) {
+		kvaddr = alloc_kpages(1);
+		if (kvaddr == 0) {
+			vmalloc_release(first, npages);
+			spinlock_acquire(&vmalloc_spinlock);
+			vmalloc_stats.vs_fails++;
+			spinlock_release(&vmalloc_spinlock);
+			return NULL;
+		}
+		pte = KVADDR_TO_PADDR(kvaddr) | TLBLO_DIRTY;
+		if (i < npages - 1) {
+			pte |= VMA_CONT;
+		}
+		spinlock_acquire(&vmalloc_spinlock);
+		vmalloc_pt[first + i] = pte;
+		spinlock_release(&vmalloc_spinlock);
+	}
+
+	spinlock_acquire(&vmalloc_spinlock);
+	for (i = 0; i < npages; i++) {
+		vmalloc_pt[first + i] |= TLBLO_VALID;
+	}
+	vmalloc_stats.vs_inuse += npages;
+	vmalloc_stats.vs_allocs++;
+	spinlock_release(&vmalloc_spinlock);
+
+	return (void *)(VMALLOC_BASE + first * PAGE_SIZE);
+}
+
+void
+vfree(void *ptr)
+{
+	vaddr_t vaddr;
+	unsigned first, i;
+
+	if (ptr == NULL) {
+		return;
+	}
+	vaddr = (vaddr_t)ptr;
+	KASSERT(vaddr >= VMALLOC_BASE);
+	KASSERT(vaddr % PAGE_SIZE == 0);
+	first = (vaddr - VMALLOC_BASE) / PAGE_SIZE;
+
+	/*
+	 * Make the pages invalid and unload them from every CPU's TLB,
+	 * so any use after this faults, then give back the frames. The
+	 * shootdown waits for the other CPUs, so it can't be done with
+	 * the spinlock held; the range isn't reusable until released.
+	 */
+	spinlock_acquire(&vmalloc_spinlock);
+	KASSERT(first < vmalloc_npages);
+	if ((vmalloc_pt[first] & TLBLO_VALID) == 0 ||
+	    (first > 0 && (vmalloc_pt[first - 1] & VMA_CONT) != 0)) {
+		panic("vfree: invalid pointer %p\n", ptr);
+	}
+	for (i = first; ; i++) {
+		KASSERT(vmalloc_pt[i] & TLBLO_VALID);
+		vmalloc_pt[i] &= ~(paddr_t)TLBLO_VALID;
+		if ((vmalloc_pt[i] & VMA_CONT) == 0) {
+			break;
+		}
+	}
+	KASSERT(vmalloc_pt[i + 1] == VMA_GUARD);
+	vmalloc_stats.vs_inuse -= i + 1 - first;
+	vmalloc_stats.vs_frees++;
+	spinlock_release(&vmalloc_spinlock);
+
+	vm_tlbinvalidate(NULL, vaddr, i + 1 - first);
+	vmalloc_release(first, i + 1 - first);
+}
+
+int
+vmalloc_fault(int faulttype, vaddr_t faultaddress)
+{
+	unsigned i;
+	paddr_t pte;
+
+	/* vmalloc pages are always writable. */
+	if (faulttype == VM_FAULT_READONLY || faultaddress < VMALLOC_BASE) {
+		return EFAULT;
+	}
+	i = (faultaddress - VMALLOC_BASE) / PAGE_SIZE;
+
+	/* the spinlock keeps interrupts off while loading the TLB. */
+	spinlock_acquire(&vmalloc_spinlock);
+	if (i >= vmalloc_npages || (vmalloc_pt[i] & TLBLO_VALID) == 0) {
+		spinlock_release(&vmalloc_spinlock);
+		return EFAULT;
+	}
+	pte = vmalloc_pt[i];
+	tlb_random(faultaddress & TLBHI_VPAGE, pte & ~(paddr_t)PTE_SWBITS);
+	vmalloc_stats.vs_faults++;
+	spinlock_release(&vmalloc_spinlock);
+
+	return 0;
+}
+
+void
+vmalloc_printstats(void)
+{
+	spinlock_acquire(&vmalloc_spinlock);
+	kprintf("vmalloc: %u of %u pages in use\n",
+		vmalloc_stats.vs_inuse, vmalloc_npages);
+	kprintf("vmalloc: %u allocs, %u frees, %u failed, %u TLB faults\n",
+		vmalloc_stats.vs_allocs, vmalloc_stats.vs_frees,
+		vmalloc_stats.vs_fails, vmalloc_stats.vs_faults);
+	spinlock_release(&vmalloc_spinlock);
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Working-set sampler. See wset.h.
+ *
+ * The estimate rises at once to the number of pages used in the last
+ * interval, and decays by half each interval after that, so that a
+ * process that pauses briefly does not immediately lose its pages to
+ * global reclaim.
+ *
+ * Once an address space's bits are cleared its TLB entries are shot
+ * down on every CPU running it, before as_lock is dropped, so that the
+ * next use of each page takes a refill and sets PTE_REF again.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <wset.h>
+
+/* seconds between samples. */
+#define WSET_INTERVAL 1
+
+static unsigned wset_samples;           /* passes made so far */
+
+/*
+ * Count and clear the reference bits of the pages of AS, fold the
+ * count into its estimate, and drop AS's TLB entries everywhere. The
+ * caller holds as_lock.
+ */
+static
+void
+wset_sample_as(struct addrspace *as)
+{
+	unsigned i, j, nref;
+
+	nref = 0;
+	for (i = 0; i < TABLE_SIZE; i++) {
+		if (as->pagetable[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < TABLE_SIZE; j++) {
+			if ((as->pagetable[i][j] & PTE_REF) != 0) {
+				as->pagetable[i][j] &= ~(paddr_t)PTE_REF;
+				nref++;
+			}
+		}
+	}
+
+	if (nref >= as->as_wss) {
+		as->as_wss = nref;
+	} else {
+		as->as_wss = (as->as_wss + nref) / 2;
+	}
+
+	/* with no bits cleared, no entry can be loaded either. */
+	if (nref > 0) {
+		vm_tlbinvalidate(as, 0, 0);
+	}
+}
+
+static
+void
+wset_thread(void *unused1, unsigned long unused2)
+{
+	struct addrspace *as;
+	unsigned n;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		for (n = 0; (as = as_lock_nth(n)) != NULL; n++) {
+			wset_sample_as(as);
+			rwlock_release_write(as->as_lock);
+		}
+
+		wset_samples++;
+		clocksleep(WSET_INTERVAL);
+	}
+}
+
+void
+wset_bootstrap(void)
+{
+	int result;
+
+	result = thread_fork("wset", NULL, wset_thread, NULL, 0);
+	if (result) {
+		panic("wset_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+void
+wset_printstats(void)
+{
+	struct addrspace *as;
+	unsigned n, rss, wss;
+
+	kprintf("Working sets after %u samples:\n", wset_samples);
+
+	rss = wss = 0;
+	for (n = 0; (as = as_lock_nth(n)) != NULL; n++) {
+		kprintf("    address space %u: %u pages resident, "
+			"%u in working set\n", n, as->as_rss, as->as_wss);
+		rss += as->as_rss;
+		wss += as->as_wss;
+		rwlock_release_write(as->as_lock);
+	}
+	kprintf("    total: %u pages resident, %u in working sets\n",
+		rss, wss);
+}
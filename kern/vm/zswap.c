@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compressed page store. See zswap.h.
+ *
+ * The pool is a set of zspages, each a single frame divided into
+ * equal objects of one size class. Classes go up in steps of
+ * ZS_CLASS_STEP bytes; a page that compresses to more than ZS_MAXOBJ
+ * is not worth keeping. Each object starts with its compressed length.
+ * A handle is the zspage number and the object's slot within it.
+ *
+ * To make progress when memory is completely exhausted, the pool keeps
+ * one spare frame. A new zspage comes from alloc_kpages if possible
+ * and from the spare otherwise, and the frame of the page being
+ * stored refills the spare if it is empty.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <lzcomp.h>
+#include <zswap.h>
+
+#define ZS_CLASS_SHIFT  6
+#define ZS_CLASS_STEP   (1 << ZS_CLASS_SHIFT)       /* class granularity */
+#define ZS_MAXOBJ       (PAGE_SIZE * 3 / 4)         /* largest object */
+#define ZS_NCLASSES     (ZS_MAXOBJ / ZS_CLASS_STEP)
+#define ZS_OBJHDR       2                           /* length prefix */
+
+/* handles are zspage << ZS_SLOTBITS | slot, and must fit in a PTE. */
+#define ZS_SLOTBITS     6
+#define ZS_MAXSLOTS     (PAGE_SIZE / ZS_CLASS_STEP)
+#define ZS_MAXPAGES     (1 << (32 - 12 - ZS_SLOTBITS))
+
+/* the pool may use at most this percentage of physical memory. */
+#define ZSWAP_POOL_PERCENT  25
+
+struct zspage {
+	vaddr_t zp_kvaddr;              /* the frame, or 0 if unused */
+	unsigned zp_class;              /* size class */
+	unsigned zp_nused;              /* objects allocated */
+	uint32_t zp_used[ZS_MAXSLOTS / 32]; /* bitmap of allocated slots */
+	struct zspage *zp_next;         /* next partly full zspage of class */
+};
+
+/* zswap_lock protects everything below. */
+static struct lock *zswap_lock;
+static struct zspage *zswap_pages;      /* zspage descriptors */
+static unsigned zswap_maxpages;         /* number of descriptors */
+static struct zspage *zswap_partial[ZS_NCLASSES]; /* with free slots */
+static vaddr_t zswap_spare;             /* reserve frame, or 0 */
+static void *zswap_work;                /* compressor scratch space */
+static unsigned char *zswap_buf;        /* compressor output */
+
+static struct {
+	unsigned zs_stored;             /* pages in the pool now */
+	unsigned zs_bytes;              /* their compressed size */
+	unsigned zs_poolpages;          /* zspages in use */
+	unsigned zs_stores;             /* pages ever stored */
+	unsigned zs_loads;              /* pages ever loaded */
+	unsigned zs_rejects;            /* did not compress well enough */
+	unsigned zs_full;               /* pool was full */
+} zswap_stats;
+
+void
+zswap_bootstrap(void)
+{
+	unsigned i;
+
+	zswap_lock = lock_create("zswap");
+	zswap_work = kmalloc(LZ_WORKSIZE);
+	zswap_buf = kmalloc(ZS_MAXOBJ);
+	zswap_spare = alloc_kpages(1);
+	if (zswap_lock == NULL || zswap_work == NULL || zswap_buf == NULL ||
+	    zswap_spare == 0) {
+		panic("zswap_bootstrap: Out of memory\n");
+	}
+
+	zswap_maxpages = ram_getsize() / PAGE_SIZE * ZSWAP_POOL_PERCENT / 100;
+	if (zswap_maxpages > ZS_MAXPAGES) {
+		zswap_maxpages = ZS_MAXPAGES;
+	}
+	zswap_pages = kmalloc(zswap_maxpages * sizeof(struct zspage));
+	if (zswap_pages == NULL) {
+		panic("zswap_bootstrap: Out of memory\n");
+	}
+	for (i = 0; i < zswap_maxpages; i++) {
+		zswap_pages[i].zp_kvaddr = 0;
+	}
+	for (i = 0; i < ZS_NCLASSES; i++) {
+		zswap_partial[i] = NULL;
+	}
+
+	COMPILE_ASSERT(ZS_MAXSLOTS <= (1 << ZS_SLOTBITS));
+}
+
+static
+unsigned
+zs_objsize(unsigned class)
+{
+	return (class + 1) * ZS_CLASS_STEP;
+}
+
+static
+unsigned
+zs_nslots(unsigned class)
+{
+	return PAGE_SIZE / zs_objsize(class);
+}
+
+/*
+ * Set up a new zspage for CLASS, taking a frame from the allocator or
+ * else from the spare.
+ */
+static
+struct zspage *
+zs_newpage(unsigned class)
+{
+	struct zspage *zp;
+	unsigned i;
+
+	for (i = 0; i < zswap_maxpages; i++) {
+		if (zswap_pages[i].zp_kvaddr == 0) {
+			break;
+		}
+	}
+	if (i == zswap_maxpages) {
+		return NULL;
+	}
+	zp = &zswap_pages[i];
+
+	zp->zp_kvaddr = alloc_kpages(1);
+	if (zp->zp_kvaddr == 0) {
+		if (zswap_spare == 0) {
+			return NULL;
+		}
+		zp->zp_kvaddr = zswap_spare;
+		zswap_spare = 0;
+	}
+
+	zp->zp_class = class;
+	zp->zp_nused = 0;
+	for (i = 0; i < ZS_MAXSLOTS / 32; i++) {
+		zp->zp_used[i] = 0;
+	}
+	zp->zp_next = zswap_partial[class];
+	zswap_partial[class] = zp;
+	zswap_stats.zs_poolpages++;
+
+	return zp;
+}
+
+/*
+ * Take ZP off its class's list of partly full zspages.
+ */
+static
+void
+zs_unlink(struct zspage *zp)
+{
+	struct zspage **prevp;
+
+	for (prevp = &zswap_partial[zp->zp_class]; *prevp != zp;
+	     prevp = &(*prevp)->zp_next) {
+		KASSERT(*prevp != NULL);
+	}
+	*prevp = zp->zp_next;
+	zp->zp_next = NULL;
+}
+
+/*
+ * Give back a frame: it refills the spare if that is empty.
+ */
+static
+void
+zs_putframe(vaddr_t kvaddr)
+{
+	if (zswap_spare == 0) {
+		zswap_spare = kvaddr;
+	} else {
+		free_kpages(kvaddr);
+	}
+}
+
+/*
+ * Find the object for HANDLE. The caller holds zswap_lock.
+ */
+static
+unsigned char *
+zs_object(unsigned handle, struct zspage **zpret, unsigned *slotret)
+{
+	struct zspage *zp;
+	unsigned slot;
+
+	slot = handle & ((1 << ZS_SLOTBITS) - 1);
+	KASSERT((handle >> ZS_SLOTBITS) < zswap_maxpages);
+	zp = &zswap_pages[handle >> ZS_SLOTBITS];
+	KASSERT(zp->zp_kvaddr != 0);
+	KASSERT(slot < zs_nslots(zp->zp_class));
+	KASSERT(zp->zp_used[slot / 32] & (1U << (slot % 32)));
+
+	*zpret = zp;
+	*slotret = slot;
+	return (unsigned char *)zp->zp_kvaddr + slot * zs_objsize(zp->zp_class);
+}
+
+int
+zswap_store(vaddr_t kvaddr, unsigned *handle)
+{
+	struct zspage *zp;
+	unsigned char *obj;
+	unsigned class, slot;
+	size_t len;
+
+	lock_acquire(zswap_lock);
+
+	len = lz_compress((void *)kvaddr, PAGE_SIZE, zswap_buf,
+			  ZS_MAXOBJ - ZS_OBJHDR, zswap_work);
+	if (len == 0) {
+		zswap_stats.zs_rejects++;
+		lock_release(zswap_lock);
+		return ENOSPC;
+	}
+	class = (len + ZS_OBJHDR - 1) >> ZS_CLASS_SHIFT;
+
+	zp = zswap_partial[class];
+	if (zp == NULL) {
+		zp = zs_newpage(class);
+		if (zp == NULL) {
+			zswap_stats.zs_full++;
+			lock_release(zswap_lock);
+			return ENOSPC;
+		}
+	}
+
+	/* find a free slot; there must be one on a partly full zspage. */
+	for (slot = 0; zp->zp_used[slot / 32] & (1U << (slot % 32)); slot++) {
+		KASSERT(slot < zs_nslots(class));
+	}
+	zp->zp_used[slot / 32] |= 1U << (slot % 32);
+	zp->zp_nused++;
+	if (zp->zp_nused == zs_nslots(class)) {
+		zs_unlink(zp);
+	}
+
+	obj = (unsigned char *)zp->zp_kvaddr + slot * zs_objsize(class);
+	obj[0] = len & 0xff;
+	obj[1] = len >> 8;
+	memcpy(obj + ZS_OBJHDR, zswap_buf, len);
+
+	*handle = (zp - zswap_pages) << ZS_SLOTBITS | slot;
+
+	zswap_stats.zs_stored++;
+	zswap_stats.zs_bytes += len;
+	zswap_stats.zs_stores++;
+
+	/* the page's frame is ours now. */
+	zs_putframe(kvaddr);
+
+	lock_release(zswap_lock);
+	return 0;
+}
+
+int
+zswap_load(unsigned handle, vaddr_t kvaddr)
+{
+	struct zspage *zp;
+	unsigned char *obj;
+	unsigned slot;
+	int result;
+
+	lock_acquire(zswap_lock);
+	obj = zs_object(handle, &zp, &slot);
+	result = lz_decompress(obj + ZS_OBJHDR, obj[0] | obj[1] << 8,
+			       (void *)kvaddr, PAGE_SIZE);
+	if (result == 0) {
+		zswap_stats.zs_loads++;
+	}
+	lock_release(zswap_lock);
+
+	return result;
+}
+
+void
+zswap_free(unsigned handle)
+{
+	struct zspage *zp;
+	unsigned char *obj;
+	unsigned slot;
+
+	lock_acquire(zswap_lock);
+	obj = zs_object(handle, &zp, &slot);
+
+	zswap_stats.zs_stored--;
+	zswap_stats.zs_bytes -= obj[0] | obj[1] << 8;
+
+	if (zp->zp_nused == zs_nslots(zp->zp_class)) {
+		/* it was full; now it has room again. */
+		zp->zp_next = zswap_partial[zp->zp_class];
+		zswap_partial[zp->zp_class] = zp;
+	}
+	zp->zp_used[slot / 32] &= ~(1U << (slot % 32));
+	zp->zp_nused--;
+
+	if (zp->zp_nused == 0) {
+		zs_unlink(zp);
+		zs_putframe(zp->zp_kvaddr);
+		zp->zp_kvaddr = 0;
+		zswap_stats.zs_poolpages--;
+	}
+
+	lock_release(zswap_lock);
+}
+
+void
+zswap_printstats(void)
+{
+	lock_acquire(zswap_lock);
+
+	kprintf("zswap status:\n");
+	kprintf("    %u pages stored in %u of %u pool frames\n",
+		zswap_stats.zs_stored, zswap_stats.zs_poolpages,
+		zswap_maxpages);
+	if (zswap_stats.zs_stored > 0) {
+		kprintf("    %u bytes compressed from %u (%u%%)\n",
+			zswap_stats.zs_bytes,
+			zswap_stats.zs_stored * PAGE_SIZE,
+			zswap_stats.zs_bytes * 100 /
+			(zswap_stats.zs_stored * PAGE_SIZE));
+	}
+	kprintf("    %u stores, %u loads, %u incompressible, %u pool full\n",
+		zswap_stats.zs_stores, zswap_stats.zs_loads,
+		zswap_stats.zs_rejects, zswap_stats.zs_full);
+
+	lock_release(zswap_lock);
+}
@@ -39,7 +39,9 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
@@ -57,6 +59,10 @@
  *     fstat:    sys/stat.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
+ *     getrlimit: sys/resource.h
+ *     setrlimit: sys/resource.h
+ *     getpriority: sys/resource.h
+ *     setpriority: sys/resource.h
  *
  * If this were standard Unix, more prototypes would go in other
  * header files as well, as follows:
@@ -147,6 +153,7 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
@@ -164,10 +171,71 @@ time_t time(time_t *seconds);			/* calls __time */
  * You should implement this version as this is what we expect to test.
  */
 
-#define PROT_READ 1
-#define PROT_WRITE 2
+/* PROT_READ and PROT_WRITE come from <kern/mman.h>. */
 
 void *mmap(size_t length, int prot, int fd, off_t offset);
 int munmap(void *addr);
 
+/*
+ * Paging hints; ADVICE is one of the MADV_* codes from <kern/mman.h>.
+ * ADDR must be page-aligned.
+ */
+int madvise(void *addr, size_t len, int advice);
+
+/*
+ * OS/161 shared memory. shmmap() maps LEN bytes of shared memory with
+ * protection PROT (PROT_READ and/or PROT_WRITE) and returns its
+ * address. With a NULL NAME the segment is anonymous and is shared
+ * only with children created by fork() afterwards; otherwise it is the
+ * segment called NAME, created if need be, which any process may map.
+ * shmunmap() takes the address shmmap() returned. shmunlink() removes
+ * a name; the segment is freed once nothing maps it.
+ */
+void *shmmap(const char *name, size_t len, int prot);
+int shmunmap(void *addr);
+int shmunlink(const char *name);
+
+/*
+ * Wait and wake on a word of memory, for building user-level locks.
+ * OP is FUTEX_WAIT or FUTEX_WAKE from <kern/futex.h>. FUTEX_WAIT
+ * sleeps while *UADDR == VAL (failing with EAGAIN if it is not);
+ * FUTEX_WAKE wakes up to VAL sleepers and returns how many it woke.
+ * Words in memory from shmmap() work across processes.
+ */
+int futex(volatile int *uaddr, int op, int val);
+
+/*
+ * Threads. thread_create() starts a thread running FUNC(ARG) in this
+ * process, on a stack of its own, and returns its thread ID. The
+ * thread ends by returning from FUNC or calling thread_exit(), and
+ * thread_join() waits for it and collects the value; each thread can
+ * be joined once, and only threads made by thread_create() can be. If
+ * the last thread calls thread_exit() the process exits with that
+ * status; _exit() from any thread ends all of them. execv() fails
+ * with EBUSY while there are other threads.
+ *
+ * Note that malloc() is not thread-safe; use futex() to build a lock
+ * around it. printf() is, but output from different threads may be
+ * interleaved.
+ */
+int __thread_create(void (*entry)(int (*)(void *), void *),
+		    int (*func)(void *), void *arg);
+int thread_create(int (*func)(void *), void *arg); /* calls __thread_create */
+int thread_join(int tid, int *status);
+__DEAD void thread_exit(int status);
+
+/*
+ * CPU affinity. setaffinity() limits the process to the cpus in MASK,
+ * bit N being cpu N, and getaffinity() returns the mask. pset_bind()
+ * binds the process to processor set PSET and returns the set it was
+ * bound to; with PSET -1 it only returns that. Cpus are put in sets
+ * with the kernel menu's pset command, and all start in set 0. Both
+ * apply to every thread in the process and are inherited by threads
+ * and children made afterwards. They fail with EINVAL if the mask and
+ * the set would have no cpu in common.
+ */
+int setaffinity(unsigned mask);
+int getaffinity(unsigned *mask);
+int pset_bind(int pset);
+
 #endif /* _UNISTD_H_ */
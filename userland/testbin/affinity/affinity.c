@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * affinity - test setaffinity(), getaffinity() and pset_bind().
+ *
+ * Pins the process to each cpu in turn, doing some work on each and
+ * checking that the mask sticks and is inherited by a thread and by
+ * a child; then checks the error cases. Which cpu the work actually
+ * runs on can't be seen from here; watch with the kernel's thread
+ * debugging on for that.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NLOOPS   20000
+
+static unsigned expected;
+
+static
+void
+checkmask(const char *who)
+{
+	unsigned mask;
+
+	if (getaffinity(&mask) < 0) {
+		err(1, "%s: getaffinity", who);
+	}
+	if (mask != expected) {
+		errx(1, "%s: mask is 0x%x, expected 0x%x", who, mask,
+		     expected);
+	}
+}
+
+static
+void
+work(void)
+{
+	volatile unsigned x;
+	unsigned i;
+
+	x = 0;
+	for (i=0; i<NLOOPS; i++) {
+		x += i;
+		if (i % 1000 == 0) {
+			getpid();
+		}
+	}
+}
+
+static
+int
+threadfunc(void *arg)
+{
+	(void)arg;
+	checkmask("thread");
+	work();
+	return 0;
+}
+
+static
+void
+pin(unsigned mask)
+{
+	pid_t pid;
+	int tid, status;
+
+	if (setaffinity(mask) < 0) {
+		err(1, "setaffinity 0x%x", mask);
+	}
+	expected = mask;
+	checkmask("main");
+
+	tid = thread_create(threadfunc, NULL);
+	if (tid < 0) {
+		err(1, "thread_create");
+	}
+	work();
+	if (thread_join(tid, &status) < 0) {
+		err(1, "thread_join");
+	}
+	if (status != 0) {
+		errx(1, "thread failed");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		checkmask("child");
+		work();
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+int
+main(void)
+{
+	unsigned all, bit;
+	int pset, ncpus;
+
+	if (getaffinity(&all) < 0) {
+		err(1, "getaffinity");
+	}
+	if (all == 0) {
+		errx(1, "Empty affinity mask");
+	}
+
+	ncpus = 0;
+	for (bit = 1; bit != 0; bit <<= 1) {
+		if (all & bit) {
+			pin(bit);
+			ncpus++;
+		}
+	}
+	pin(all);
+	printf("Pinned to each of %d cpus\n", ncpus);
+
+	if (setaffinity(0) == 0 || errno != EINVAL) {
+		errx(1, "setaffinity with an empty mask didn't fail");
+	}
+	checkmask("main");
+
+	pset = pset_bind(-1);
+	if (pset < 0) {
+		err(1, "pset_bind query");
+	}
+	if (pset_bind(pset) != pset) {
+		err(1, "pset_bind %d", pset);
+	}
+	if (pset_bind(1000) == 0 || errno != EINVAL) {
+		errx(1, "pset_bind to a bad set didn't fail");
+	}
+	if (pset_bind(-1) != pset) {
+		errx(1, "pset_bind changed the set");
+	}
+	printf("In processor set %d\n", pset);
+
+	printf("affinity done.\n");
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * exitsleep - check that _exit doesn't wait for sleeping threads.
+ *
+ * A child process starts one thread that goes to sleep in nanosleep
+ * and another that waits for a grandchild that also sleeps, then
+ * calls _exit from its main thread. Both waits should be cut short,
+ * so the parent's waitpid should return well before either sleep
+ * would have ended.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+#define SLEEPSECS	30	/* how long the sleepers ask for */
+#define MAXSECS		10	/* how long the exit may take */
+
+static
+int
+sleeper(void *unused)
+{
+	struct timespec ts;
+
+	(void)unused;
+
+	ts.tv_sec = SLEEPSECS;
+	ts.tv_nsec = 0;
+	nanosleep(&ts, NULL);
+	return 0;
+}
+
+static
+int
+waiter(void *pidp)
+{
+	int status;
+
+	waitpid(*(pid_t *)pidp, &status, 0);
+	return 0;
+}
+
+static
+void
+child(void)
+{
+	struct timespec ts;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		sleeper(NULL);
+		_exit(0);
+	}
+
+	if (thread_create(sleeper, NULL) < 0) {
+		err(1, "thread_create");
+	}
+	if (thread_create(waiter, &pid) < 0) {
+		err(1, "thread_create");
+	}
+
+	/* give them time to go to sleep. */
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+	nanosleep(&ts, NULL);
+	_exit(0);
+}
+
+int
+main(void)
+{
+	time_t start, end;
+	pid_t pid;
+	int status;
+
+	start = time(NULL);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		child();
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	end = time(NULL);
+
+	if (end - start >= MAXSECS) {
+		errx(1, "exit took %d seconds; it waited for its sleepers",
+		     (int)(end - start));
+	}
+	printf("exitsleep: passed (%d seconds)\n", (int)(end - start));
+	return 0;
+}
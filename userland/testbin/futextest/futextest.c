@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futextest - test futex().
+ *
+ * Checks the simple cases of FUTEX_WAIT and FUTEX_WAKE, that a wake
+ * reaches a process sleeping on a word of shared memory, and then
+ * has several processes share a counter under a futex-based mutex
+ * that only enters the kernel when it is contended.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NPROCS   4
+#define NLOOPS   500
+
+struct shared {
+	volatile int mutex;     /* 0 free, 1 held, 2 held with waiters */
+	volatile int counter;
+	volatile int word;
+	volatile int done;
+};
+
+/*
+ * Atomically store VAL in *P and return what was there, using the
+ * LL/SC instructions as the kernel's spinlocks do.
+ */
+static
+int
+xchg(volatile int *p, int val)
+{
+	int old, ok;
+
+	do {
+		ok = val;
+		__asm volatile(
+			".set push;"
+			".set mips32;"
+			".set volatile;"
+			"ll %0, 0(%2);"
+			"sc %1, 0(%2);"
+			".set pop"
+			: "=&r" (old), "+r" (ok) : "r" (p));
+	} while (ok == 0);
+	return old;
+}
+
+static
+void
+mutex_lock(volatile int *m)
+{
+	if (xchg(m, 1) == 0) {
+		return;
+	}
+	/* Contended: mark that there are waiters, and sleep. */
+	while (xchg(m, 2) != 0) {
+		if (futex(m, FUTEX_WAIT, 2) < 0 && errno != EAGAIN) {
+			err(1, "futex wait");
+		}
+	}
+}
+
+static
+void
+mutex_unlock(volatile int *m)
+{
+	if (xchg(m, 0) == 2) {
+		if (futex(m, FUTEX_WAKE, 1) < 0) {
+			err(1, "futex wake");
+		}
+	}
+}
+
+static
+void
+waitforchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+static
+void
+simple(struct shared *sh)
+{
+	sh->word = 5;
+	if (futex(&sh->word, FUTEX_WAIT, 4) != -1 || errno != EAGAIN) {
+		errx(1, "FUTEX_WAIT on a changed word did not fail with "
+		     "EAGAIN");
+	}
+	if (futex(&sh->word, FUTEX_WAKE, 1) != 0) {
+		errx(1, "FUTEX_WAKE with no sleepers did not return 0");
+	}
+	if (futex((volatile int *)((char *)&sh->word + 1),
+		  FUTEX_WAKE, 1) != -1 || errno != EINVAL) {
+		errx(1, "Misaligned futex did not fail with EINVAL");
+	}
+	if (futex(&sh->word, 99, 0) != -1 || errno != EINVAL) {
+		errx(1, "Bad futex op did not fail with EINVAL");
+	}
+	printf("Simple cases passed\n");
+}
+
+static
+void
+wakeup(struct shared *sh)
+{
+	pid_t pid;
+
+	sh->word = 0;
+	sh->done = 0;
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		while (sh->word == 0) {
+			if (futex(&sh->word, FUTEX_WAIT, 0) < 0 &&
+			    errno != EAGAIN) {
+				err(1, "futex wait");
+			}
+		}
+		sh->done = 1;
+		_exit(0);
+	}
+
+	sh->word = 1;
+	while (sh->done == 0) {
+		if (futex(&sh->word, FUTEX_WAKE, 1) < 0) {
+			err(1, "futex wake");
+		}
+	}
+	waitforchild(pid);
+	printf("Wakeup across processes passed\n");
+}
+
+static
+void
+counting(struct shared *sh)
+{
+	pid_t pids[NPROCS];
+	int i, j, val;
+
+	sh->mutex = 0;
+	sh->counter = 0;
+	for (i=0; i<NPROCS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			for (j=0; j<NLOOPS; j++) {
+				mutex_lock(&sh->mutex);
+				val = sh->counter;
+				/* widen the window a little */
+				if (j % 16 == 0) {
+					getpid();
+				}
+				sh->counter = val + 1;
+				mutex_unlock(&sh->mutex);
+			}
+			_exit(0);
+		}
+	}
+	for (i=0; i<NPROCS; i++) {
+		waitforchild(pids[i]);
+	}
+	if (sh->counter != NPROCS * NLOOPS) {
+		errx(1, "Counter is %d, expected %d", sh->counter,
+		     NPROCS * NLOOPS);
+	}
+	printf("Mutex counting passed\n");
+}
+
+int
+main(void)
+{
+	struct shared *sh;
+
+	sh = shmmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE);
+	if (sh == (void *)-1) {
+		err(1, "shmmap");
+	}
+
+	simple(sh);
+	wakeup(sh);
+	counting(sh);
+
+	printf("futextest done.\n");
+	return 0;
+}
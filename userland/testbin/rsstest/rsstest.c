@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rsstest - test resident set size limits.
+ *
+ * Sets a small RLIMIT_RSS, then touches an array several times that
+ * size and checks that every page still holds what was written to it
+ * once the kernel has had to trim the process to fit. Also checks
+ * that the limit is inherited by fork and that the hard limit cannot
+ * be raised.
+ */
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGESIZE   4096
+#define NPAGES     128                          /* size of the array */
+#define LIMITPAGES 16                           /* RSS limit */
+#define NWORDS     (PAGESIZE / sizeof(unsigned))
+
+static volatile unsigned data[NPAGES][NWORDS];
+
+/*
+ * Fill page P with a pattern that compresses well but differs from
+ * every other page.
+ */
+static
+void
+fill(unsigned p)
+{
+	unsigned i;
+
+	for (i=0; i<NWORDS; i++) {
+		data[p][i] = (i % 16 == 0) ? p : 0xdeadbeef;
+	}
+}
+
+static
+void
+check(unsigned p)
+{
+	unsigned i, want;
+
+	for (i=0; i<NWORDS; i++) {
+		want = (i % 16 == 0) ? p : 0xdeadbeef;
+		if (data[p][i] != want) {
+			errx(1, "page %u word %u is 0x%x, should be 0x%x",
+			     p, i, data[p][i], want);
+		}
+	}
+}
+
+static
+void
+touchall(void)
+{
+	unsigned p;
+
+	for (p=0; p<NPAGES; p++) {
+		fill(p);
+	}
+	for (p=0; p<NPAGES; p++) {
+		check(p);
+	}
+	/* and once more, backwards. */
+	for (p=NPAGES; p-- > 0; ) {
+		check(p);
+	}
+}
+
+int
+main(void)
+{
+	struct rlimit rl;
+	pid_t pid;
+	int status;
+
+	rl.rlim_cur = LIMITPAGES * PAGESIZE;
+	rl.rlim_max = LIMITPAGES * PAGESIZE * 2;
+	if (setrlimit(RLIMIT_RSS, &rl) < 0) {
+		err(1, "setrlimit");
+	}
+	rl.rlim_cur = rl.rlim_max = 0;
+	if (getrlimit(RLIMIT_RSS, &rl) < 0) {
+		err(1, "getrlimit");
+	}
+	if (rl.rlim_cur != LIMITPAGES * PAGESIZE ||
+	    rl.rlim_max != LIMITPAGES * PAGESIZE * 2) {
+		errx(1, "getrlimit returned the wrong limits");
+	}
+
+	printf("Touching %d pages with a limit of %d...\n",
+	       NPAGES, LIMITPAGES);
+	touchall();
+
+	printf("Again in a child...\n");
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (getrlimit(RLIMIT_RSS, &rl) < 0) {
+			err(1, "child: getrlimit");
+		}
+		if (rl.rlim_cur != LIMITPAGES * PAGESIZE) {
+			errx(1, "child: limit not inherited");
+		}
+		touchall();
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+
+	rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+	if (setrlimit(RLIMIT_RSS, &rl) == 0) {
+		errx(1, "setrlimit raised the hard limit");
+	}
+	if (errno != EPERM) {
+		err(1, "setrlimit raising the hard limit");
+	}
+	if (setrlimit(RLIMIT_NOFILE, &rl) == 0 || errno != EINVAL) {
+		errx(1, "setrlimit accepted RLIMIT_NOFILE");
+	}
+
+	printf("Passed rsstest.\n");
+	return 0;
+}
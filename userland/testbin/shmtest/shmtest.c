@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * shmtest - test shared memory.
+ *
+ * Checks that an anonymous shmmap() region is shared with a child
+ * created by fork, that two processes mapping the same named segment
+ * see each other's writes, and a few error cases.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NPAGES   4
+#define PAGESIZE 4096
+#define NWORDS   (NPAGES * PAGESIZE / sizeof(unsigned))
+#define SEGNAME  "shmtest"
+
+/*
+ * Fork, run FUNC on SEG in the child, and wait for it to exit.
+ */
+static
+void
+inchild(void (*func)(volatile unsigned *), volatile unsigned *seg)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		func(seg);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+static
+void
+fill(volatile unsigned *seg, unsigned base)
+{
+	unsigned i;
+
+	for (i=0; i<NWORDS; i++) {
+		seg[i] = base + i;
+	}
+}
+
+static
+void
+check(volatile unsigned *seg, unsigned base)
+{
+	unsigned i;
+
+	for (i=0; i<NWORDS; i++) {
+		if (seg[i] != base + i) {
+			errx(1, "word %u is %u, should be %u",
+			     i, seg[i], base + i);
+		}
+	}
+}
+
+static
+void
+anonchild(volatile unsigned *seg)
+{
+	check(seg, 1000);
+	fill(seg, 2000);
+}
+
+static
+void
+namedchild(volatile unsigned *seg)
+{
+	volatile unsigned *myseg;
+
+	(void)seg;
+
+	myseg = shmmap(SEGNAME, NPAGES * PAGESIZE, PROT_READ|PROT_WRITE);
+	if (myseg == (void *)-1) {
+		err(1, "child: shmmap %s", SEGNAME);
+	}
+	check(myseg, 3000);
+	fill(myseg, 4000);
+	if (shmunmap((void *)myseg)) {
+		err(1, "child: shmunmap");
+	}
+}
+
+static
+void
+testanon(void)
+{
+	volatile unsigned *seg;
+
+	printf("Anonymous segment shared across fork...\n");
+	seg = shmmap(NULL, NPAGES * PAGESIZE, PROT_READ|PROT_WRITE);
+	if (seg == (void *)-1) {
+		err(1, "shmmap");
+	}
+	fill(seg, 1000);
+	inchild(anonchild, seg);
+	check(seg, 2000);
+	if (shmunmap((void *)seg)) {
+		err(1, "shmunmap");
+	}
+}
+
+static
+void
+testnamed(void)
+{
+	volatile unsigned *seg;
+
+	printf("Named segment mapped separately by two processes...\n");
+	seg = shmmap(SEGNAME, NPAGES * PAGESIZE, PROT_READ|PROT_WRITE);
+	if (seg == (void *)-1) {
+		err(1, "shmmap %s", SEGNAME);
+	}
+	fill(seg, 3000);
+	inchild(namedchild, seg);
+	check(seg, 4000);
+	if (shmunlink(SEGNAME)) {
+		err(1, "shmunlink");
+	}
+	/* still mapped, so the data must survive the unlink. */
+	check(seg, 4000);
+	if (shmunmap((void *)seg)) {
+		err(1, "shmunmap");
+	}
+}
+
+static
+void
+testerrors(void)
+{
+	static int notshared;
+
+	printf("Error cases...\n");
+	if (shmmap(NULL, 0, PROT_READ) != (void *)-1 || errno != EINVAL) {
+		errx(1, "shmmap of length 0 did not fail with EINVAL");
+	}
+	if (shmmap(NULL, PAGESIZE, 0) != (void *)-1 || errno != EINVAL) {
+		errx(1, "shmmap with no access did not fail with EINVAL");
+	}
+	if (shmunlink(SEGNAME) != -1 || errno != ENOENT) {
+		errx(1, "shmunlink of removed name did not fail with ENOENT");
+	}
+	if (shmunmap(&notshared) != -1 || errno != EINVAL) {
+		errx(1, "shmunmap of data segment did not fail with EINVAL");
+	}
+}
+
+int
+main(void)
+{
+	testanon();
+	testnamed();
+	testerrors();
+	printf("shmtest: passed\n");
+	return 0;
+}
@@ -29,20 +29,12 @@
 
 /*
  * Test multiple user level threads inside a process. The program
- * forks 3 threads off 2 to functions, each of which displays a string
- * every once in a while.
+ * starts 3 threads running 2 functions, each of which displays a
+ * string every once in a while, and then waits for them all.
  *
- * This won't do much of anything unless you implement user-level
- * threads.
- *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
+ * The threads are made with thread_create() and collected with
+ * thread_join(). Returning from main() calls exit(), which ends the
+ * whole process, so the main thread has to wait for the others.
  *
  * This is also a rather basic test and you'll probably want to write
  * some more of your own.
@@ -51,6 +43,7 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <err.h>
 
 #define NTHREADS  3
 #define MAX       1<<25
@@ -61,49 +54,66 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+int ThreadRunner(void *);
+int BladeRunner(void *);
 
 int
 main(int argc, char *argv[])
 {
-    int i;
+    int nums[NTHREADS], tids[NTHREADS];
+    int i, status;
 
     (void)argc;
     (void)argv;
 
     for (i=0; i<NTHREADS; i++) {
+	nums[i] = i;
 	if (i)
-	    threadfork(ThreadRunner);
+	    tids[i] = thread_create(ThreadRunner, &nums[i]);
         else
-	    threadfork(BladeRunner);
+	    tids[i] = thread_create(BladeRunner, &nums[i]);
+	if (tids[i] < 0) {
+	    err(1, "thread_create");
+	}
+    }
+
+    for (i=0; i<NTHREADS; i++) {
+	if (thread_join(tids[i], &status) < 0) {
+	    err(1, "thread_join");
+	}
+	if (status != i) {
+	    errx(1, "thread %d returned %d", tids[i], status);
+	}
     }
 
-    printf("Parent has left.\n");
+    printf("\nParent has left.\n");
     return 0;
 }
 
 /* multiple threads will simply print out the global variable.
    Even though there is no synchronization, we should get some
-   random results.
+   random results. Each returns the number it was given, for
+   main to check.
 */
 
-void
-BladeRunner()
+int
+BladeRunner(void *num)
 {
     while (count < MAX) {
 	if (count % 500 == 0)
 	    printf("Blade ");
 	count++;
     }
+    return *(int *)num;
 }
 
-void
-ThreadRunner()
+int
+ThreadRunner(void *num)
 {
     while (count < MAX) {
 	if (count % 513 == 0)
 	    printf(" Runner\n");
 	count++;
     }
+    return *(int *)num;
 }